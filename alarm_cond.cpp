@@ -13,263 +13,71 @@
  *  ported to C++11; ck
  *  use steady_clock instead of system_clock! ck
  *  use strstream instead of stdio! ck
+ *  use the TimerService instead of the sorted alarm list! ck
+ *
+ * The sorted alarm list took O(n) for each insert. The TimerService keeps
+ * the alarms in a hierarchical timing wheel (O(1) insert and cancel), its
+ * expiry thread is the alarm thread and hands the due alarms to a
+ * QueuedThreadPool.
  */
 
+#include "threadpool.hpp" // TimerService, QueuedThreadPool
+
 #include <stdlib.h> // exit()
 
-#include <cassert> // assert()
 #include <iostream>
 #include <sstream>
 #include <string>
 
-#if defined(__cplusplus) && (__cplusplus >= 201103L)
-#    include <chrono>
-#    include <condition_variable>
-#    include <mutex>
-#    include <thread>
-
-using std::chrono::duration;
-using std::chrono::seconds;
-using std::chrono::steady_clock;
-using std::chrono::system_clock;
-using std::chrono::time_point;
-using namespace std;
-
-#else //##########################################
-
-#    include <boost/thread.hpp>
-#    include <boost/thread/condition_variable.hpp>
-#    include <boost/thread/mutex.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/current_function.hpp>
+#include <boost/thread/mutex.hpp>
 
+using Agentpp::QueuedThreadPool;
+using Agentpp::TimerService;
 using boost::chrono::duration;
 using boost::chrono::seconds;
-using boost::chrono::steady_clock;
-using boost::chrono::system_clock;
-using boost::chrono::time_point;
-using namespace boost;
-#endif //##########################################
 
-#include <boost/algorithm/string/trim.hpp>
-#include <boost/current_function.hpp>
+typedef TimerService::clock steady_clock;
 
 #ifdef NDEBUG
 #    define TRACE(x)
 #else
 static void TRACE(const std::string& msg)
 {
-    static mutex _mut; // private mutex only!
-    lock_guard<mutex> lk(_mut);
+    static boost::mutex _mut; // private mutex only!
+    boost::lock_guard<boost::mutex> lk(_mut);
     std::cerr << msg << std::endl;
 }
-#    define VERBOSE
-#endif
-
-namespace Alarm
-{
-/*
- * The "alarm" structure now contains the time_t (time since the Epoch, in
- * seconds) for each alarm, so that they can be sorted. Storing the requested
- * number of seconds would not be enough, since the "alarm thread" cannot tell
- * how long it has been on the list.
- */
-typedef struct alarm_tag {
-    struct alarm_tag* link;
-    time_t seconds;
-    time_point<steady_clock> time;
-    std::string message;
-} alarm_t;
-} // namespace Alarm
-
-//==================================
-// shared data, mutex, and condition
-mutex alarm_mutex;
-condition_variable alarm_cond;
-Alarm::alarm_t* alarm_list = NULL;
-time_point<steady_clock> current_alarm(seconds(0LL));
-const time_point<steady_clock> ZERO(seconds(0LL));
-bool enabled = true;
-//==================================
-
-/*
- * Insert alarm entry on list, in order of time.
- */
-static time_point<steady_clock> alarm_insert(Alarm::alarm_t* alarm)
-{
-    static Alarm::alarm_t* longest(NULL);
-    Alarm::alarm_t **last, *next;
-
-    assert(alarm != NULL);
-
-    /*
-     * LOCKING PROTOCOL:
-     *
-     * This routine requires that the caller have locked the alarm_mutex!
-     */
-    last = &alarm_list;
-    next = *last;
-    while (next != NULL) {
-        if (alarm->time < next->time) {
-            alarm->link = next;
-            *last       = alarm;
-            break;
-        }
-        // insert in alarm list at current position
-        last = &next->link;
-        next = next->link;
-    }
-
-    /*
-     * If we reached the end of the list, insert the new alarm there.  ("next"
-     * is NULL, and "last" points to the link field of the last item, or to the
-     * list header.)
-     */
-    if (next == NULL) {
-        *last       = alarm;
-        alarm->link = NULL;
-        longest     = alarm; // NOTE: this is the last alarm for now!
-    }
-
-#ifdef VERBOSE
-    {
-        std::ostringstream os;
-        Alarm::alarm_t* longestAlarm = alarm_list;
-        os << "alarm_list = [";
-        for (next = alarm_list; next != NULL; next = next->link) {
-            longestAlarm                 = next;
-            time_point<steady_clock> now = steady_clock::now();
-            duration<double> timeleft    = next->time - now;
-            os << next->seconds << "(" << timeleft.count() << ")\""
-               << next->message << "\"" << std::endl;
-        }
-        os << "]";
-        TRACE(os.str());
-        assert(longestAlarm == longest);
-    }
 #endif
 
-    /*
-     * Wake the alarm thread if it is not busy (that is, if current_alarm is
-     * ZERO, signifying that it's waiting for work), or if the new alarm comes
-     * before the one on which the alarm thread is waiting.
-     */
-    if ((current_alarm == ZERO) || (alarm->time < current_alarm)) {
-        current_alarm = alarm->time;
-        alarm_cond.notify_one();
-    }
-
-    assert(longest != NULL);
-    return longest->time;
-}
-
-/*
- * The alarm thread's start routine.
- */
-void alarm_thread(void)
-{
-    Alarm::alarm_t* alarm;
-    time_point<steady_clock> now;
-    bool expired;
-
-    /*
-     * Loop forever, processing commands. The alarm thread will be
-     * disintegrated when the process exits. Lock the mutex at the start -- it
-     * will be unlocked during condition waits, so the main thread can insert
-     * alarms.
-     */
-    unique_lock<mutex> lk(alarm_mutex);
-
-    // while event dispatcher loop
-    do {
-        /*
-         * If the alarm list is empty, wait until an alarm is added. Setting
-         * current_alarm to ZERO informs the insert routine that the thread is
-         * not busy.
-         */
-        current_alarm = ZERO;
-        while (enabled && alarm_list == NULL) {
-            alarm_cond.wait(lk);
-        }
-        if (!enabled) {
-            break;
-        }
-
-        // get first alarm from alarm list
-        alarm      = alarm_list;
-        alarm_list = alarm->link;
-
-        now     = steady_clock::now();
-        expired = false;
-        if (alarm->time > now) {
-            duration<double> timeleft = alarm->time - now;
-
-#ifdef VERBOSE
-            std::ostringstream os;
-            os << "[waiting: " << alarm->seconds << "(" << timeleft.count()
-               << ")\"" << alarm->message << "\"]" << std::endl;
-            TRACE(os.str());
-#endif
-
-            current_alarm = alarm->time;
-            while (enabled && alarm->time == current_alarm) {
-                // use system_clock: cv_status status =
-                // alarm_cond.wait_until(lk, current_alarm);
-                cv_status status =
-                    alarm_cond.wait_for(lk, timeleft); // use steady_clock
-                if (status == cv_status::timeout) {
-                    expired = true;
-                    break;
-                }
-            }
-            if (!enabled) {
-                break;
-            }
-
-            // current_alarm has changed
-            if (!expired) {
-                alarm_insert(alarm);
-            }
-        } else {
-            expired = true;
-        }
-
-        // handle alarm
-        if (expired) {
-            std::cerr << "handle(" << alarm->seconds << ") " << alarm->message
-                      << std::endl;
-            delete (alarm);
-        }
-
-    } while (enabled);
-    TRACE(
-        std::string(BOOST_CURRENT_FUNCTION) + " stopped"); // use concatenation
-}
-
 int main(int arc, char** argv)
 {
     std::string line;
-    Alarm::alarm_t* alarm; // TODO use shared ptr! CK
-    time_point<steady_clock> last = ZERO;
+    steady_clock::time_point last = steady_clock::now();
 
-    thread scheduler(&alarm_thread);
+    QueuedThreadPool handlers(1); // NOTE: the alarms are handled in order
+    TimerService scheduler(handlers);
 
-    while (enabled) {
+    for (;;) {
         std::cout << "Alarm> ";
         if (!std::getline(std::cin, line)) { // EOF
             if (arc > 1 && std::string(argv[1]) == "--wait") {
-                time_point<steady_clock> now = steady_clock::now();
-                duration<double> timeleft    = last - now;
+                duration<double> timeleft = last - steady_clock::now();
                 std::cerr << "terminate in " << timeleft.count() << "sec ..."
                           << std::endl;
                 // wait before terminate to finish test ...
-                this_thread::sleep_for(timeleft);
+                boost::this_thread::sleep_until(last);
+                while (scheduler.pending() > 0) {
+                    boost::this_thread::sleep_for(Agentpp::ms(1));
+                }
             }
             //=================================
-            unique_lock<mutex> lk(alarm_mutex);
-            enabled = false;
-            alarm_cond.notify_all();
-            lk.unlock();
+            scheduler.stop();
+            handlers.terminate(); // NOTE: the due alarms are handled first
+            TRACE(std::string(BOOST_CURRENT_FUNCTION) + " stopped");
             //=================================
-            scheduler.join();
             break;
         }
         if (line.length() <= 3) {
@@ -278,31 +86,30 @@ int main(int arc, char** argv)
             continue; // too short ...
         }
 
-        alarm = new (Alarm::alarm_t);
-
         /*
          * Parse input line into seconds and a message [^\n]),
          * separated from the seconds by whitespace.
          */
+        time_t secs = 0;
+        std::string message;
         std::istringstream input(line);
-        input >> alarm->seconds;
-        std::getline(input, alarm->message);
-        boost::algorithm::trim(alarm->message);
+        input >> secs;
+        std::getline(input, message);
+        boost::algorithm::trim(message);
         if (!input) {
             std::cerr << "Alarm format: [seconds message] | <EOF>"
                       << std::endl;
-            delete (alarm);
         } else {
-            //=================================
-            unique_lock<mutex> lk(alarm_mutex);
-            alarm->time = steady_clock::now() + seconds(alarm->seconds);
+            const steady_clock::time_point time =
+                steady_clock::now() + seconds(secs);
             TRACE(line);
-            /*
-             * Insert the new alarm into the list of alarms, sorted by
-             * expiration time.
-             */
-            last = alarm_insert(alarm);
-            //=================================
+            if (time > last) {
+                last = time;
+            }
+            (void)scheduler.schedule_at(time, [secs, message]() {
+                std::cerr << "handle(" << secs << ") " << message
+                          << std::endl;
+            });
         }
     } // end while input
 
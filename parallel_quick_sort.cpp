@@ -1,101 +1,140 @@
-// Copyright (C) 2012-2013 Vicente Botet
 //
-//  Distributed under the Boost Software License, Version 1.0. (See
-//  accompanying file LICENSE_1_0.txt or copy at
-//  http://www.boost.org/LICENSE_1_0.txt)
-
-#include <boost/config.hpp>
+// Sort benchmark: a parallel quick sort with parallel_invoke() on a
+// ThreadPool and a QueuedThreadPool vs std::sort
+//
+// A std::vector of pseudo random ints is filled with parallel_for() and
+// sorted in place. Each partition step forks the sort of the lower and
+// the upper part, the thread which waits for them helps to sort, so even
+// a pool of one thread sorts without a deadlock. Ranges of less than
+// cutoff elements are sorted with std::sort. The sizes are min, 10 * min,
+// ... up to max elements, each result is compared with std::sort.
+//
+// Based on the parallel_quick_sort example of Boost.Thread by Vicente
+// Botet, which spliced std::lists and blocked in future::get().
+//
+// usage: parallel_quick_sort [min elements] [max elements] [threads]
+//
 
-#define BOOST_THREAD_VERSION 4
-#define BOOST_THREAD_PROVIDES_EXECUTORS
-#define BOOST_THREAD_USES_LOG_THREAD_ID
-#define BOOST_THREAD_QUEUE_DEPRECATE_OLD
-#if !defined BOOST_NO_CXX11_DECLTYPE
-#    define BOOST_RESULT_OF_USE_DECLTYPE
-#endif
+#include "threadpool.hpp"
 
-#include <boost/assert.hpp>
-#include <boost/thread/executors/basic_thread_pool.hpp>
-#include <boost/thread/future.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/thread_only.hpp>
 
 #include <algorithm>
-#include <functional>
-#include <iostream>
-#include <list>
-#include <numeric>
-
-template <typename T> struct sorter {
-    boost::basic_thread_pool pool;
-    typedef std::list<T> return_type;
-
-    std::list<T> do_sort(std::list<T> chunk_data)
-    {
-        if (chunk_data.empty()) {
-            return chunk_data;
-        }
-
-        std::list<T> result;
-        result.splice(result.begin(), chunk_data, chunk_data.begin());
-        T const& partition_val = *result.begin();
-
-        typename std::list<T>::iterator divide_point =
-            std::partition(chunk_data.begin(), chunk_data.end(),
-                [&](T const& val) { return val < partition_val; });
-
-        std::list<T> new_lower_chunk;
-        new_lower_chunk.splice(new_lower_chunk.end(), chunk_data,
-            chunk_data.begin(), divide_point);
-
-        boost::future<std::list<T> > new_lower = boost::async(
-            pool, &sorter::do_sort, this, std::move(new_lower_chunk));
-        // boost::future<std::list<T> > new_lower = boost::async<return_type>(
-        //  pool, &sorter::do_sort, this, std::move(new_lower_chunk));
-
-        std::list<T> new_higher(do_sort(chunk_data));
-
-        result.splice(result.end(), new_higher);
-        while (!new_lower.is_ready()) {
-            pool.schedule_one_or_yield();
-        }
-
-        result.splice(result.begin(), new_lower.get());
-        return result;
-    }
-};
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+using namespace Agentpp;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double, boost::milli> milliseconds;
+typedef std::vector<int>::iterator Iterator;
+
+const std::ptrdiff_t cutoff = 16384;
+
+int median(int a, int b, int c)
+{
+    return std::max(std::min(a, b), std::min(std::max(a, b), c));
+}
 
-template <typename T> std::list<T> parallel_quick_sort(std::list<T>& input)
+void quick_sort(ThreadPool& pool, Iterator first, Iterator last)
 {
-    if (input.empty()) {
-        return input;
+    if (last - first <= cutoff) {
+        std::sort(first, last);
+        return;
     }
-    sorter<T> s;
 
-    return s.do_sort(input);
+    const int pivot =
+        median(*first, *(first + (last - first) / 2), *(last - 1));
+    // NOTE: the elements equal to the pivot are in place already
+    const Iterator lower = std::partition(
+        first, last, [pivot](int x) { return x < pivot; });
+    const Iterator upper = std::partition(
+        lower, last, [pivot](int x) { return !(pivot < x); });
+
+    parallel_invoke(
+        pool, [&pool, first, lower]() { quick_sort(pool, first, lower); },
+        [&pool, upper, last]() { quick_sort(pool, upper, last); });
 }
 
-int main()
+void fill(ThreadPool& pool, std::vector<int>& data)
 {
+    parallel_for(pool, size_t(0), data.size(), size_t(0),
+        [&data](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                boost::uint64_t x = (i + 1) * 0x9E3779B97F4A7C15ULL;
+                x ^= x >> 31;
+                x *= 0xBF58476D1CE4E5B9ULL;
+                data[i] = static_cast<int>(x >> 33);
+            }
+        });
+}
+
+double sort_with(ThreadPool& pool, std::vector<int>& data,
+    const std::vector<int>& expected, bool& ok)
+{
+    fill(pool, data);
+    const steady_clock::time_point start = steady_clock::now();
+    quick_sort(pool, data.begin(), data.end());
+    const double elapsed = milliseconds(steady_clock::now() - start).count();
+    ok = ok && data == expected;
+    return elapsed;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t min     = 1000000;
+    size_t max     = 100000000;
+    size_t threads = std::max(2U, boost::thread::hardware_concurrency());
+    if (argc > 1) {
+        min = static_cast<size_t>(std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        max = static_cast<size_t>(std::atol(argv[2]));
+    }
+    if (argc > 3) {
+        threads = static_cast<size_t>(std::atol(argv[3]));
+    }
+    bool ok = true;
+
+    ThreadPool threadPool(threads);
+    QueuedThreadPool queuedThreadPool(threads);
+
+    // NOTE: the first exception of a callable is passed to the caller
     try {
-        const int s = 101;
-        std::list<int> lst;
-        for (int i = 0; i < s; ++i) {
-            lst.push_back(100 - i);
-        }
-        std::list<int> r = parallel_quick_sort(lst);
-        int n            = 0;
-        for (std::list<int>::const_iterator it = r.begin(); it != r.end();
-             ++it, ++n) {
-            std::cout << *it << std::endl;
-            assert(n == *it);
-        }
-
-    } catch (std::exception& ex) {
-        std::cerr << "ERROR= " << ex.what() << "" << std::endl;
-        return 1;
-    } catch (...) {
-        std::cerr << " ERROR= exception thrown" << std::endl;
-        return 2;
+        parallel_invoke(
+            queuedThreadPool, []() {},
+            []() { throw std::runtime_error("thrown by a callable"); });
+        ok = false;
+    } catch (std::runtime_error&) {
+        // OK
+    }
+
+    std::printf("threads: %lu, cutoff: %ld\n%12s %12s %12s %12s %8s\n",
+        static_cast<unsigned long>(threads), static_cast<long>(cutoff),
+        "elements", "std[ms]", "pool[ms]", "queued[ms]", "speedup");
+    for (size_t n = min; n && n <= max; n *= 10) {
+        std::vector<int> expected(n);
+        fill(queuedThreadPool, expected);
+        steady_clock::time_point start = steady_clock::now();
+        std::sort(expected.begin(), expected.end());
+        const double sorted = milliseconds(steady_clock::now() - start).count();
+
+        std::vector<int> data(n);
+        const double pool   = sort_with(threadPool, data, expected, ok);
+        const double queued = sort_with(queuedThreadPool, data, expected, ok);
+
+        std::printf("%12lu %12.1f %12.1f %12.1f %8.2f\n",
+            static_cast<unsigned long>(n), sorted, pool, queued,
+            sorted / std::min(pool, queued));
     }
 
-    return 0;
+    return ok ? 0 : 1;
 }
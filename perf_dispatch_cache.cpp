@@ -0,0 +1,187 @@
+//
+// Dispatch path benchmark: cache misses per task of ThreadPool::execute()
+//
+// Tiny tasks are executed on a ThreadPool of 1 up to 8 threads. The
+// hardware cache misses and the L1 data cache read misses of all threads
+// are counted with perf_event_open(2), so the effect of the per thread
+// state layout on the dispatcher and the workers is visible. If the
+// hardware counters are not available (e.g. in a VM), n/a is printed.
+//
+// Build with USE_AGENTPP_CK for the posix AgentppCK::ThreadPool,
+// else the boost based Agentpp::ThreadPool is used.
+//
+// usage: perf_dispatch_cache [tasks]
+//
+
+#ifdef USE_AGENTPP_CK
+#    include "posix/threadpool.hpp"
+using namespace AgentppCK;
+#else
+#    include "threadpool.hpp"
+using namespace Agentpp;
+#endif
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#    include <linux/perf_event.h>
+#    include <sys/ioctl.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double> seconds;
+
+class TinyTask : public Runnable {
+public:
+    explicit TinyTask(boost::latch& l)
+        : done(l)
+    { }
+
+#ifndef USE_AGENTPP_CK
+    std::unique_ptr<Runnable> clone() const BOOST_OVERRIDE
+    {
+        return std::make_unique<TinyTask>(done);
+    }
+#endif
+
+    void run() BOOST_OVERRIDE { done.count_down(); }
+
+private:
+    boost::latch& done;
+};
+
+/**
+ * A perf event counter of this and all threads started after its
+ * creation. The counts of a thread are added when it is joined.
+ */
+class EventCounter {
+public:
+    EventCounter(unsigned type, unsigned long long config)
+        : fd(-1)
+    {
+#ifdef __linux__
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = type;
+        attr.config         = config;
+        attr.disabled       = 1;
+        attr.inherit        = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#else
+        (void)type;
+        (void)config;
+#endif
+    }
+
+    ~EventCounter()
+    {
+#ifdef __linux__
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    /// @return the count, or -1 if the counter is not available
+    double value() const
+    {
+#ifdef __linux__
+        unsigned long long count = 0;
+        if (fd >= 0 && read(fd, &count, sizeof(count)) == sizeof(count)) {
+            return static_cast<double>(count);
+        }
+#endif
+        return -1.0;
+    }
+
+private:
+    int fd;
+};
+
+struct Result {
+    double rate, cache_misses, l1d_misses;
+};
+
+Result run(size_t threads, size_t tasks)
+{
+#ifdef __linux__
+    EventCounter misses(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    EventCounter l1d(PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#else
+    EventCounter misses(0, 0);
+    EventCounter l1d(0, 0);
+#endif
+
+    seconds elapsed;
+    {
+        boost::latch done(tasks);
+        ThreadPool pool(threads);
+
+        steady_clock::time_point start = steady_clock::now();
+        for (size_t i = 0; i < tasks; ++i) {
+            pool.execute(new TinyTask(done));
+        }
+        done.wait();
+        elapsed = steady_clock::now() - start;
+
+        pool.terminate();
+    } // NOTE: the threads are joined, their counts are added now! CK
+
+    Result r;
+    r.rate         = tasks / elapsed.count();
+    r.cache_misses = misses.value();
+    r.l1d_misses   = l1d.value();
+    return r;
+}
+
+void print_per_task(double count, size_t tasks)
+{
+    if (count < 0.0) {
+        std::printf(" %14s", "n/a");
+    } else {
+        std::printf(" %14.2f", count / tasks);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t tasks = 100000;
+    if (argc > 1) {
+        tasks = static_cast<size_t>(std::atol(argv[1]));
+    }
+
+    std::printf("tasks: %lu\n", static_cast<unsigned long>(tasks));
+    std::printf("%8s %14s %14s %14s\n", "threads", "tasks/s", "misses/task",
+        "L1D/task");
+
+    for (size_t n = 1; n <= 8; n *= 2) {
+        Result r = run(n, tasks);
+        std::printf("%8lu %14.0f", static_cast<unsigned long>(n), r.rate);
+        print_per_task(r.cache_misses, tasks);
+        print_per_task(r.l1d_misses, tasks);
+        std::printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+//
+// Batch submission benchmark: execute_bulk() vs looped execute()
+//
+// 1k, 10k and 100k tiny tasks are submitted to a ThreadPool and to a
+// QueuedThreadPool of 4 threads. The time is measured from the first
+// submission until the last task has run.
+//
+// Build with USE_AGENTPP_CK for the posix AgentppCK::ThreadPool family,
+// else the boost based Agentpp::ThreadPool family is used.
+//
+// usage: perf_execute_bulk [max-tasks]
+//
+
+#ifdef USE_AGENTPP_CK
+#    include "posix/threadpool.hpp"
+using namespace AgentppCK;
+#else
+#    include "threadpool.hpp"
+using namespace Agentpp;
+#endif
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double> seconds;
+
+class TinyTask : public Runnable {
+public:
+    explicit TinyTask(boost::latch& l)
+        : done(l)
+    { }
+
+#ifndef USE_AGENTPP_CK
+    std::unique_ptr<Runnable> clone() const BOOST_OVERRIDE
+    {
+        return std::make_unique<TinyTask>(done);
+    }
+#endif
+
+    void run() BOOST_OVERRIDE { done.count_down(); }
+
+private:
+    boost::latch& done;
+};
+
+template <class Pool> double run(size_t tasks, bool bulk)
+{
+    boost::latch done(tasks);
+    std::vector<Runnable*> batch(tasks);
+    for (size_t i = 0; i < tasks; ++i) {
+        batch[i] = new TinyTask(done);
+    }
+
+    Pool pool(4);
+    steady_clock::time_point start = steady_clock::now();
+    if (bulk) {
+        pool.execute_bulk(&batch[0], tasks);
+    } else {
+        for (size_t i = 0; i < tasks; ++i) {
+            pool.execute(batch[i]);
+        }
+    }
+    done.wait();
+    seconds elapsed = steady_clock::now() - start;
+
+    pool.terminate();
+    return elapsed.count() * 1e3;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t max_tasks = 100000;
+    if (argc > 1) {
+        max_tasks = static_cast<size_t>(std::atol(argv[1]));
+    }
+
+    std::printf("%8s %14s %14s %14s %14s\n", "tasks", "pool loop[ms]",
+        "pool bulk[ms]", "queued loop[ms]", "queued bulk[ms]");
+
+    for (size_t n = 1000; n <= max_tasks; n *= 10) {
+        double pl = run<ThreadPool>(n, false);
+        double pb = run<ThreadPool>(n, true);
+        double ql = run<QueuedThreadPool>(n, false);
+        double qb = run<QueuedThreadPool>(n, true);
+        std::printf("%8lu %14.2f %14.2f %14.2f %14.2f\n",
+            static_cast<unsigned long>(n), pl, pb, ql, qb);
+    }
+
+    return 0;
+}
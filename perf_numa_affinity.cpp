@@ -0,0 +1,131 @@
+//
+// Placement benchmark: memory bound tasks on a ThreadPool with Affinity
+//
+// The CPUs and NUMA nodes of the host are read from sysfs and shown. Then
+// one task per thread first touches a buffer of its own, so its pages are
+// on the node of the thread, and reads it several times. With NONE the
+// scheduler may move a thread away from its pages, COMPACT fills one node
+// after the other, SCATTER spreads the threads over all nodes and
+// NUMA_NODE keeps them all on node 0. The sum of the read bandwidth of
+// all threads is shown. On a host with one node all policies are equal.
+//
+// usage: perf_numa_affinity [MB per thread] [threads]
+//
+
+#include "posix/threadpool.hpp"
+
+#include <boost/atomic.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace AgentppCK;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double> seconds;
+
+const size_t passes = 8;
+
+class StreamTask : public Runnable {
+public:
+    StreamTask(boost::latch& r, boost::latch& d, size_t n,
+        boost::atomic<unsigned long>& s)
+        : ready(r)
+        , done(d)
+        , words(n)
+        , sum(s)
+    { }
+
+    void run() BOOST_OVERRIDE
+    {
+        // NOTE: the first touch places the pages on the node of the CPU
+        std::vector<unsigned long> buffer(words, 1UL);
+        ready.count_down_and_wait();
+
+        unsigned long s = 0;
+        for (size_t p = 0; p < passes; ++p) {
+            for (size_t i = 0; i < words; ++i) {
+                s += buffer[i];
+            }
+        }
+        sum.fetch_add(s);
+        done.count_down();
+    }
+
+private:
+    boost::latch& ready;
+    boost::latch& done;
+    const size_t words;
+    boost::atomic<unsigned long>& sum;
+};
+
+/// @return the read bandwidth of all threads in GB/s
+double run(const Affinity& affinity, size_t threads, size_t mb, bool& ok)
+{
+    ThreadPool pool(
+        threads, AGENTPP_DEFAULT_STACKSIZE, ThreadPool::EAGER, affinity);
+    const size_t words = mb * 1024 * 1024 / sizeof(unsigned long);
+
+    boost::atomic<unsigned long> sum(0);
+    boost::latch ready(threads + 1);
+    boost::latch done(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        pool.execute(new StreamTask(ready, done, words, sum));
+    }
+    ready.count_down_and_wait();
+    steady_clock::time_point start = steady_clock::now();
+    done.wait();
+    const double elapsed = seconds(steady_clock::now() - start).count();
+
+    ok = ok && (sum.load() == threads * words * passes);
+    return (threads * words * passes * sizeof(unsigned long)) / elapsed
+        / 1e9;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const CpuTopology& topology = CpuTopology::instance();
+
+    size_t mb      = 64;
+    size_t threads = topology.cpus().size();
+    if (argc > 1) {
+        mb = static_cast<size_t>(std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        threads = static_cast<size_t>(std::atol(argv[2]));
+    }
+
+    std::printf("%lu cpus on %lu nodes\n",
+        static_cast<unsigned long>(topology.cpus().size()),
+        static_cast<unsigned long>(topology.nodes().size()));
+    std::printf("%6s %6s %8s %6s\n", "cpu", "node", "package", "core");
+    for (size_t i = 0; i < topology.cpus().size(); ++i) {
+        const CpuTopology::Cpu& cpu = topology.cpus()[i];
+        std::printf(
+            "%6d %6d %8d %6d\n", cpu.id, cpu.node, cpu.package, cpu.core);
+    }
+
+    std::printf("\nthreads: %lu, buffer: %lu MB per thread, passes: %lu\n",
+        static_cast<unsigned long>(threads), static_cast<unsigned long>(mb),
+        static_cast<unsigned long>(passes));
+    std::printf("%10s %10s\n", "affinity", "GB/s");
+
+    bool ok = true;
+    std::printf("%10s %10.2f\n", "none", run(Affinity(), threads, mb, ok));
+    std::printf("%10s %10.2f\n", "compact",
+        run(Affinity(Affinity::COMPACT), threads, mb, ok));
+    std::printf("%10s %10.2f\n", "scatter",
+        run(Affinity(Affinity::SCATTER), threads, mb, ok));
+    std::printf("%10s %10.2f\n", "node 0",
+        run(Affinity::numa_node(topology.nodes()[0]), threads, mb, ok));
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+//
+// Algorithm benchmark: parallel_sort, parallel_reduce, parallel_transform
+// and parallel_scan on a QueuedThreadPool vs std::sort, std::accumulate,
+// std::transform and std::partial_sum
+//
+// For each element type, size and number of threads the same data is
+// processed by the sequential and by the parallel version, the time of
+// both and the speedup are shown. Each result is compared with the one
+// of the sequential version; the sums of doubles may differ by rounding
+// only. The strings are sorted only.
+//
+// usage: perf_parallel_algorithms [min elements] [max elements] [threads]
+//
+// The sizes are min, 10 * min, ... up to max; the pools have 1, 2, 4 ...
+// up to threads threads.
+//
+
+#include "threadpool.hpp"
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/thread_only.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <string>
+#include <vector>
+
+using namespace Agentpp;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double, boost::milli> milliseconds;
+
+boost::uint64_t mix(size_t i)
+{
+    boost::uint64_t x = (i + 1) * 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 31;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    return x ^ (x >> 29);
+}
+
+void make(size_t i, unsigned& value)
+{
+    value = static_cast<unsigned>(mix(i) >> 40);
+}
+void make(size_t i, double& value)
+{
+    value = static_cast<double>(mix(i) >> 11) / 9007199254740992.0;
+}
+void make(size_t i, std::string& value)
+{
+    char text[24];
+    std::snprintf(text, sizeof(text), "%016llx",
+        static_cast<unsigned long long>(mix(i)));
+    value = text;
+}
+
+bool same(unsigned a, unsigned b) { return a == b; }
+bool same(double a, double b)
+{
+    return std::fabs(a - b) <= 1e-9 * std::max(std::fabs(a), std::fabs(b));
+}
+
+template <class T> bool same(const std::vector<T>& a, const std::vector<T>& b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (!same(a[i], b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct Timer {
+    Timer()
+        : start(steady_clock::now())
+    { }
+    double elapsed() const
+    {
+        return milliseconds(steady_clock::now() - start).count();
+    }
+    steady_clock::time_point start;
+};
+
+void report(const char* algorithm, const char* type, size_t n,
+    size_t threads, double sequential, double parallel)
+{
+    std::printf("%10s %8s %10lu %8lu %10.2f %10.2f %8.2f\n", algorithm, type,
+        static_cast<unsigned long>(n), static_cast<unsigned long>(threads),
+        sequential, parallel, sequential / parallel);
+}
+
+template <class T>
+bool sort(ThreadPool& pool, const std::vector<T>& data, const char* type)
+{
+    std::vector<T> expected(data);
+    Timer t;
+    std::sort(expected.begin(), expected.end());
+    const double sequential = t.elapsed();
+
+    std::vector<T> result(data);
+    t = Timer();
+    parallel_sort(pool, result.begin(), result.end());
+    report("sort", type, data.size(), pool.size(), sequential, t.elapsed());
+    return result == expected;
+}
+
+template <class T>
+bool numeric(ThreadPool& pool, const std::vector<T>& data, const char* type)
+{
+    bool ok = true;
+
+    Timer t;
+    const T expected = std::accumulate(data.begin(), data.end(), T());
+    double sequential = t.elapsed();
+    t                 = Timer();
+    const T sum = parallel_reduce(pool, data.begin(), data.end(), T());
+    report("reduce", type, data.size(), pool.size(), sequential, t.elapsed());
+    ok = ok && same(sum, expected);
+
+    std::vector<T> expectedOut(data.size());
+    std::vector<T> out(data.size());
+    const auto square = [](T x) { return x * x + x; };
+    t                 = Timer();
+    std::transform(data.begin(), data.end(), expectedOut.begin(), square);
+    sequential = t.elapsed();
+    t          = Timer();
+    parallel_transform(pool, data.begin(), data.end(), out.begin(), square);
+    report(
+        "transform", type, data.size(), pool.size(), sequential, t.elapsed());
+    ok = ok && out == expectedOut;
+
+    t = Timer();
+    std::partial_sum(data.begin(), data.end(), expectedOut.begin());
+    sequential = t.elapsed();
+    t          = Timer();
+    parallel_scan(pool, data.begin(), data.end(), out.begin());
+    report("scan", type, data.size(), pool.size(), sequential, t.elapsed());
+    ok = ok && same(out, expectedOut);
+
+    return ok;
+}
+
+template <class T> std::vector<T> make_data(ThreadPool& pool, size_t n)
+{
+    std::vector<T> data(n);
+    parallel_for(pool, size_t(0), n, size_t(0),
+        [&data](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                make(i, data[i]);
+            }
+        });
+    return data;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t min     = 100000;
+    size_t max     = 10000000;
+    size_t threads = std::max(2U, boost::thread::hardware_concurrency());
+    if (argc > 1) {
+        min = static_cast<size_t>(std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        max = static_cast<size_t>(std::atol(argv[2]));
+    }
+    if (argc > 3) {
+        threads = static_cast<size_t>(std::atol(argv[3]));
+    }
+    bool ok = true;
+
+    std::printf("cpus: %u\n%10s %8s %10s %8s %10s %10s %8s\n",
+        boost::thread::hardware_concurrency(), "algorithm", "type",
+        "elements", "threads", "std[ms]", "pool[ms]", "speedup");
+    for (size_t size = 1; size <= threads; size *= 2) {
+        QueuedThreadPool pool(size);
+        for (size_t n = min; n && n <= max; n *= 10) {
+            const std::vector<unsigned> u = make_data<unsigned>(pool, n);
+            ok = sort(pool, u, "unsigned") && ok;
+            ok = numeric(pool, u, "unsigned") && ok;
+
+            const std::vector<double> d = make_data<double>(pool, n);
+            ok = sort(pool, d, "double") && ok;
+            ok = numeric(pool, d, "double") && ok;
+
+            const std::vector<std::string> s =
+                make_data<std::string>(pool, n);
+            ok = sort(pool, s, "string") && ok;
+        }
+    }
+
+    // NOTE: the edge cases, checked with a pool of two threads
+    QueuedThreadPool pool(2);
+    std::vector<unsigned> few(3, 7);
+    parallel_sort(pool, few.begin(), few.end());
+    ok = ok && parallel_reduce(pool, few.begin(), few.begin(), 5U) == 5U;
+    ok = ok && parallel_reduce(pool, few.begin(), few.end(), 5U) == 26U;
+    ok = ok
+        && parallel_scan(pool, few.begin(), few.end(), few.begin())
+            == few.end()
+        && few.back() == 21U;
+
+    std::vector<unsigned> equal(1000000, 42);
+    parallel_sort(pool, equal.begin(), equal.end(), std::greater<unsigned>());
+    ok = ok && std::count(equal.begin(), equal.end(), 42U) == 1000000;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+//
+// Elasticity benchmark: QueuedThreadPool of a fixed size vs PoolSizing
+//
+// Bursts of tasks which block for 1 ms (e.g. on I/O) are executed with a
+// pause between the bursts. A pool of the min size is slow, a pool of the
+// max size keeps its idle threads during the pause. The elastic pool
+// grows to the max size for a burst and shrinks to the min size after
+// the keep-alive time of its idle threads.
+//
+// Build with USE_AGENTPP_CK for the posix AgentppCK::QueuedThreadPool,
+// else the boost based Agentpp::QueuedThreadPool is used.
+//
+// usage: perf_pool_elastic [tasks] [threads]
+//
+
+#ifdef USE_AGENTPP_CK
+#    include "posix/threadpool.hpp"
+using namespace AgentppCK;
+#else
+#    include "threadpool.hpp"
+using namespace Agentpp;
+#endif
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+#include <boost/thread/thread_only.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double, boost::milli> milliseconds;
+
+const unsigned long keep_alive = 20; // ms
+const size_t bursts            = 3;
+
+class BlockingTask : public Runnable {
+public:
+    explicit BlockingTask(boost::latch& l)
+        : done(l)
+    { }
+
+#ifndef USE_AGENTPP_CK
+    std::unique_ptr<Runnable> clone() const BOOST_OVERRIDE
+    {
+        return std::make_unique<BlockingTask>(done);
+    }
+#endif
+
+    void run() BOOST_OVERRIDE
+    {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+        done.count_down();
+    }
+
+private:
+    boost::latch& done;
+};
+
+struct Result {
+    double burst; // milliseconds per burst
+    size_t peak, after_pause;
+};
+
+Result run(const PoolSizing& sizing, size_t tasks)
+{
+    Result r;
+    r.burst       = 0.0;
+    r.after_pause = 0;
+
+    QueuedThreadPool pool(sizing);
+    for (size_t b = 0; b < bursts; ++b) {
+        boost::latch done(tasks);
+        steady_clock::time_point start = steady_clock::now();
+        for (size_t i = 0; i < tasks; ++i) {
+            pool.execute(new BlockingTask(done));
+        }
+        done.wait();
+        r.burst += milliseconds(steady_clock::now() - start).count() / bursts;
+
+        boost::this_thread::sleep_for(
+            boost::chrono::milliseconds(5 * keep_alive));
+        r.after_pause = pool.size();
+    }
+    r.peak = pool.peak_size();
+    return r;
+}
+
+void print(const char* name, const Result& r)
+{
+    std::printf("%10s %12.2f %8lu %14lu\n", name, r.burst,
+        static_cast<unsigned long>(r.peak),
+        static_cast<unsigned long>(r.after_pause));
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t tasks   = 200;
+    size_t threads = 8;
+    if (argc > 1) {
+        tasks = static_cast<size_t>(std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        threads = static_cast<size_t>(std::atol(argv[2]));
+    }
+
+    std::printf("tasks per burst: %lu, max threads: %lu, keep-alive: %lu ms\n",
+        static_cast<unsigned long>(tasks), static_cast<unsigned long>(threads),
+        keep_alive);
+    std::printf("%10s %12s %8s %14s\n", "pool", "burst[ms]", "peak",
+        "after pause");
+
+    print("min", run(PoolSizing(1), tasks));
+    print("max", run(PoolSizing(threads), tasks));
+    const Result e = run(PoolSizing(1, threads, keep_alive), tasks);
+    print("elastic", e);
+
+    return (e.peak == threads && e.after_pause == 1) ? 0 : 1;
+}
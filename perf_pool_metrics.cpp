@@ -0,0 +1,122 @@
+//
+// Metrics benchmark: the PoolMetrics of ThreadPool and QueuedThreadPool
+//
+// Many short tasks are executed on both pools, then the snapshot of each
+// pool is printed as text and as JSON. The counts of the snapshot must
+// match the tasks executed and rejected. The cost of the counting is the
+// cost of two clock reads and of a few stores per task, the clock and
+// a Histogram are measured alone for comparison.
+//
+// usage: perf_pool_metrics [tasks] [threads]
+//
+
+#include "threadpool.hpp"
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace Agentpp;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double, boost::nano> nanoseconds;
+
+const size_t rounds = 1000000;
+
+bool run(ThreadPool& pool, const char* name, size_t tasks)
+{
+    boost::latch done(tasks);
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < tasks; ++i) {
+        pool.execute([&done]() { done.count_down(); });
+    }
+    done.wait();
+    const double elapsed =
+        nanoseconds(steady_clock::now() - start).count() / tasks;
+    while (!pool.is_idle()) {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+    }
+
+    start                 = steady_clock::now();
+    const PoolMetrics m   = pool.metrics();
+    const double snapshot = nanoseconds(steady_clock::now() - start).count();
+
+    std::printf("%s: %.1f ns per task, snapshot: %.1f us\n%s%s\n\n", name,
+        elapsed, snapshot / 1000.0, m.to_text().c_str(), m.to_json().c_str());
+
+    bool ok = m.tasks == tasks && m.wait.count() == tasks
+        && m.run.count() == tasks && m.rejected == 0 && m.busy <= m.alive;
+    size_t counted = 0;
+    for (size_t i = 0; i < m.workers.size(); ++i) {
+        counted += m.workers[i].tasks;
+    }
+    ok = ok && counted == tasks;
+
+    pool.terminate();
+    pool.execute([]() { });
+    return ok && pool.metrics().rejected == 1;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t tasks   = 100000;
+    size_t threads = 2;
+    if (argc > 1) {
+        tasks = static_cast<size_t>(std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        threads = static_cast<size_t>(std::atol(argv[2]));
+    }
+    bool ok = true;
+
+    // NOTE: what each task pays for its counters
+    Histogram h;
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        h.record(i);
+    }
+    const double record =
+        nanoseconds(steady_clock::now() - start).count() / rounds;
+    start = steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        (void)Clock::now();
+    }
+    const double clock =
+        nanoseconds(steady_clock::now() - start).count() / rounds;
+    std::printf("Histogram::record: %.1f ns, Clock::now: %.1f ns\n", record,
+        clock);
+
+    // NOTE: a percentile is known within one bucket (12.5%)
+    const double p99 = static_cast<double>(h.percentile(99.0));
+    ok = ok && p99 >= 0.99 * rounds && p99 <= 1.125 * 0.99 * rounds;
+    ok = ok && h.max() == rounds - 1 && h.count() == rounds;
+    std::printf("p50: %lu, p99: %lu, max: %lu of 0 .. %lu\n\n",
+        static_cast<unsigned long>(h.percentile(50.0)),
+        static_cast<unsigned long>(h.percentile(99.0)),
+        static_cast<unsigned long>(h.max()),
+        static_cast<unsigned long>(rounds - 1));
+
+    {
+        ThreadPool pool(threads);
+        ok = run(pool, "ThreadPool", tasks) && ok;
+    }
+    {
+        QueuedThreadPool pool(threads);
+        ok = run(pool, "QueuedThreadPool", tasks) && ok;
+    }
+    {
+        // NOTE: a pool without threads drops the task, but counts it
+        ThreadPool pool(0UL);
+        pool.execute([]() { });
+        ok = ok && pool.metrics().rejected == 1;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+//
+// Shutdown benchmark: AgentppCK::ThreadPool::wait_for_idle() and
+// shutdown() of ThreadPool, QueuedThreadPool and WorkStealingThreadPool
+//
+// At first a task which runs for 20 ms is executed and the caller waits
+// until the pool is idle again, once with a Thread::sleep(100) polling
+// loop (like the tests did) and once with wait_for_idle(). The time
+// between the end of the task and the return of the caller is measured.
+// Then a backlog of short tasks is executed and the pool is stopped with
+// each ShutdownMode: the time of shutdown() and the tasks run are shown.
+//
+// usage: perf_pool_shutdown [tasks] [rounds]
+//
+
+#include "posix/threadpool.hpp"
+
+#include <boost/atomic.hpp>
+#include <boost/chrono/chrono.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace AgentppCK;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double, boost::milli> milliseconds;
+
+const size_t threads = 2;
+
+class SleepTask : public Runnable {
+public:
+    explicit SleepTask(steady_clock::time_point& t)
+        : ended(t)
+    { }
+
+    void run() BOOST_OVERRIDE
+    {
+        Thread::sleep(20); // ms
+        ended = steady_clock::now();
+    }
+
+private:
+    steady_clock::time_point& ended;
+};
+
+class ShortTask : public Runnable {
+public:
+    explicit ShortTask(boost::atomic<size_t>& n)
+        : count(n)
+    { }
+
+    void run() BOOST_OVERRIDE
+    {
+        const steady_clock::time_point end =
+            steady_clock::now() + boost::chrono::microseconds(20);
+        while (steady_clock::now() < end) { }
+        count++;
+    }
+
+private:
+    boost::atomic<size_t>& count;
+};
+
+// NOTE: the time from the end of a task to the return of the waiter
+double wake_latency(ThreadPool& pool, bool polling, bool& ok)
+{
+    steady_clock::time_point ended;
+    pool.execute(new SleepTask(ended));
+
+    if (polling) {
+        do {
+            Thread::sleep(100); // ms
+        } while (!pool.is_idle());
+    } else {
+        ok = pool.wait_for_idle() && ok;
+    }
+    return milliseconds(steady_clock::now() - ended).count();
+}
+
+template <class Pool> void wake(const char* name, size_t rounds, bool& ok)
+{
+    Pool pool(threads);
+    double polled = 0.0;
+    double waited = 0.0;
+    for (size_t i = 0; i < rounds; ++i) {
+        polled += wake_latency(pool, true, ok) / rounds;
+        waited += wake_latency(pool, false, ok) / rounds;
+    }
+    std::printf("%16s %14.3f %14.3f\n", name, polled, waited);
+}
+
+template <class Pool>
+void stop(const char* name, ThreadPool::ShutdownMode mode, size_t tasks,
+    bool& ok)
+{
+    boost::atomic<size_t> count(0);
+    double elapsed = 0.0;
+    bool stopped   = false;
+    {
+        Pool pool(threads);
+        for (size_t i = 0; i < tasks; ++i) {
+            pool.execute(new ShortTask(count));
+        }
+        const steady_clock::time_point start = steady_clock::now();
+        stopped = pool.shutdown(mode);
+        elapsed = milliseconds(steady_clock::now() - start).count();
+    }
+
+    std::printf("%16s %12s %10.3f %8lu %8s\n", name,
+        (mode == ThreadPool::DRAIN)
+            ? "drain"
+            : ((mode == ThreadPool::DROP_QUEUED) ? "drop queued"
+                                                 : "cancel now"),
+        elapsed, static_cast<unsigned long>(count.load()),
+        stopped ? "yes" : "no");
+
+    if (mode == ThreadPool::DRAIN) {
+        ok = ok && stopped && count == tasks;
+    } else if (mode == ThreadPool::DROP_QUEUED) {
+        ok = ok && stopped && count <= tasks;
+    }
+}
+
+template <class Pool> void stop_all(const char* name, size_t tasks, bool& ok)
+{
+    stop<Pool>(name, ThreadPool::DRAIN, tasks, ok);
+    stop<Pool>(name, ThreadPool::DROP_QUEUED, tasks, ok);
+    stop<Pool>(name, ThreadPool::CANCEL_NOW, tasks, ok);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t tasks  = 10000;
+    size_t rounds = 5;
+    if (argc > 1) {
+        tasks = static_cast<size_t>(std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        rounds = static_cast<size_t>(std::atol(argv[2]));
+    }
+    bool ok = true;
+
+    std::printf("wake up after the last task (mean of %lu):\n"
+                "%16s %14s %14s\n",
+        static_cast<unsigned long>(rounds), "pool", "sleep(100)[ms]",
+        "wait[ms]");
+    wake<ThreadPool>("ThreadPool", rounds, ok);
+    wake<QueuedThreadPool>("QueuedThreadPool", rounds, ok);
+    wake<WorkStealingThreadPool>("WorkStealing", rounds, ok);
+
+    std::printf("\nshutdown with %lu queued tasks:\n"
+                "%16s %12s %10s %8s %8s\n",
+        static_cast<unsigned long>(tasks), "pool", "mode", "time[ms]", "run",
+        "stopped");
+    stop_all<QueuedThreadPool>("QueuedThreadPool", tasks, ok);
+    stop_all<WorkStealingThreadPool>("WorkStealing", tasks, ok);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+//
+// Startup benchmark: EAGER, PARALLEL and LAZY ThreadPool construction
+//
+// A ThreadPool of 1, 16 and 256 threads is constructed with each startup
+// mode. For the LAZY pool the latency of its first task, which starts
+// the first thread, is shown too. At last each pool has to run as many
+// tasks at the same time as it has threads, so a LAZY pool must grow to
+// its full size.
+//
+// Build with USE_AGENTPP_CK for the posix AgentppCK::ThreadPool,
+// else the boost based Agentpp::ThreadPool is used.
+//
+// usage: perf_pool_startup [rounds]
+//
+
+#ifdef USE_AGENTPP_CK
+#    include "posix/threadpool.hpp"
+using namespace AgentppCK;
+#else
+#    include "threadpool.hpp"
+using namespace Agentpp;
+#endif
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double, boost::micro> microseconds;
+
+class RendezvousTask : public Runnable {
+public:
+    explicit RendezvousTask(boost::latch& l)
+        : all(l)
+    { }
+
+#ifndef USE_AGENTPP_CK
+    std::unique_ptr<Runnable> clone() const BOOST_OVERRIDE
+    {
+        return std::make_unique<RendezvousTask>(all);
+    }
+#endif
+
+    void run() BOOST_OVERRIDE { all.count_down_and_wait(); }
+
+private:
+    boost::latch& all;
+};
+
+ThreadPool* make_pool(size_t threads, ThreadPool::Startup startup)
+{
+#ifdef USE_AGENTPP_CK
+    return new ThreadPool(threads, AGENTPP_DEFAULT_STACKSIZE, startup);
+#else
+    return new ThreadPool(
+        threads, AGENTPP_DEFAULT_STACKSIZE, SpinWait(), startup);
+#endif
+}
+
+struct Result {
+    double construct, first; // microseconds
+};
+
+Result run(size_t threads, ThreadPool::Startup startup, size_t rounds,
+    bool& ok)
+{
+    Result r;
+    r.construct = 0.0;
+    r.first     = 0.0;
+    for (size_t i = 0; i < rounds; ++i) {
+        steady_clock::time_point start = steady_clock::now();
+        ThreadPool* pool               = make_pool(threads, startup);
+        steady_clock::time_point built = steady_clock::now();
+        r.construct += microseconds(built - start).count() / rounds;
+
+        {
+            boost::latch first(1);
+            built = steady_clock::now();
+            pool->execute(new RendezvousTask(first));
+            first.wait();
+            r.first += microseconds(steady_clock::now() - built).count()
+                / rounds;
+        }
+
+        boost::latch all(threads);
+        for (size_t k = 0; k < threads; ++k) {
+            pool->execute(new RendezvousTask(all));
+        }
+        all.wait();
+        ok = ok && (pool->size() == threads);
+
+        delete pool;
+    }
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t rounds = 10;
+    if (argc > 1) {
+        rounds = static_cast<size_t>(std::atol(argv[1]));
+    }
+    bool ok = true;
+
+    std::printf("rounds: %lu\n", static_cast<unsigned long>(rounds));
+    std::printf("%8s %14s %14s %14s %16s\n", "threads", "eager[us]",
+        "parallel[us]", "lazy[us]", "lazy first[us]");
+
+    const size_t sizes[] = { 1, 16, 256 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        Result e = run(sizes[s], ThreadPool::EAGER, rounds, ok);
+        Result p = run(sizes[s], ThreadPool::PARALLEL, rounds, ok);
+        Result l = run(sizes[s], ThreadPool::LAZY, rounds, ok);
+        std::printf("%8lu %14.1f %14.1f %14.1f %16.1f\n",
+            static_cast<unsigned long>(sizes[s]), e.construct, p.construct,
+            l.construct, l.first);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+//
+// Teardown benchmark: construct and destroy a ThreadPool of 64 threads
+//
+// The time to construct a pool, to destroy it, and to construct and
+// destroy a single Synchronized is measured. Each pool thread owns a
+// Synchronized and a Thread, so any fixed delay in the destructor of the
+// monitor is multiplied by the number of threads. At last a Synchronized
+// is destroyed while [threads] threads wait() on it; each of them must
+// have left wait() when the destructor returns.
+//
+// Build with USE_AGENTPP_CK for the posix AgentppCK::ThreadPool,
+// else the boost based Agentpp::ThreadPool is used.
+//
+// usage: perf_pool_teardown [rounds] [threads]
+//
+
+#ifdef USE_AGENTPP_CK
+#    include "posix/threadpool.hpp"
+using namespace AgentppCK;
+#else
+#    include "threadpool.hpp"
+using namespace Agentpp;
+#endif
+
+#include <boost/chrono/chrono.hpp>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double, boost::milli> milliseconds;
+typedef boost::chrono::duration<double, boost::micro> microseconds;
+
+struct Result {
+    double construct, destroy; // milliseconds per pool
+};
+
+template <class Pool> Result run(size_t rounds, size_t threads)
+{
+    Result r;
+    r.construct = 0.0;
+    r.destroy   = 0.0;
+    for (size_t i = 0; i < rounds; ++i) {
+        steady_clock::time_point start = steady_clock::now();
+        Pool* pool                     = new Pool(threads);
+        steady_clock::time_point built = steady_clock::now();
+        delete pool;
+        r.construct += milliseconds(built - start).count() / rounds;
+        r.destroy += milliseconds(steady_clock::now() - built).count() / rounds;
+    }
+    return r;
+}
+
+double synchronized(size_t count)
+{
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        Synchronized* sync = new Synchronized();
+        delete sync;
+    }
+    return microseconds(steady_clock::now() - start).count() / count;
+}
+
+/// @return the microseconds to destroy a Synchronized with waiters
+double synchronized_waited(size_t threads, bool& ok)
+{
+    Synchronized* sync = new Synchronized();
+    size_t waiting     = 0; // NOTE: guarded by sync
+    std::atomic<size_t> left(0);
+    std::vector<std::thread> waiters;
+    for (size_t i = 0; i < threads; ++i) {
+        waiters.emplace_back([sync, &waiting, &left]() {
+            sync->lock();
+            ++waiting;
+            sync->wait(); // NOTE: until the destructor notifies us
+            left++;
+            sync->unlock();
+        });
+    }
+
+    // NOTE: the waiting count is raised with the lock, so all threads are
+    // in wait() once we see it complete with the lock! CK
+    sync->lock();
+    while (waiting < threads) {
+        sync->unlock();
+        Thread::sleep(1); // ms
+        sync->lock();
+    }
+
+    steady_clock::time_point start = steady_clock::now();
+    delete sync; // NOTE: with our lock
+    const double elapsed = microseconds(steady_clock::now() - start).count();
+    ok                   = ok && left == threads;
+
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        waiters[i].join();
+    }
+    return elapsed;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t rounds  = 10;
+    size_t threads = 64;
+    if (argc > 1) {
+        rounds = static_cast<size_t>(std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        threads = static_cast<size_t>(std::atol(argv[2]));
+    }
+
+    std::printf("rounds: %lu, threads: %lu\n",
+        static_cast<unsigned long>(rounds), static_cast<unsigned long>(threads));
+    std::printf("%18s %16s %16s\n", "", "construct[ms]", "destroy[ms]");
+
+    Result r = run<ThreadPool>(rounds, threads);
+    std::printf("%18s %16.2f %16.2f\n", "ThreadPool", r.construct, r.destroy);
+    r = run<QueuedThreadPool>(rounds, threads);
+    std::printf(
+        "%18s %16.2f %16.2f\n", "QueuedThreadPool", r.construct, r.destroy);
+    std::printf("%18s %16.2f us\n", "Synchronized", synchronized(rounds * 10));
+
+    bool ok = true;
+    std::printf("%18s %16.2f us\n", "with waiters",
+        synchronized_waited(threads, ok));
+    if (!ok) {
+        std::printf("FAILED: a waiter had not left wait()\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+//
+// Latency benchmark: high priority tasks behind a saturating low priority
+// load, AgentppCK::QueuedThreadPool vs PriorityQueuedThreadPool
+//
+// A backlog of low priority tasks which work for 20 us each is queued.
+// Then a high priority task is executed every 2 ms while the backlog is
+// drained and the time from its execute() until it runs is measured. The
+// FIFO queue runs it after the whole backlog queued before, the priority
+// queue after the tasks which are already running.
+//
+// usage: perf_priority_latency [low tasks] [threads]
+//
+
+#include "posix/threadpool.hpp"
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+#include <boost/thread/thread_only.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace AgentppCK;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double, boost::micro> microseconds;
+
+const size_t probes = 20;
+
+class LowTask : public Runnable {
+public:
+    explicit LowTask(boost::latch& l)
+        : done(l)
+    { }
+
+    void run() BOOST_OVERRIDE
+    {
+        // NOTE: busy, like the encoding of a large response
+        const steady_clock::time_point end =
+            steady_clock::now() + boost::chrono::microseconds(20);
+        while (steady_clock::now() < end) { }
+        done.count_down();
+    }
+
+private:
+    boost::latch& done;
+};
+
+class ProbeTask : public Runnable {
+public:
+    ProbeTask(boost::latch& l, double& us)
+        : done(l)
+        , latency(us)
+        , submitted(steady_clock::now())
+    { }
+
+    void run() BOOST_OVERRIDE
+    {
+        latency = microseconds(steady_clock::now() - submitted).count();
+        done.count_down();
+    }
+
+private:
+    boost::latch& done;
+    double& latency;
+    const steady_clock::time_point submitted;
+};
+
+struct Result {
+    double mean, max; // microseconds
+};
+
+void submit(QueuedThreadPool& pool, Runnable* task, int /*priority*/)
+{
+    pool.execute(task);
+}
+
+void submit(PriorityQueuedThreadPool& pool, Runnable* task, int priority)
+{
+    pool.execute(task, priority);
+}
+
+template <class Pool> Result run(Pool& pool, size_t low)
+{
+    boost::latch lowDone(low);
+    boost::latch probesDone(probes);
+    std::vector<double> latency(probes, 0.0);
+
+    for (size_t i = 0; i < low; ++i) {
+        submit(pool, new LowTask(lowDone), 0);
+    }
+    for (size_t i = 0; i < probes; ++i) {
+        submit(pool, new ProbeTask(probesDone, latency[i]), 10);
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(2));
+    }
+    probesDone.wait();
+    lowDone.wait();
+
+    Result r;
+    r.mean = 0.0;
+    r.max  = *std::max_element(latency.begin(), latency.end());
+    for (size_t i = 0; i < probes; ++i) {
+        r.mean += latency[i] / probes;
+    }
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t low     = 5000;
+    size_t threads = 2;
+    if (argc > 1) {
+        low = static_cast<size_t>(std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        threads = static_cast<size_t>(std::atol(argv[2]));
+    }
+
+    std::printf("low priority tasks: %lu, probes: %lu, threads: %lu\n",
+        static_cast<unsigned long>(low), static_cast<unsigned long>(probes),
+        static_cast<unsigned long>(threads));
+    std::printf("%10s %12s %12s\n", "queue", "mean[us]", "max[us]");
+
+    QueuedThreadPool fifo(threads);
+    Result r = run(fifo, low);
+    std::printf("%10s %12.1f %12.1f\n", "fifo", r.mean, r.max);
+
+    PriorityQueuedThreadPool priority(threads);
+    r = run(priority, low);
+    std::printf("%10s %12.1f %12.1f\n", "priority", r.mean, r.max);
+
+    return 0;
+}
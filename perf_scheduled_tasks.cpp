@@ -0,0 +1,161 @@
+//
+// Scheduling benchmark: ThreadPool::execute_after() and execute_every()
+//
+// At first many delayed tasks (1 h) are executed and cancelled again to
+// measure the overhead of a pending timer. While they are pending a
+// periodic task runs with FIXED_RATE and FIXED_DELAY and the jitter of
+// its runs is measured, i.e. how late each run starts compared with its
+// ideal time. At last delayed tasks with random delays measure the
+// accuracy of execute_after(); none may run before its time.
+//
+// Without the timer thread each of these tasks would block a thread of
+// the pool in Thread::sleep() for its whole delay.
+//
+// usage: perf_scheduled_tasks [pending] [runs]
+//
+
+#include "threadpool.hpp"
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace Agentpp;
+
+namespace
+{
+
+typedef TimerService::clock steady_clock;
+typedef boost::chrono::duration<double, boost::nano> nanoseconds;
+typedef boost::chrono::duration<double, boost::micro> microseconds;
+
+const steady_clock::duration period = ms(5);
+const size_t delayed                = 1000;
+
+struct Jitter {
+    double mean, max; // microseconds
+};
+
+Jitter jitter(const std::vector<double>& late)
+{
+    Jitter j;
+    j.mean = 0.0;
+    j.max  = *std::max_element(late.begin(), late.end());
+    for (size_t i = 0; i < late.size(); ++i) {
+        j.mean += late[i] / late.size();
+    }
+    return j;
+}
+
+/// @return the lateness of each run compared with start + k * period
+std::vector<double> periodic(
+    ThreadPool& pool, ThreadPool::Schedule schedule, size_t runs, bool& ok)
+{
+    std::vector<steady_clock::time_point> starts;
+    starts.reserve(runs);
+    boost::latch done(runs);
+
+    const steady_clock::time_point start = steady_clock::now();
+    ScheduledTask task                   = pool.execute_every(
+        period,
+        [&starts, &done, runs]() {
+            if (starts.size() < runs) {
+                starts.push_back(steady_clock::now());
+                done.count_down();
+            }
+        },
+        schedule);
+    done.wait();
+    ok = task.cancel() && ok;
+    ok = !task.cancel() && ok; // NOTE: only once
+
+    std::vector<double> late;
+    for (size_t k = 0; k < runs; ++k) {
+        const steady_clock::time_point ideal =
+            (schedule == ThreadPool::FIXED_RATE)
+            ? start + period * static_cast<long>(k + 1)
+            : (k ? starts[k - 1] : start) + period;
+        late.push_back(microseconds(starts[k] - ideal).count());
+        ok = ok && (starts[k] >= ideal);
+    }
+    return late;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t pending = 100000;
+    size_t runs    = 100;
+    if (argc > 1) {
+        pending = static_cast<size_t>(std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        runs = static_cast<size_t>(std::atol(argv[2]));
+    }
+    bool ok = true;
+
+    QueuedThreadPool pool(2);
+
+    std::vector<ScheduledTask> tasks;
+    tasks.reserve(pending);
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < pending; ++i) {
+        tasks.push_back(pool.execute_after(sec(3600), []() { }));
+    }
+    const double scheduled =
+        nanoseconds(steady_clock::now() - start).count() / pending;
+
+    std::printf("pending: %lu, execute_after: %.1f ns\n",
+        static_cast<unsigned long>(pending), scheduled);
+
+    std::printf("\n%12s %8s %12s %12s\n", "schedule", "runs", "mean[us]",
+        "max[us]");
+    Jitter j = jitter(periodic(pool, ThreadPool::FIXED_RATE, runs, ok));
+    std::printf("%12s %8lu %12.1f %12.1f\n", "fixed rate",
+        static_cast<unsigned long>(runs), j.mean, j.max);
+    j = jitter(periodic(pool, ThreadPool::FIXED_DELAY, runs, ok));
+    std::printf("%12s %8lu %12.1f %12.1f\n", "fixed delay",
+        static_cast<unsigned long>(runs), j.mean, j.max);
+
+    start = steady_clock::now();
+    for (size_t i = 0; i < pending; ++i) {
+        ok = tasks[i].cancel() && ok;
+    }
+    std::printf("\ncancel: %.1f ns\n",
+        nanoseconds(steady_clock::now() - start).count() / pending);
+
+    // NOTE: random delays up to 100 ms
+    boost::latch done(delayed);
+    std::vector<double> late(delayed, 0.0);
+    boost::atomic<size_t> early(0);
+    unsigned long seed = 4711;
+    for (size_t i = 0; i < delayed; ++i) {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        const steady_clock::time_point when =
+            steady_clock::now() + us((seed >> 33) % 100000);
+        double* lateness = &late[i];
+        (void)pool.execute_after(when - steady_clock::now(),
+            [when, lateness, &done, &early]() {
+                const steady_clock::time_point now = steady_clock::now();
+                if (now < when) {
+                    early++;
+                }
+                *lateness = microseconds(now - when).count();
+                done.count_down();
+            });
+    }
+    done.wait();
+    j = jitter(late);
+    std::printf("execute_after: %lu, early: %lu, late mean: %.1f us, "
+                "max: %.1f us\n",
+        static_cast<unsigned long>(delayed),
+        static_cast<unsigned long>(early.load()), j.mean, j.max);
+    ok = ok && (early.load() == 0);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+//
+// Wakeup latency benchmark: SpinWait options of Agentpp::ThreadPool
+//
+// Tasks are executed one after another on a pool of one thread with a
+// gap between the tasks. The latency from execute() to the start of the
+// task is measured for an idle thread which parks at once, spins for a
+// fixed time, or adapts its spin time to the gap.
+//
+// usage: perf_spin_wait [tasks]
+//
+
+#include "threadpool.hpp"
+
+#include <boost/atomic.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/thread_only.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace Agentpp;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+
+void busy_wait(long nanos)
+{
+    const steady_clock::time_point end =
+        steady_clock::now() + boost::chrono::nanoseconds(nanos);
+    while (steady_clock::now() < end) { }
+}
+
+struct Result {
+    double median, mean; // microseconds
+};
+
+Result run(const SpinWait& spin, size_t tasks, long gap)
+{
+    std::vector<double> latency(tasks);
+    ThreadPool pool(1, AGENTPP_DEFAULT_STACKSIZE, spin);
+
+    for (size_t i = 0; i < tasks; ++i) {
+        boost::atomic<bool> done(false);
+        steady_clock::time_point started;
+        const steady_clock::time_point submitted = steady_clock::now();
+        pool.execute(Task([&done, &started]() {
+            started = steady_clock::now();
+            done.store(true, boost::memory_order_release);
+        }));
+        while (!done.load(boost::memory_order_acquire)) {
+            boost::this_thread::yield();
+        }
+        latency[i] =
+            boost::chrono::duration<double, boost::micro>(started - submitted)
+                .count();
+        busy_wait(gap);
+    }
+
+    pool.terminate();
+
+    Result r;
+    r.mean = 0.0;
+    for (size_t i = 0; i < tasks; ++i) {
+        r.mean += latency[i] / tasks;
+    }
+    std::nth_element(
+        latency.begin(), latency.begin() + tasks / 2, latency.end());
+    r.median = latency[tasks / 2];
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t tasks = 10000;
+    if (argc > 1) {
+        tasks = static_cast<size_t>(std::atol(argv[1]));
+    }
+
+    std::printf("tasks: %lu, cpus: %u, spin limit: %lu ns\n",
+        static_cast<unsigned long>(tasks),
+        boost::thread::hardware_concurrency(), AGENTPP_SPIN_WAIT_NS);
+    std::printf("%8s %22s %22s %22s\n", "gap[us]", "park med/mean[us]",
+        "fixed med/mean[us]", "adaptive med/mean[us]");
+
+    const long gaps[] = { 0, 10000, 100000 };
+    for (size_t g = 0; g < sizeof(gaps) / sizeof(gaps[0]); ++g) {
+        Result p = run(SpinWait(SpinWait::PARK), tasks, gaps[g]);
+        Result f = run(SpinWait(SpinWait::FIXED), tasks, gaps[g]);
+        Result a = run(SpinWait(SpinWait::ADAPTIVE), tasks, gaps[g]);
+        std::printf("%8ld %11.2f/%-10.2f %11.2f/%-10.2f %11.2f/%-10.2f\n",
+            gaps[g] / 1000, p.median, p.mean, f.median, f.mean, a.median,
+            a.mean);
+    }
+
+    return 0;
+}
@@ -0,0 +1,449 @@
+//
+// Monitor benchmark: Agentpp::Synchronized vs boost::mutex and
+// boost::condition_variable
+//
+// - uncontended: lock() and unlock() by one thread
+// - contended:   4 threads increment a counter under the lock
+// - ping-pong:   one producer and 1 or 2 consumers hand over a counter
+//                with wait() and notify_all(), see perf_condition_variable
+// - timed lock:  the median time from unlock() to the return of a waiting
+//                lock(timeout), and the time until lock(20) of a lock held
+//                for 200 ms gives up
+//
+// The ping-pong waits with a timeout of 1 ms. A wait which times out
+// while it should have been notified is counted as a stall, a monitor
+// which loses wakeups shows many of them.
+//
+// Before the timings, the less used paths of Synchronized are checked:
+// wait_for() with and without notify(), lock(timeout) and trylock() of
+// a lock held by this or another thread, the detection of recursive
+// locking and notify_all() to waiters requeued to the lock word. The
+// program fails if one of them does, if the median handover of the
+// timed lock takes 2 ms or more, or if lock(20) returns before 20 ms or
+// after 100 ms.
+//
+// Build with -DAGENTPP_NO_FUTEX for the boost based Synchronized, the
+// test perf_synchronized_nofutex does so.
+//
+// usage: perf_synchronized [iterations]
+//
+
+#include "threadpool.hpp"
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/latch.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread_only.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double, boost::nano> nanoseconds;
+typedef boost::chrono::duration<double, boost::micro> microseconds;
+typedef boost::chrono::duration<double, boost::milli> milliseconds;
+typedef Agentpp::Synchronized Synchronized;
+
+bool check(const char* name, bool passed)
+{
+    std::printf("%24s %16s\n", name, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+void lock_and_notify(Synchronized* sync)
+{
+    sync->lock(); // NOTE: free only while the other thread waits! CK
+    sync->notify();
+    sync->unlock();
+}
+
+bool wait_for_timeout()
+{
+    Synchronized sync;
+    sync.lock();
+    const steady_clock::time_point start = steady_clock::now();
+    const bool notified = sync.wait_for(20); // ms
+    const double elapsed = milliseconds(steady_clock::now() - start).count();
+    // NOTE: the lock is owned again after the timeout! CK
+    const bool owned = sync.trylock() == Synchronized::OWNED;
+
+    boost::thread t(lock_and_notify, &sync);
+    const bool woken = sync.wait_for(10000); // ms
+    sync.unlock();
+    t.join();
+
+    return !notified && elapsed >= 20.0 && owned && woken;
+}
+
+void try_other(Synchronized* sync, Synchronized::TryLockResult* result,
+    bool* timed)
+{
+    *result = sync->trylock();
+    *timed  = sync->lock(10); // ms
+}
+
+bool trylock_owned()
+{
+    Synchronized sync;
+    bool ok = sync.trylock() == Synchronized::LOCKED;
+    ok      = ok && sync.trylock() == Synchronized::OWNED;
+
+    Synchronized::TryLockResult other = Synchronized::LOCKED;
+    bool timed                        = true;
+    boost::thread(try_other, &sync, &other, &timed).join();
+    ok = ok && other == Synchronized::BUSY && !timed;
+
+    ok = ok && sync.unlock() && !sync.unlock();
+    return ok;
+}
+
+bool recursive_lock()
+{
+    Synchronized sync;
+    sync.lock();
+    bool locked = true;
+    try {
+        locked = sync.lock();
+    } catch (std::runtime_error&) {
+        locked = false; // NOTE: only without NDEBUG! CK
+    }
+    bool ok = !locked && !sync.lock(10); // ms
+
+    // NOTE: there is no recursive locking, one unlock() frees the lock
+    ok = ok && sync.trylock() == Synchronized::OWNED;
+    ok = ok && sync.unlock() && !sync.unlock();
+    return ok;
+}
+
+struct Waiters {
+    Synchronized sync;
+    unsigned ready;
+    unsigned woken;
+    bool go;
+};
+
+void wait_for_go(Waiters* w)
+{
+    w->sync.lock();
+    ++w->ready;
+    while (!w->go) {
+        // NOTE: a lost wakeup shows as a timeout of 2 s! CK
+        (void)w->sync.wait_for(2000); // ms
+    }
+    ++w->woken;
+    w->sync.unlock();
+}
+
+bool notify_all_requeue(unsigned rounds)
+{
+    const unsigned count = 4;
+    bool ok              = true;
+    for (unsigned r = 0; ok && r < rounds; ++r) {
+        Waiters w;
+        w.ready = w.woken = 0;
+        w.go              = false;
+
+        std::vector<boost::thread> threads;
+        for (unsigned i = 0; i < count; ++i) {
+            threads.push_back(boost::thread(wait_for_go, &w));
+        }
+        // NOTE: a waiter releases the lock only in wait_for()! CK
+        w.sync.lock();
+        while (w.ready != count) {
+            w.sync.unlock();
+            boost::this_thread::yield();
+            w.sync.lock();
+        }
+        w.go = true;
+        w.sync.notify_all(); // NOTE: with lock, the waiters are requeued
+        const steady_clock::time_point notified = steady_clock::now();
+        w.sync.unlock();
+
+        for (size_t t = 0; t < threads.size(); ++t) {
+            threads[t].join();
+        }
+        const double elapsed =
+            milliseconds(steady_clock::now() - notified).count();
+        ok = w.woken == count && elapsed < 1000.0;
+    }
+    return ok;
+}
+
+class SynchronizedMonitor {
+public:
+    void lock() { sync.lock(); }
+    void unlock() { sync.unlock(); }
+    bool wait_for_ms(unsigned long timeout) { return sync.wait_for(timeout); }
+    void notify_all() { sync.notify_all(); }
+
+private:
+    Agentpp::Synchronized sync;
+};
+
+class BoostMonitor {
+public:
+    void lock() { mutex.lock(); }
+    void unlock() { mutex.unlock(); }
+    bool wait_for_ms(unsigned long timeout)
+    {
+        boost::unique_lock<boost::mutex> l(mutex, boost::adopt_lock);
+        const bool notified = cond.wait_for(l, boost::chrono::milliseconds(
+                                                   timeout))
+            == boost::cv_status::no_timeout;
+        l.release(); // ownership
+        return notified;
+    }
+    void notify_all() { cond.notify_all(); }
+
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+};
+
+template <class Monitor> void lock_unlock(size_t iterations, double* result)
+{
+    Monitor m;
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        m.lock();
+        m.unlock();
+    }
+    *result = nanoseconds(steady_clock::now() - start).count() / iterations;
+}
+
+// NOTE: glibc omits the lock prefix while a process has only one thread,
+// so the loop runs on a thread of its own! CK
+template <class Monitor> double uncontended(size_t iterations)
+{
+    double result = 0.0;
+    boost::thread(lock_unlock<Monitor>, iterations, &result).join();
+    return result;
+}
+
+template <class Monitor> struct Counter {
+    Monitor monitor;
+    size_t value;
+};
+
+template <class Monitor> void increment(Counter<Monitor>* c, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        c->monitor.lock();
+        ++c->value;
+        c->monitor.unlock();
+    }
+}
+
+template <class Monitor> double contended(size_t iterations, bool& ok)
+{
+    Counter<Monitor> c;
+    c.value = 0;
+    std::vector<boost::thread> threads;
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t t = 0; t < 4; ++t) {
+        threads.push_back(
+            boost::thread(increment<Monitor>, &c, iterations / 4));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    ok = ok && (c.value == 4 * (iterations / 4));
+    return nanoseconds(steady_clock::now() - start).count() / c.value;
+}
+
+template <class Monitor> struct PingPong {
+    Monitor monitor;
+    unsigned rounds;
+    unsigned counter;   // incremented by the producer
+    unsigned semaphore; // incremented by each consumer
+    size_t stalls;      // timeouts of the waits
+};
+
+template <class Monitor> void producer(PingPong<Monitor>* p, unsigned consumers)
+{
+    for (unsigned i = 0; i < p->rounds; ++i) {
+        p->monitor.lock();
+        while (p->semaphore != consumers) {
+            if (!p->monitor.wait_for_ms(1) && p->semaphore != consumers) {
+                ++p->stalls;
+            }
+        }
+        p->semaphore = 0;
+        ++p->counter;
+        p->monitor.notify_all();
+        p->monitor.unlock();
+    }
+}
+
+template <class Monitor> void consumer(PingPong<Monitor>* p)
+{
+    unsigned seen = 0;
+    while (seen != p->rounds) {
+        p->monitor.lock();
+        while (seen == p->counter) {
+            if (!p->monitor.wait_for_ms(1) && seen == p->counter) {
+                ++p->stalls;
+            }
+        }
+        seen = p->counter;
+        ++p->semaphore;
+        p->monitor.notify_all();
+        p->monitor.unlock();
+    }
+}
+
+struct PingPongResult {
+    double round; // microseconds
+    size_t stalls;
+};
+
+template <class Monitor>
+PingPongResult ping_pong(unsigned rounds, unsigned consumers, bool& ok)
+{
+    PingPong<Monitor> p;
+    p.rounds    = rounds;
+    p.counter   = 0;
+    p.semaphore = consumers;
+    p.stalls    = 0;
+
+    std::vector<boost::thread> threads;
+    steady_clock::time_point start = steady_clock::now();
+    for (unsigned i = 0; i < consumers; ++i) {
+        threads.push_back(boost::thread(consumer<Monitor>, &p));
+    }
+    threads.push_back(boost::thread(producer<Monitor>, &p, consumers));
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    ok = ok && (p.counter == rounds);
+
+    PingPongResult r;
+    r.round  = nanoseconds(steady_clock::now() - start).count() / 1e3 / rounds;
+    r.stalls = p.stalls;
+    return r;
+}
+
+struct TimedLockHandover {
+    Synchronized sync;
+    boost::latch* locked;
+    unsigned hold;                      // ms
+    steady_clock::time_point released; // NOTE: written with lock
+};
+
+void hold_and_release(TimedLockHandover* h)
+{
+    h->sync.lock();
+    h->locked->count_down();
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(h->hold));
+    h->released = steady_clock::now();
+    h->sync.unlock();
+}
+
+// NOTE: a lock(timeout) polling every 10 ms has a median of 5 ms! CK
+double timed_lock_handover(size_t rounds, bool& ok)
+{
+    TimedLockHandover h;
+    h.hold = 1; // ms
+    std::vector<double> latency;
+    for (size_t i = 0; i < rounds; ++i) {
+        boost::latch locked(1);
+        h.locked = &locked;
+        boost::thread t(hold_and_release, &h);
+        locked.wait();
+
+        if (h.sync.lock(1000)) { // ms
+            latency.push_back(
+                microseconds(steady_clock::now() - h.released).count());
+            ok = h.sync.unlock() && ok;
+        } else {
+            ok = false;
+        }
+        t.join();
+    }
+    if (latency.empty()) {
+        return 0.0;
+    }
+
+    std::nth_element(
+        latency.begin(), latency.begin() + latency.size() / 2, latency.end());
+    const double median = latency[latency.size() / 2];
+    ok                  = ok && median < 2000.0;
+    return median;
+}
+
+double timed_lock_expiry(bool& ok)
+{
+    boost::latch locked(1);
+    TimedLockHandover h;
+    h.locked = &locked;
+    h.hold   = 200; // ms
+    boost::thread t(hold_and_release, &h);
+    locked.wait();
+
+    const steady_clock::time_point start = steady_clock::now();
+    const bool owned = h.sync.lock(20); // ms
+    const double elapsed = milliseconds(steady_clock::now() - start).count();
+    t.join();
+
+    ok = ok && !owned && elapsed >= 20.0 && elapsed < 100.0;
+    return elapsed;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = 1000000;
+    if (argc > 1) {
+        iterations = static_cast<size_t>(std::atol(argv[1]));
+    }
+    const unsigned rounds = static_cast<unsigned>(iterations / 100 + 1);
+    bool ok               = true;
+
+#ifdef AGENTPP_USE_FUTEX
+    std::printf("Synchronized: futex, iterations: %lu\n",
+#else
+    std::printf("Synchronized: boost, iterations: %lu\n",
+#endif
+        static_cast<unsigned long>(iterations));
+
+    ok = check("wait_for() timeout", wait_for_timeout()) && ok;
+    ok = check("trylock() OWNED", trylock_owned()) && ok;
+    ok = check("recursive lock()", recursive_lock()) && ok;
+    ok = check("notify_all() requeue", notify_all_requeue(100)) && ok;
+
+    std::printf("%24s %16s %16s\n", "", "Synchronized", "boost");
+
+    std::printf("%24s %16.1f %16.1f\n", "uncontended [ns/lock]",
+        uncontended<SynchronizedMonitor>(iterations),
+        uncontended<BoostMonitor>(iterations));
+    std::printf("%24s %16.1f %16.1f\n", "4 threads [ns/lock]",
+        contended<SynchronizedMonitor>(iterations, ok),
+        contended<BoostMonitor>(iterations, ok));
+
+    for (unsigned consumers = 1; consumers <= 2; ++consumers) {
+        PingPongResult s = ping_pong<SynchronizedMonitor>(rounds, consumers, ok);
+        PingPongResult b = ping_pong<BoostMonitor>(rounds, consumers, ok);
+        char label[32];
+        std::snprintf(label, sizeof(label), "%u consumer [us/round]", consumers);
+        std::printf("%24s %16.2f %16.2f\n", label, s.round, b.round);
+        std::snprintf(label, sizeof(label), "%u consumer [stalls]", consumers);
+        std::printf("%24s %16lu %16lu\n", label,
+            static_cast<unsigned long>(s.stalls),
+            static_cast<unsigned long>(b.stalls));
+    }
+
+    std::printf("%24s %16.1f\n", "lock(timeout) wake [us]",
+        timed_lock_handover(200, ok));
+    std::printf(
+        "%24s %16.1f\n", "lock(20) expiry [ms]", timed_lock_expiry(ok));
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+//
+// Allocation benchmark: Runnable* vs. Task vs. submit() to Agentpp::ThreadPool
+//
+// The global operator new is replaced to count the heap allocations made
+// while tiny tasks are executed. A lambda which fits into the inline
+// storage of a Task should cost no allocation on the ThreadPool, else the
+// program fails. The same holds for submit(), its Future states are
+// reused. boost::async() on a boost::basic_thread_pool is the reference.
+// Exceptions thrown by a submitted task have to be passed to its Future.
+//
+// usage: perf_task_allocations [tasks]
+//
+
+#include "threadpool.hpp"
+
+#include <boost/atomic.hpp>
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/executors/basic_thread_pool.hpp>
+#include <boost/thread/latch.hpp>
+
+#include <boost/thread/future.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+
+boost::atomic<size_t> allocations(0);
+
+} // namespace
+
+// NOTE: not inlined, else g++ warns about new/free mismatches! CK
+BOOST_NOINLINE void* operator new(std::size_t size)
+{
+    ++allocations;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+BOOST_NOINLINE void operator delete(void* p) noexcept { std::free(p); }
+BOOST_NOINLINE void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double> seconds;
+
+class TinyTask : public Agentpp::Runnable {
+public:
+    explicit TinyTask(boost::latch& l)
+        : done(l)
+    { }
+
+    std::unique_ptr<Agentpp::Runnable> clone() const BOOST_OVERRIDE
+    {
+        return std::make_unique<TinyTask>(done);
+    }
+
+    void run() BOOST_OVERRIDE { done.count_down(); }
+
+private:
+    boost::latch& done;
+};
+
+struct Result {
+    double per_task, rate;
+};
+
+enum Mode { RUNNABLE, TASK, SUBMIT };
+
+// NOTE: the number of submit() futures waited for at once! CK
+const size_t window = 64;
+
+template <class Pool> Result run(size_t tasks, Mode mode)
+{
+    boost::latch done(mode == SUBMIT ? 0 : tasks);
+    std::vector<Agentpp::Future<size_t> > futures;
+    futures.reserve(window);
+    size_t sum = 0;
+    Pool pool(4);
+
+    const size_t before             = allocations;
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < tasks; ++i) {
+        if (mode == SUBMIT) {
+            futures.push_back(pool.submit([i]() { return i; }));
+            if (futures.size() == window || i + 1 == tasks) {
+                for (size_t f = 0; f < futures.size(); ++f) {
+                    sum += futures[f].get();
+                }
+                futures.clear();
+            }
+        } else if (mode == TASK) {
+            pool.execute(Agentpp::Task([&done]() { done.count_down(); }));
+        } else {
+            pool.execute(new TinyTask(done));
+        }
+    }
+    done.wait();
+    seconds elapsed = steady_clock::now() - start;
+    const size_t after = allocations;
+
+    pool.terminate();
+    if (mode == SUBMIT && sum != tasks * (tasks - 1) / 2) {
+        std::printf("wrong sum of results: %lu\n", (unsigned long)sum);
+    }
+
+    Result r;
+    r.per_task = double(after - before) / tasks;
+    r.rate     = tasks / elapsed.count();
+    return r;
+}
+
+// the reference: boost::async() on a boost::basic_thread_pool
+Result run_async(size_t tasks)
+{
+    std::vector<boost::future<size_t> > futures;
+    futures.reserve(window);
+    boost::basic_thread_pool pool(4);
+
+    const size_t before             = allocations;
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < tasks; ++i) {
+        futures.push_back(boost::async(pool, [i]() { return i; }));
+        if (futures.size() == window || i + 1 == tasks) {
+            for (size_t f = 0; f < futures.size(); ++f) {
+                futures[f].get();
+            }
+            futures.clear();
+        }
+    }
+    seconds elapsed = steady_clock::now() - start;
+    const size_t after = allocations;
+
+    pool.close();
+
+    Result r;
+    r.per_task = double(after - before) / tasks;
+    r.rate     = tasks / elapsed.count();
+    return r;
+}
+
+// an exception of the task and a task never run have to reach the Future
+bool check_exceptions()
+{
+    bool thrown = false;
+    bool broken = false;
+    Agentpp::ThreadPool pool(1);
+
+    Agentpp::Future<int> f =
+        pool.submit([]() -> int { throw std::runtime_error("failed"); });
+    try {
+        f.get();
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+
+    pool.terminate();
+    Agentpp::Future<void> g = pool.submit([]() { });
+    try {
+        g.get();
+    } catch (std::future_error& e) {
+        broken = (e.code() == std::future_errc::broken_promise);
+    }
+
+    return thrown && broken;
+}
+
+void print(const char* pool, const char* submit, const Result& r)
+{
+    std::printf(
+        "%18s %10s %14.2f %14.0f\n", pool, submit, r.per_task, r.rate);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t tasks = 100000;
+    if (argc > 1) {
+        tasks = static_cast<size_t>(std::atol(argv[1]));
+    }
+
+    std::printf("tasks: %lu, Task inline size: %d bytes\n",
+        static_cast<unsigned long>(tasks), AGENTPP_TASK_INLINE_SIZE);
+    std::printf("%18s %10s %14s %14s\n", "pool", "submit", "allocs/task",
+        "tasks/s");
+
+    using Agentpp::QueuedThreadPool;
+    using Agentpp::ThreadPool;
+
+    print("ThreadPool", "Runnable*", run<ThreadPool>(tasks, RUNNABLE));
+    Result task = run<ThreadPool>(tasks, TASK);
+    print("ThreadPool", "Task", task);
+    Result submit = run<ThreadPool>(tasks, SUBMIT);
+    print("ThreadPool", "submit()", submit);
+    print("QueuedThreadPool", "Runnable*",
+        run<QueuedThreadPool>(tasks, RUNNABLE));
+    print("QueuedThreadPool", "Task", run<QueuedThreadPool>(tasks, TASK));
+    print("QueuedThreadPool", "submit()",
+        run<QueuedThreadPool>(tasks, SUBMIT));
+    print("basic_thread_pool", "async()", run_async(tasks));
+
+    // NOTE: a small Task must not allocate on the ThreadPool, the states
+    // of the futures are reused after the first window! CK
+    const bool allocation_free =
+        (task.per_task == 0.0) && (submit.per_task * tasks <= window);
+    return (allocation_free && check_exceptions()) ? 0 : 1;
+}
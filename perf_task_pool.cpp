@@ -0,0 +1,143 @@
+//
+// Task recycling benchmark: Agentpp::PooledRunnable vs. plain new/delete
+//
+// Two workloads are run with a task class derived from Runnable and an
+// identical one derived from PooledRunnable:
+//  - local: each of 4 threads creates and deletes its own tasks
+//  - pool:  one thread submits the tasks to a ThreadPool of 4 threads,
+//           so each task is deleted by another thread than it was created
+//
+// The TaskAllocator counters show how many tasks were served without the
+// global allocator.
+//
+// usage: perf_task_pool [tasks]
+//
+
+#include "threadpool.hpp"
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+#include <boost/thread/thread_only.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace Agentpp;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double> seconds;
+
+// NOTE: about the size of a MibTask with its request pointer! CK
+template <class Base> class SnmpTask : public Base {
+public:
+    explicit SnmpTask(boost::latch* l)
+        : done(l)
+    { }
+
+    std::unique_ptr<Runnable> clone() const BOOST_OVERRIDE
+    {
+        return std::make_unique<SnmpTask>(done);
+    }
+
+    void run() BOOST_OVERRIDE
+    {
+        if (done) {
+            done->count_down();
+        }
+    }
+
+private:
+    boost::latch* done;
+    char request[32];
+};
+
+typedef SnmpTask<Runnable> PlainTask;
+typedef SnmpTask<PooledRunnable> RecycledTask;
+
+template <class T> void create_and_delete(size_t count)
+{
+    std::vector<Runnable*> tasks(16);
+    for (size_t i = 0; i < count; i += tasks.size()) {
+        for (size_t k = 0; k < tasks.size(); ++k) {
+            tasks[k] = new T(nullptr);
+        }
+        for (size_t k = 0; k < tasks.size(); ++k) {
+            delete tasks[k];
+        }
+    }
+}
+
+template <class T> double local(size_t tasks)
+{
+    steady_clock::time_point start = steady_clock::now();
+    std::vector<boost::thread> threads;
+    for (size_t t = 0; t < 4; ++t) {
+        threads.push_back(boost::thread(create_and_delete<T>, tasks / 4));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    seconds elapsed = steady_clock::now() - start;
+    return tasks / elapsed.count();
+}
+
+template <class T> double pool(size_t tasks)
+{
+    boost::latch done(tasks);
+    ThreadPool threadPool(4);
+
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < tasks; ++i) {
+        threadPool.execute(new T(&done));
+    }
+    done.wait();
+    seconds elapsed = steady_clock::now() - start;
+
+    threadPool.terminate();
+    return tasks / elapsed.count();
+}
+
+void print(const char* workload, double plain, double recycled,
+    const TaskAllocator::Statistics& before)
+{
+    TaskAllocator::Statistics after = TaskAllocator::statistics();
+    const size_t allocations = after.allocations - before.allocations;
+    const size_t heap = after.heap_allocations - before.heap_allocations;
+    std::printf("%10s %14.0f %14.0f %12lu %12lu %12lu\n", workload, plain,
+        recycled, static_cast<unsigned long>(allocations),
+        static_cast<unsigned long>(heap),
+        static_cast<unsigned long>(
+            after.depot_transfers - before.depot_transfers));
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t tasks = 400000;
+    if (argc > 1) {
+        tasks = static_cast<size_t>(std::atol(argv[1]));
+    }
+
+    std::printf("tasks: %lu, task size: %lu bytes\n",
+        static_cast<unsigned long>(tasks),
+        static_cast<unsigned long>(sizeof(RecycledTask)));
+    std::printf("%10s %14s %14s %12s %12s %12s\n", "workload", "new/delete/s",
+        "recycled/s", "allocations", "from heap", "transfers");
+
+    double plain                     = local<PlainTask>(tasks);
+    TaskAllocator::Statistics before = TaskAllocator::statistics();
+    double recycled                  = local<RecycledTask>(tasks);
+    print("local", plain, recycled, before);
+
+    plain    = pool<PlainTask>(tasks);
+    before   = TaskAllocator::statistics();
+    recycled = pool<RecycledTask>(tasks);
+    print("pool", plain, recycled, before);
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+//
+// Producer contention benchmark: AgentppCK::QueuedThreadPool with the
+// unbounded (mutex protected) queue vs the bounded lock-free ring buffer
+//
+// Several producer threads execute() tiny tasks at the same time on a pool
+// of 2 threads. With the BLOCK policy a producer has to wait if the bounded
+// queue is full, so the memory used by the queue stays bounded.
+//
+// usage: perf_task_queue [tasks] [capacity]
+//
+
+#include "posix/threadpool.hpp"
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+#include <boost/thread/thread_only.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace AgentppCK;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double> seconds;
+
+class TinyTask : public Runnable {
+public:
+    explicit TinyTask(boost::latch& l)
+        : done(l)
+    { }
+
+    void run() BOOST_OVERRIDE { done.count_down(); }
+
+private:
+    boost::latch& done;
+};
+
+void producer(QueuedThreadPool* pool, boost::latch* done, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        pool->execute(new TinyTask(*done));
+    }
+}
+
+double run(size_t producers, size_t tasks, size_t capacity)
+{
+    boost::latch done(tasks);
+    QueuedThreadPool pool(
+        2, AGENTPP_DEFAULT_STACKSIZE, capacity, TaskQueue::BLOCK);
+
+    steady_clock::time_point start = steady_clock::now();
+    std::vector<boost::thread> threads;
+    const size_t chunk = tasks / producers;
+    for (size_t p = 0; p < producers; ++p) {
+        const size_t count = (p + 1 == producers) ? tasks - p * chunk : chunk;
+        threads.push_back(boost::thread(producer, &pool, &done, count));
+    }
+    for (size_t p = 0; p < threads.size(); ++p) {
+        threads[p].join();
+    }
+    done.wait();
+    seconds elapsed = steady_clock::now() - start;
+
+    pool.terminate();
+    return tasks / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t tasks    = 200000;
+    size_t capacity = 1024;
+    if (argc > 1) {
+        tasks = static_cast<size_t>(std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        capacity = static_cast<size_t>(std::atol(argv[2]));
+    }
+
+    std::printf("tasks: %lu, bounded capacity: %lu\n",
+        static_cast<unsigned long>(tasks), static_cast<unsigned long>(capacity));
+    std::printf("%10s %16s %16s\n", "producers", "unbounded/s", "bounded/s");
+
+    const size_t producers[] = { 1, 2, 4, 8 };
+    for (size_t i = 0; i < sizeof(producers) / sizeof(producers[0]); ++i) {
+        double u = run(producers[i], tasks, 0);
+        double b = run(producers[i], tasks, capacity);
+        std::printf("%10lu %16.0f %16.0f\n",
+            static_cast<unsigned long>(producers[i]), u, b);
+    }
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+//
+// Dispatch latency benchmark for Agentpp::ThreadPool::execute()
+//
+// Measures the time between the call of execute() and the start of the
+// task's run() method on a worker thread. Tasks are submitted in bursts
+// (more tasks than workers), so most of them have to wait for a worker to
+// become idle. The p50/p99/max values show how fast an idle worker is
+// handed the next task.
+//
+// usage: perf_threadpool_dispatch [tasks-per-run]
+//
+
+#include "threadpool.hpp"
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+#include <boost/thread/thread_only.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::nanoseconds nanoseconds;
+
+class LatencyTask : public Agentpp::Runnable {
+public:
+    LatencyTask(std::vector<nanoseconds>& s, size_t i, boost::latch& l,
+        unsigned work_us)
+        : samples(s)
+        , index(i)
+        , done(l)
+        , work(work_us)
+        , submitted(steady_clock::now())
+    { }
+
+    std::unique_ptr<Agentpp::Runnable> clone() const BOOST_OVERRIDE
+    {
+        return std::make_unique<LatencyTask>(samples, index, done, work);
+    }
+
+    void run() BOOST_OVERRIDE
+    {
+        steady_clock::time_point started = steady_clock::now();
+        samples[index]                   = started - submitted;
+
+        // NOTE: simulate a short SNMP GET handler (busy, no sleep)! CK
+        while (steady_clock::now() - started < boost::chrono::microseconds(work))
+            ;
+        done.count_down();
+    }
+
+private:
+    std::vector<nanoseconds>& samples;
+    const size_t index;
+    boost::latch& done;
+    const unsigned work;
+    const steady_clock::time_point submitted;
+};
+
+struct Result {
+    double p50, p99, max, total;
+};
+
+void submitter(Agentpp::ThreadPool* pool, std::vector<nanoseconds>* samples,
+    size_t first, size_t count, boost::latch* done, unsigned work_us)
+{
+    for (size_t i = first; i < first + count; ++i) {
+        pool->execute(new LatencyTask(*samples, i, *done, work_us));
+    }
+}
+
+Result benchmark_dispatch(
+    size_t threads, size_t submitters, size_t tasks, unsigned work_us)
+{
+    std::vector<nanoseconds> samples(tasks);
+    boost::latch done(tasks);
+    steady_clock::time_point start;
+    {
+        Agentpp::ThreadPool pool(threads);
+
+        start = steady_clock::now();
+        std::vector<boost::thread> producers;
+        const size_t chunk = tasks / submitters;
+        for (size_t s = 0; s < submitters; ++s) {
+            const size_t first = s * chunk;
+            const size_t count = (s + 1 == submitters) ? tasks - first : chunk;
+            producers.push_back(boost::thread(submitter, &pool, &samples,
+                first, count, &done, work_us));
+        }
+        for (size_t s = 0; s < producers.size(); ++s) {
+            producers[s].join();
+        }
+        done.wait();
+        pool.terminate();
+    }
+    nanoseconds total = steady_clock::now() - start;
+
+    std::sort(samples.begin(), samples.end());
+    Result r;
+    r.p50   = samples[tasks / 2].count() * 1e-3;
+    r.p99   = samples[(tasks * 99) / 100].count() * 1e-3;
+    r.max   = samples.back().count() * 1e-3;
+    r.total = total.count() * 1e-6;
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t tasks = 2000;
+    if (argc > 1) {
+        tasks = static_cast<size_t>(std::atol(argv[1]));
+    }
+
+    const size_t pool_sizes[] = { 1, 4, 16 };
+    const size_t submitters[] = { 1, 4 };
+    const unsigned work_us    = 20;
+
+    std::printf("tasks per run: %lu, work per task: %u us\n",
+        static_cast<unsigned long>(tasks), work_us);
+    std::printf("%8s %10s %12s %12s %12s %12s\n", "threads", "submitters",
+        "p50[us]", "p99[us]", "max[us]", "total[ms]");
+
+    for (size_t p = 0; p < sizeof(pool_sizes) / sizeof(pool_sizes[0]); ++p) {
+        for (size_t s = 0; s < sizeof(submitters) / sizeof(submitters[0]);
+             ++s) {
+            Result r = benchmark_dispatch(
+                pool_sizes[p], submitters[s], tasks, work_us);
+            std::printf("%8lu %10lu %12.1f %12.1f %12.1f %12.1f\n",
+                static_cast<unsigned long>(pool_sizes[p]),
+                static_cast<unsigned long>(submitters[s]), r.p50, r.p99,
+                r.max, r.total);
+        }
+    }
+
+    return 0;
+}
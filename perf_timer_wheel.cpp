@@ -0,0 +1,216 @@
+//
+// Timer benchmark: Agentpp::TimerService vs a sorted list and a multimap
+//
+// Many timers with random delays between 1 s and 1 h are scheduled and
+// cancelled again, like the retransmit timers of SNMP requests which are
+// answered in time. The sorted list of alarm_cond.cpp needs O(n) per
+// insert, so it is only measured with up to 20000 timers. At last some
+// timers with short delays really fire on a QueuedThreadPool; none may
+// fire before its time. A ThreadPool with its only thread busy must not
+// block the expiry thread: the due Tasks run once the thread is idle,
+// and stop() returns at once.
+//
+// usage: perf_timer_wheel [timers]
+//
+
+#include "threadpool.hpp"
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <vector>
+
+using namespace Agentpp;
+
+namespace
+{
+
+typedef TimerService::clock steady_clock;
+typedef boost::chrono::duration<double, boost::nano> nanoseconds;
+typedef boost::chrono::duration<double, boost::micro> microseconds;
+
+const size_t list_limit = 20000;
+const size_t fired      = 10000;
+
+struct Result {
+    double schedule, cancel; // nanoseconds per timer
+};
+
+std::vector<steady_clock::duration> random_delays(size_t n)
+{
+    std::vector<steady_clock::duration> delays;
+    delays.reserve(n);
+    unsigned long seed = 4711;
+    for (size_t i = 0; i < n; ++i) {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        delays.push_back(ms(1000 + (seed >> 33) % 3599000)); // 1 s .. 1 h
+    }
+    return delays;
+}
+
+Result run_list(const std::vector<steady_clock::duration>& delays)
+{
+    typedef std::list<steady_clock::time_point> List;
+    List alarms;
+    std::vector<List::iterator> ids;
+    ids.reserve(delays.size());
+
+    Result r;
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < delays.size(); ++i) {
+        const steady_clock::time_point when = start + delays[i];
+        List::iterator it                   = alarms.begin();
+        while (it != alarms.end() && *it <= when) {
+            ++it; // NOTE: the linear search of alarm_insert()
+        }
+        ids.push_back(alarms.insert(it, when));
+    }
+    steady_clock::time_point scheduled = steady_clock::now();
+    for (size_t i = 0; i < ids.size(); ++i) {
+        alarms.erase(ids[i]);
+    }
+    r.schedule = nanoseconds(scheduled - start).count() / delays.size();
+    r.cancel   = nanoseconds(steady_clock::now() - scheduled).count()
+        / delays.size();
+    return r;
+}
+
+Result run_map(const std::vector<steady_clock::duration>& delays)
+{
+    typedef std::multimap<steady_clock::time_point, Task> Map;
+    Map alarms;
+    std::vector<Map::iterator> ids;
+    ids.reserve(delays.size());
+
+    Result r;
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < delays.size(); ++i) {
+        ids.push_back(alarms.emplace(start + delays[i], Task([]() { })));
+    }
+    steady_clock::time_point scheduled = steady_clock::now();
+    for (size_t i = 0; i < ids.size(); ++i) {
+        alarms.erase(ids[i]);
+    }
+    r.schedule = nanoseconds(scheduled - start).count() / delays.size();
+    r.cancel   = nanoseconds(steady_clock::now() - scheduled).count()
+        / delays.size();
+    return r;
+}
+
+Result run_wheel(
+    TimerService& timers, const std::vector<steady_clock::duration>& delays)
+{
+    std::vector<TimerService::TimerId> ids;
+    ids.reserve(delays.size());
+
+    Result r;
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < delays.size(); ++i) {
+        ids.push_back(timers.schedule_at(start + delays[i], []() { }));
+    }
+    steady_clock::time_point scheduled = steady_clock::now();
+    for (size_t i = 0; i < ids.size(); ++i) {
+        (void)timers.cancel(ids[i]);
+    }
+    r.schedule = nanoseconds(scheduled - start).count() / delays.size();
+    r.cancel   = nanoseconds(steady_clock::now() - scheduled).count()
+        / delays.size();
+    return r;
+}
+
+void print(const char* name, size_t n, const Result& r)
+{
+    std::printf("%14s %10lu %14.1f %14.1f\n", name,
+        static_cast<unsigned long>(n), r.schedule, r.cancel);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t timers = 1000000;
+    if (argc > 1) {
+        timers = static_cast<size_t>(std::atol(argv[1]));
+    }
+    bool ok = true;
+
+    QueuedThreadPool pool(2);
+    TimerService service(pool);
+
+    const std::vector<steady_clock::duration> delays = random_delays(timers);
+    std::printf("%14s %10s %14s %14s\n", "timers", "n", "schedule[ns]",
+        "cancel[ns]");
+    const std::vector<steady_clock::duration> few(delays.begin(),
+        delays.begin() + static_cast<long>(std::min(timers, list_limit)));
+    print("sorted list", few.size(), run_list(few));
+    print("multimap", timers, run_map(delays));
+    print("timer wheel", timers, run_wheel(service, delays));
+    ok = ok && (service.pending() == 0);
+
+    // NOTE: the fired timers are spread over 200 ms
+    boost::latch done(fired);
+    boost::atomic<size_t> early(0);
+    std::vector<double> late(fired, 0.0);
+    const steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < fired; ++i) {
+        const steady_clock::time_point when = start + us((i * 200000) / fired);
+        double* lateness                    = &late[i];
+        (void)service.schedule_at(when, [when, lateness, &done, &early]() {
+            const steady_clock::time_point now = steady_clock::now();
+            if (now < when) {
+                early++;
+            }
+            *lateness = microseconds(now - when).count();
+            done.count_down();
+        });
+    }
+    done.wait();
+
+    double mean = 0.0;
+    for (size_t i = 0; i < fired; ++i) {
+        mean += late[i] / fired;
+    }
+    std::printf("\nfired: %lu, early: %lu, late mean: %.1f us, max: %.1f us\n",
+        static_cast<unsigned long>(fired),
+        static_cast<unsigned long>(early.load()), mean,
+        *std::max_element(late.begin(), late.end()));
+    ok = ok && (early.load() == 0) && (service.pending() == 0);
+
+    boost::latch ran(2);
+    boost::latch release(1);
+    boost::latch released(1);
+    ThreadPool busy(1UL);
+    TimerService blocked(busy);
+    busy.execute([&release]() { release.wait(); });
+    for (size_t i = 0; i < 2; ++i) {
+        (void)blocked.schedule_after(us(1000), [&ran]() { ran.count_down(); });
+    }
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+    ok = ok && (blocked.pending() == 0) && !ran.try_wait(); // NOTE: kept
+    release.count_down();
+    ok = ok
+        && ran.wait_for(boost::chrono::seconds(10))
+            == boost::cv_status::no_timeout;
+
+    // NOTE: released only after 500 ms, if stop() blocked it would wait
+    busy.execute([&released]() { released.wait(); });
+    (void)blocked.schedule_after(us(1000), []() { });
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+    boost::thread later([&released]() {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(500));
+        released.count_down();
+    });
+    const steady_clock::time_point stopping = steady_clock::now();
+    blocked.stop();
+    const double stopped = microseconds(steady_clock::now() - stopping).count();
+    later.join();
+    std::printf("busy ThreadPool: stop() after %.1f us\n", stopped);
+    ok = ok && stopped < 250000.0;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+//
+// Idle benchmark: QueuedThreadPool::wait_idle() vs polling is_idle()
+//
+// At first many short tasks are executed while a monitor thread polls
+// is_busy() and queue_length() without pause; these read counters
+// without lock, so the monitor must not slow down the pool. Then a task
+// which runs for some ms is executed and the caller waits until the pool
+// is idle again, once with a Thread::sleep(100) polling loop (like the
+// tests do) and once with wait_idle(). The time between the end of the
+// task and the return of the caller is measured.
+//
+// usage: perf_wait_idle [tasks] [rounds]
+//
+
+#include "threadpool.hpp"
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+#include <boost/thread/thread_only.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace Agentpp;
+
+namespace
+{
+
+typedef boost::chrono::duration<double, boost::nano> nanoseconds;
+typedef boost::chrono::duration<double, boost::milli> milliseconds;
+
+double run_tasks(QueuedThreadPool& pool, size_t tasks, bool monitor)
+{
+    boost::atomic<bool> done(false);
+    boost::atomic<size_t> polls(0);
+    boost::thread poller;
+    if (monitor) {
+        poller = boost::thread([&pool, &done, &polls]() {
+            while (!done.load()) {
+                if (pool.is_busy() || pool.queue_length() > 0) {
+                    polls++;
+                }
+                boost::this_thread::yield();
+            }
+        });
+    }
+
+    boost::latch finished(tasks);
+    const time_point start = Clock::now();
+    for (size_t i = 0; i < tasks; ++i) {
+        pool.execute([&finished]() { finished.count_down(); });
+    }
+    finished.wait();
+    const double elapsed = nanoseconds(Clock::now() - start).count() / tasks;
+
+    done = true;
+    if (poller.joinable()) {
+        poller.join();
+    }
+    return elapsed;
+}
+
+// NOTE: the time from the end of a task to the return of the waiter
+double wake_latency(QueuedThreadPool& pool, bool polling, bool& ok)
+{
+    time_point ended;
+    pool.execute([&ended]() {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+        ended = Clock::now();
+    });
+
+    if (polling) {
+        do {
+            Thread::sleep(100); // ms
+        } while (!pool.is_idle());
+    } else {
+        ok = pool.wait_idle() && ok;
+    }
+    return milliseconds(Clock::now() - ended).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t tasks  = 100000;
+    size_t rounds = 5;
+    if (argc > 1) {
+        tasks = static_cast<size_t>(std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        rounds = static_cast<size_t>(std::atol(argv[2]));
+    }
+    bool ok = true;
+
+    QueuedThreadPool pool(2);
+    std::printf("tasks: %lu\n", static_cast<unsigned long>(tasks));
+    std::printf("%16s %12.1f ns per task\n", "without monitor",
+        run_tasks(pool, tasks, false));
+    std::printf("%16s %12.1f ns per task\n", "with monitor",
+        run_tasks(pool, tasks, true));
+    ok = ok && pool.wait_idle() && pool.completed_count() == 2 * tasks;
+
+    double polled = 0.0;
+    double waited = 0.0;
+    for (size_t i = 0; i < rounds; ++i) {
+        polled += wake_latency(pool, true, ok) / rounds;
+        waited += wake_latency(pool, false, ok) / rounds;
+    }
+    std::printf("\nwake up after the last task (mean of %lu):\n"
+                "%16s %12.3f ms\n%16s %12.3f ms\n",
+        static_cast<unsigned long>(rounds), "sleep(100) loop", polled,
+        "wait_idle()", waited);
+
+    // NOTE: a timeout while busy, a terminated pool is never idle
+    pool.execute([]() {
+        boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+    });
+    ok = ok && !pool.wait_idle(1) && pool.active_count() == 1;
+    ok = ok && pool.wait_idle(1000) && pool.active_count() == 0;
+    pool.terminate();
+    ok = ok && !pool.wait_idle() && !pool.is_idle();
+
+    return ok ? 0 : 1;
+}
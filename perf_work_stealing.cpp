@@ -0,0 +1,145 @@
+//
+// Scaling benchmark: AgentppCK::WorkStealingThreadPool vs QueuedThreadPool
+//
+// Two workloads are run for 1 up to N threads:
+//  - flat:    many tiny tasks executed from the main thread
+//  - fan-out: a binary tree of tasks, each task executes its children
+//             from within the pool (recursive parallelism)
+//
+// usage: perf_work_stealing [tasks] [max-threads]
+//
+
+#include "posix/threadpool.hpp"
+
+#include <boost/chrono/chrono.hpp>
+#include <boost/thread/latch.hpp>
+#include <boost/thread/thread_only.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace AgentppCK;
+
+namespace
+{
+
+typedef boost::chrono::steady_clock steady_clock;
+typedef boost::chrono::duration<double> seconds;
+
+inline void spin(unsigned iterations)
+{
+    volatile unsigned sink = 0;
+    for (unsigned i = 0; i < iterations; ++i) {
+        sink = sink + i;
+    }
+}
+
+class FlatTask : public Runnable {
+public:
+    explicit FlatTask(boost::latch& l)
+        : done(l)
+    { }
+
+    void run() BOOST_OVERRIDE
+    {
+        spin(200);
+        done.count_down();
+    }
+
+private:
+    boost::latch& done;
+};
+
+class TreeTask : public Runnable {
+public:
+    TreeTask(ThreadPool& tp, boost::latch& l, unsigned d)
+        : pool(tp)
+        , done(l)
+        , depth(d)
+    { }
+
+    void run() BOOST_OVERRIDE
+    {
+        if (depth > 0) {
+            pool.execute(new TreeTask(pool, done, depth - 1));
+            pool.execute(new TreeTask(pool, done, depth - 1));
+        }
+        spin(200);
+        done.count_down();
+    }
+
+private:
+    ThreadPool& pool;
+    boost::latch& done;
+    const unsigned depth;
+};
+
+template <class Pool> double flat(size_t threads, size_t tasks)
+{
+    boost::latch done(tasks);
+    Pool pool(threads);
+
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < tasks; ++i) {
+        pool.execute(new FlatTask(done));
+    }
+    done.wait();
+    seconds elapsed = steady_clock::now() - start;
+
+    pool.terminate();
+    return tasks / elapsed.count();
+}
+
+template <class Pool> double fan_out(size_t threads, unsigned depth)
+{
+    const size_t tasks = (size_t(2) << depth) - 1;
+    boost::latch done(tasks);
+    Pool pool(threads);
+
+    steady_clock::time_point start = steady_clock::now();
+    pool.execute(new TreeTask(pool, done, depth));
+    done.wait();
+    seconds elapsed = steady_clock::now() - start;
+
+    pool.terminate();
+    return tasks / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t tasks       = 100000;
+    size_t max_threads = boost::thread::hardware_concurrency();
+    if (argc > 1) {
+        tasks = static_cast<size_t>(std::atol(argv[1]));
+    }
+    if (argc > 2) {
+        max_threads = static_cast<size_t>(std::atol(argv[2]));
+    }
+    if (max_threads < 4) {
+        max_threads = 4;
+    }
+
+    unsigned depth = 0;
+    while ((size_t(4) << depth) <= tasks) {
+        ++depth;
+    }
+
+    std::printf("flat: %lu tasks, fan-out: %lu tasks\n",
+        static_cast<unsigned long>(tasks),
+        static_cast<unsigned long>((size_t(2) << depth) - 1));
+    std::printf("%8s %16s %16s %16s %16s\n", "threads", "queued flat/s",
+        "queued tree/s", "stealing flat/s", "stealing tree/s");
+
+    for (size_t n = 1; n <= max_threads; n *= 2) {
+        double qf = flat<QueuedThreadPool>(n, tasks);
+        double qt = fan_out<QueuedThreadPool>(n, depth);
+        double wf = flat<WorkStealingThreadPool>(n, tasks);
+        double wt = fan_out<WorkStealingThreadPool>(n, depth);
+        std::printf("%8lu %16.0f %16.0f %16.0f %16.0f\n",
+            static_cast<unsigned long>(n), qf, qt, wf, wt);
+    }
+
+    return 0;
+}
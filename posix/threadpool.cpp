@@ -25,19 +25,77 @@ unifdef -U_WIN32THREADS -UWIN32 -DPOSIX_THREADS -DAGENTPP_NAMESPACE -D_THREADS
 #include "posix/threadpool.hpp"
 
 #include <cerrno>
+#include <cstdio>  // fopen()
+#include <cstdlib> // strtol()
 #include <cstring> // memset()
 
+#include <sched.h> // sched_yield() sched_getcpu()
+
 #ifdef _WIN32
+#    include <malloc.h>  // _aligned_malloc()
 #    include <windows.h> // Sleep()
 #else
 #    include <sys/time.h> // gettimeofday()
 #endif
 
-#include <stdexcept> // std::runtime_error()
+#ifdef __linux__
+#    include <linux/mempolicy.h> // MPOL_PREFERRED
+#    include <sys/mman.h>        // mmap()
+#    include <sys/syscall.h>     // SYS_mbind
+#endif
+
+#include <algorithm> // std::find() std::sort()
+#include <new>       // placement new
+#include <stdexcept> // std::runtime_error() std::invalid_argument()
+
+// NOTE: pthread_mutex_clocklock() is available since glibc 2.30! CK
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#    if __GLIBC_PREREQ(2, 30)
+#        define AGENTPP_HAVE_MUTEX_CLOCKLOCK
+#    endif
+#endif
+
+// NOTE: the timed waits must not follow steps of the system time! CK
+#if !defined(__APPLE__) && defined(_POSIX_MONOTONIC_CLOCK)                  \
+    && _POSIX_MONOTONIC_CLOCK >= 0
+#    define AGENTPP_COND_CLOCK CLOCK_MONOTONIC
+#endif
 
 namespace AgentppCK
 {
 
+#ifndef _WIN32
+namespace
+{
+
+/// @return the absolute time timeout milliseconds from now on clock
+struct timespec deadline_on(clockid_t clock, unsigned long timeout)
+{
+    struct timespec ts = {};
+
+#    if defined(__APPLE__) || defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0
+    clock_gettime(clock, &ts);
+#    else
+#        warning "gettimeofday() used"
+    (void)clock; // NOTE: CLOCK_REALTIME only! CK
+    struct timeval tv = {};
+    gettimeofday(&tv, NULL);
+    ts.tv_sec  = tv.tv_sec;
+    ts.tv_nsec = tv.tv_usec * 1000L;
+#    endif
+
+    ts.tv_sec += (time_t)(timeout / 1000);
+    ts.tv_nsec += (long)(timeout % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+} // namespace
+#endif
+
 #ifndef NO_LOGGING
 static const char* loggerModuleName = "agent++.threads";
 #endif
@@ -61,7 +119,9 @@ int Synchronized::next_id = 0;
     } while (0)
 
 Synchronized::Synchronized()
-    : cond()
+    : waiters(0)
+    , draining(false)
+    , cond()
     , monitor()
 {
 #ifndef NO_LOGGING
@@ -83,8 +143,16 @@ Synchronized::Synchronized()
     ERR_CHK_WITH_EXCEPTIONS(pthread_mutex_init(&monitor, &attr));
     ERR_CHK_WITH_EXCEPTIONS(pthread_mutexattr_destroy(&attr));
 
+    pthread_condattr_t condattr;
+    ERR_CHK_WITH_EXCEPTIONS(pthread_condattr_init(&condattr));
+#ifdef AGENTPP_COND_CLOCK
+    ERR_CHK_WITH_EXCEPTIONS(
+        pthread_condattr_setclock(&condattr, AGENTPP_COND_CLOCK));
+#endif
+
     memset(&cond, 0, sizeof(cond));
-    ERR_CHK_WITH_EXCEPTIONS(pthread_cond_init(&cond, NULL));
+    ERR_CHK_WITH_EXCEPTIONS(pthread_cond_init(&cond, &condattr));
+    ERR_CHK_WITH_EXCEPTIONS(pthread_condattr_destroy(&condattr));
 }
 
 Synchronized::~Synchronized()
@@ -93,41 +161,41 @@ Synchronized::~Synchronized()
     int errors = 0;
 
 #ifdef NO_FAST_MUTEXES
-    do {
-        // first try to get the lock
-        error = pthread_mutex_trylock(&monitor);
-        if (!error) {
-            (void)pthread_mutex_unlock(&monitor);
-            // if another thread waits for signal with mutex, let's wait.
-
+    // NOTE: each waiter must have returned from wait() before the monitor
+    // is destroyed. It takes the monitor again, so we wait until it passed
+    // the lock instead of polling with sleeps! CK
+    error = pthread_mutex_trylock(&monitor);
+    if (error == EBUSY && pthread_mutex_unlock(&monitor) == 0) {
+        // in case this thread hold the lock:
+        error = pthread_mutex_lock(&monitor);
+    }
 #    if defined(_POSIX_TIMEOUTS) && _POSIX_TIMEOUTS > 0
-            if (lock(10)) // NOTE: but not forever! CK
-#    else
-            error = pthread_mutex_trylock(&monitor);
-            if (!error)
+    if (error == EBUSY && lock(AGENTPP_SYNCHRONIZED_DESTROY_TIMEOUT)) {
+        // NOTE: the other thread has released the lock in time
+        error = 0;
+    }
 #    endif
-            {
-                (void)pthread_mutex_unlock(&monitor);
-                error = pthread_mutex_destroy(&monitor);
-                if (error) {
-                    ++errors;
-                    Thread::sleep(errors * 2);
-                }
-            }
-        } else {
-            // in case this thread hold the lock:
-            error = pthread_mutex_unlock(&monitor);
-            if (error != EPERM) {
-                break;
-            }
-            notify_all();
-            ++errors;
-            Thread::sleep(errors * 2);
+
+    if (!error) {
+        // NOTE: the last waiter wakes us, see left_wait()! CK
+        draining = true;
+        if (waiters > 0) {
+            (void)pthread_cond_broadcast(&cond);
         }
-        if (errors > AGENTPP_SYNCHRONIZED_UNLOCK_RETRIES) {
-            break;
+        while (waiters > 0) {
+            (void)pthread_cond_wait(&cond, &monitor);
         }
-    } while (EBUSY == error);
+        (void)pthread_mutex_unlock(&monitor);
+        error = pthread_mutex_destroy(&monitor);
+    } else {
+        ++errors;
+        LOG_BEGIN(loggerModuleName, ERROR_LOG | 2);
+        LOG("Synchronized still locked by another thread (error)(ptr)");
+        LOG(strerror(error));
+        LOG((void*)this);
+        LOG_END;
+        error = 0; // NOTE: the mutex is not destroyed! CK
+    }
 #else
     error              = pthread_mutex_destroy(&monitor);
 #endif
@@ -166,17 +234,28 @@ void Synchronized::wait()
     // NOTE: not implemented! wait(INFINITE);
 #endif
 
+    ++waiters;
     int err = pthread_cond_wait(&cond, &monitor); // NOTE: FOREVER! CK
+    left_wait();
     if (err == EINVAL) {
         throw std::runtime_error(
             "pthread_cond_wait: The cond or the mutex is invalid!");
     }
 }
 
+void Synchronized::left_wait()
+{
+    if (!--waiters && draining) {
+        (void)pthread_cond_broadcast(&cond); // NOTE: wakes the destructor
+    }
+}
+
 #ifndef _WIN32
 int Synchronized::cond_timed_wait(const struct timespec& ts)
 {
+    ++waiters;
     int error = pthread_cond_timedwait(&cond, &monitor, &ts);
+    left_wait();
     if (error == EINVAL) {
         throw std::runtime_error("pthread_cond_timedwait: The cond or the "
                                  "mutex ot the timespec is invalid!");
@@ -185,37 +264,21 @@ int Synchronized::cond_timed_wait(const struct timespec& ts)
 }
 #endif
 
-bool Synchronized::wait(long timeout)
+#ifndef _WIN32
+struct timespec Synchronized::deadline(unsigned long timeout)
 {
-    bool timeoutOccurred = false;
-
-#if defined(_WIN32)
-    throw std::runtime_error("not implemented function called!");
-    return timeoutOccurred;
-#else
-    struct timespec ts = {};
-
-#    if defined(__APPLE__) || defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0
-    clock_gettime(CLOCK_REALTIME, &ts);
-    ts.tv_sec += (time_t)timeout / 1000;
-    long millis = ts.tv_nsec / 1000000 + (timeout % 1000);
-    if (millis >= 1000) {
-        ts.tv_sec += 1;
-    }
-    ts.tv_nsec = (millis % 1000) * 1000000;
+#    ifdef AGENTPP_COND_CLOCK
+    return deadline_on(AGENTPP_COND_CLOCK, timeout);
 #    else
-#        warning "gettimeofday() used"
-    struct timeval tv = {};
-    gettimeofday(&tv, NULL);
-    ts.tv_sec   = tv.tv_sec + (time_t)timeout / 1000;
-    long millis = tv.tv_usec / 1000 + (timeout % 1000);
-    if (millis >= 1000) {
-        ts.tv_sec += 1;
-    }
-    ts.tv_nsec              = (millis % 1000) * 1000000;
+    return deadline_on(CLOCK_REALTIME, timeout);
 #    endif
+}
 
-    int err = cond_timed_wait(ts);
+bool Synchronized::wait_until(const struct timespec& abstime)
+{
+    bool timeoutOccurred = false;
+
+    int err = cond_timed_wait(abstime);
     if (err) {
         switch (err) {
         case EINVAL:
@@ -235,10 +298,20 @@ bool Synchronized::wait(long timeout)
             break;
         }
     }
-#endif // !defined(_WIN32)
 
     return timeoutOccurred;
 }
+#endif
+
+bool Synchronized::wait(long timeout)
+{
+#if defined(_WIN32)
+    throw std::runtime_error("not implemented function called!");
+    return false;
+#else
+    return wait_until(deadline(timeout < 0 ? 0 : timeout));
+#endif // !defined(_WIN32)
+}
 
 void Synchronized::notify()
 {
@@ -294,28 +367,14 @@ bool Synchronized::lock()
 #if defined(_POSIX_TIMEOUTS) && _POSIX_TIMEOUTS > 0
 bool Synchronized::lock(unsigned long timeout)
 {
-    struct timespec ts = {};
-
-#    if defined(__APPLE__) || defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0
-    clock_gettime(CLOCK_REALTIME, &ts);
-    ts.tv_sec += (time_t)timeout / 1000;
-    long millis = ts.tv_nsec / 1000000 + (timeout % 1000);
-    if (millis >= 1000) {
-        ts.tv_sec += 1;
-    }
-    ts.tv_nsec = (millis % 1000) * 1000000;
+#    ifdef AGENTPP_HAVE_MUTEX_CLOCKLOCK
+    // NOTE: a step of the system time must not stall or fail the lock! CK
+    const struct timespec ts = deadline_on(CLOCK_MONOTONIC, timeout);
+    int error = pthread_mutex_clocklock(&monitor, CLOCK_MONOTONIC, &ts);
 #    else
-    struct timeval tv = {};
-    gettimeofday(&tv, 0);
-    ts.tv_sec = tv.tv_sec + (time_t)timeout / 1000;
-    long millis = tv.tv_usec / 1000 + (timeout % 1000);
-    if (millis >= 1000) {
-        ts.tv_sec += 1;
-    }
-    ts.tv_nsec = (millis % 1000) * 1000000;
+    const struct timespec ts = deadline_on(CLOCK_REALTIME, timeout);
+    int error                = pthread_mutex_timedlock(&monitor, &ts);
 #    endif
-
-    int error = pthread_mutex_timedlock(&monitor, &ts);
     if (!error) {
         // no logging because otherwise deep (virtual endless) recursion
         return true;
@@ -491,6 +550,21 @@ void Thread::start()
 #endif
 
         pthread_attr_setstacksize(&attr, stackSize);
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+        if (!affinity.empty()) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            for (size_t i = 0; i < affinity.size(); i++) {
+                if (affinity[i] >= 0 && affinity[i] < CPU_SETSIZE) {
+                    CPU_SET(affinity[i], &cpus);
+                }
+            }
+            // NOTE: the new thread touches its stack on these CPUs! CK
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+#endif
+
         int err = pthread_create(&tid, &attr, thread_starter, this);
         if (err) {
             LOG_BEGIN(loggerModuleName, ERROR_LOG | 1);
@@ -577,343 +651,2150 @@ void Thread::nsleep(time_t secs, long nanos)
 #endif
 }
 
-/*--------------------- class TaskManager --------------------------*/
+/*--------------------- class CpuTopology --------------------------*/
 
-TaskManager::TaskManager(ThreadPool* tp, size_t stack_size)
-    : thread(*this)
+namespace
 {
-    threadPool = tp;
-    task       = NULL;
-    go         = true;
-    thread.set_stack_size(stack_size);
-    thread.start();
-    LOG_BEGIN(loggerModuleName, DEBUG_LOG | 1);
-    LOG("TaskManager: thread started");
-    LOG_END;
-}
 
-TaskManager::~TaskManager()
+/// @return the ids of a sysfs list like "0-3,8-11", empty on error
+std::vector<int> read_id_list(const char* path)
 {
-    {
-        Lock l(*this);
-        go = false;
-        notify();
+    std::vector<int> ids;
+    FILE* f = std::fopen(path, "r");
+    if (!f) {
+        return ids;
     }
 
-    thread.join();
-    LOG_BEGIN(loggerModuleName, DEBUG_LOG | 1);
-    LOG("TaskManager: thread stopped");
-    LOG_END;
-}
-
-void TaskManager::run()
-{
-    Lock l(*this);
-
-    while (go) {
-        if (task) {
-            try {
-                task->run(); // NOTE: executes the task
-            } catch (std::exception& ex) {
-                DTRACE("Exception: " << ex.what());
-            } catch (...) {
-                // OK; ignored CK
+    char line[4096] = {};
+    if (std::fgets(line, sizeof(line), f)) {
+        const char* p = line;
+        for (;;) {
+            char* end   = NULL;
+            const long first = std::strtol(p, &end, 10);
+            if (end == p) {
+                break;
             }
-            delete task;
-            task = NULL;
-            //==============================
-            threadPool->idle_notification();
-            //==============================
-        }
-
-        while (go && !task) {
-            wait(); // NOTE: until notify signal! CK
+            long last = first;
+            if (*end == '-') {
+                p    = end + 1;
+                last = std::strtol(p, &end, 10);
+            }
+            for (long id = first; id <= last; id++) {
+                ids.push_back(static_cast<int>(id));
+            }
+            if (*end != ',') {
+                break;
+            }
+            p = end + 1;
         }
     }
-
-    if (task) {
-        delete task;
-        task = NULL;
-        DTRACE("task deleted after stop()");
-    }
+    std::fclose(f);
+    return ids;
 }
 
-bool TaskManager::is_idle()
+/// @return the number in a sysfs file or def
+int read_id(const char* path, int def)
 {
-    Lock l(*this);
-    return (!task && thread.is_alive());
+    std::vector<int> ids = read_id_list(path);
+    return ids.empty() ? def : ids[0];
 }
 
-bool TaskManager::set_task(Runnable* t)
+bool by_placement(const CpuTopology::Cpu& a, const CpuTopology::Cpu& b)
 {
-    Lock l(*this);
-
-    if (!task) {
-        task = t;
-        notify();
-        LOG_BEGIN(loggerModuleName, DEBUG_LOG | 2);
-        LOG("TaskManager: after notify");
-        LOG_END;
-        return true;
+    if (a.node != b.node) {
+        return a.node < b.node;
     }
-
-    LOG_BEGIN(loggerModuleName, DEBUG_LOG | 2);
-    LOG("TaskManager: got already a task");
-    LOG_END;
-    return false;
+    if (a.package != b.package) {
+        return a.package < b.package;
+    }
+    if (a.core != b.core) {
+        return a.core < b.core;
+    }
+    return a.id < b.id;
 }
 
-/*--------------------- class ThreadPool --------------------------*/
-
-void ThreadPool::execute(Runnable* t)
+/// @return the CPUs ordered to spread threads over nodes, packages and cores
+std::vector<int> scatter_order(const CpuTopology& topology)
 {
-    Lock l(*this);
-
-    TaskManager* tm = NULL;
-    while (!tm) {
-        if (taskList.empty()) {
-            delete t;
-            return;
+    // NOTE: the first hardware thread of each core comes first! CK
+    std::vector<std::vector<CpuTopology::Cpu> > perNode;
+    for (size_t n = 0; n < topology.nodes().size(); n++) {
+        std::vector<CpuTopology::Cpu> cpus;
+        for (size_t c = 0; c < topology.cpus().size(); c++) {
+            if (topology.cpus()[c].node == topology.nodes()[n]) {
+                cpus.push_back(topology.cpus()[c]);
+            }
         }
-
-        for (std::vector<TaskManager*>::iterator cur = taskList.begin();
-             cur != taskList.end(); ++cur) {
-            tm = *cur;
-            if (tm->is_idle()) {
-                LOG_BEGIN(loggerModuleName, DEBUG_LOG | 1);
-                LOG("TaskManager: task manager found");
-                LOG_END;
-
-                if (tm->set_task(t)) {
-                    return; // done
+        std::sort(cpus.begin(), cpus.end(), by_placement);
+        std::vector<CpuTopology::Cpu> spread;
+        for (size_t sibling = 0; spread.size() < cpus.size(); sibling++) {
+            size_t rank = 0;
+            for (size_t c = 0; c < cpus.size(); c++) {
+                rank = (c > 0 && cpus[c].package == cpus[c - 1].package
+                           && cpus[c].core == cpus[c - 1].core)
+                    ? rank + 1
+                    : 0;
+                if (rank == sibling) {
+                    spread.push_back(cpus[c]);
                 }
             }
-            tm = NULL;
         }
+        perNode.push_back(spread);
+    }
 
-        if (!tm) {
-            wait(); // TODO: until idle_notification or with 1s timeout? CK
+    std::vector<int> order;
+    for (size_t k = 0; order.size() < topology.cpus().size(); k++) {
+        for (size_t n = 0; n < perNode.size(); n++) {
+            if (k < perNode[n].size()) {
+                order.push_back(perNode[n][k].id);
+            }
         }
     }
+    return order;
 }
 
-/// NOTE: should to be called with lock! CK
-void ThreadPool::idle_notification() { notify(); }
+} // namespace
 
-/// return true if NONE of the threads in the pool is currently executing any
-/// task.
-bool ThreadPool::is_idle()
+CpuTopology::CpuTopology(const char* root)
 {
-    Lock l(*this);
-
-    if (taskList.empty()) {
-        return false;
-    }
-
-    for (std::vector<TaskManager*>::iterator cur = taskList.begin();
-         cur != taskList.end(); ++cur) {
-        if (!(*cur)->is_idle()) {
-            return false;
+    char path[512];
+    std::snprintf(path, sizeof(path), "%s/cpu/online", root);
+    std::vector<int> online = read_id_list(path);
+    if (online.empty()) {
+        const long n = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long id = 0; id < (n > 0 ? n : 1); id++) {
+            online.push_back(static_cast<int>(id));
         }
     }
-    return true; // NOTE: all threads are idle
-}
-
-/// return true if ALL of the threads in the pool is currently executing any
-/// task.
-bool ThreadPool::is_busy()
-{
-#if 0
-    // NOTE: this not the same! CK return !ThreadPool::is_idle();
-#else
-    Lock l(*this);
 
-    if (taskList.empty()) {
-        return true;
+    for (size_t i = 0; i < online.size(); i++) {
+        Cpu cpu;
+        cpu.id   = online[i];
+        cpu.node = 0;
+        std::snprintf(path, sizeof(path),
+            "%s/cpu/cpu%d/topology/physical_package_id", root, cpu.id);
+        cpu.package = read_id(path, 0);
+        std::snprintf(
+            path, sizeof(path), "%s/cpu/cpu%d/topology/core_id", root, cpu.id);
+        cpu.core = read_id(path, cpu.id);
+        cpuList.push_back(cpu);
     }
 
-    for (std::vector<TaskManager*>::iterator cur = taskList.begin();
-         cur != taskList.end(); ++cur) {
-        if (!(*cur)->is_idle()) {
-            return true;
+    std::snprintf(path, sizeof(path), "%s/node/online", root);
+    const std::vector<int> nodes = read_id_list(path);
+    for (size_t n = 0; n < nodes.size(); n++) {
+        std::snprintf(
+            path, sizeof(path), "%s/node/node%d/cpulist", root, nodes[n]);
+        const std::vector<int> cpus = read_id_list(path);
+        for (size_t c = 0; c < cpus.size(); c++) {
+            for (size_t i = 0; i < cpuList.size(); i++) {
+                if (cpuList[i].id == cpus[c]) {
+                    cpuList[i].node = nodes[n];
+                }
+            }
         }
     }
-    return false; // NOTE: non of the threads are busy
-#endif
-}
 
-void ThreadPool::EmptyTaskList()
-{
-    for (size_t i = 0; i < taskList.size(); i++) {
-        delete taskList[i]; // implizit Thread::join()
+    for (size_t i = 0; i < cpuList.size(); i++) {
+        if (std::find(nodeList.begin(), nodeList.end(), cpuList[i].node)
+            == nodeList.end()) {
+            nodeList.push_back(cpuList[i].node);
+        }
     }
-    taskList.clear();
+    std::sort(nodeList.begin(), nodeList.end());
 }
 
-void ThreadPool::terminate()
+const CpuTopology& CpuTopology::instance()
 {
-    Lock l(*this);
-
-    for (std::vector<TaskManager*>::iterator cur = taskList.begin();
-         cur != taskList.end(); ++cur) {
-        (*cur)->stop();
-    }
-    EmptyTaskList();
-
-    notify(); // see execute()
+    static const CpuTopology topology; // NOTE: sysfs is read once! CK
+    return topology;
 }
 
-ThreadPool::ThreadPool(size_t size)
-    : stackSize(AGENTPP_DEFAULT_STACKSIZE)
+std::vector<int> CpuTopology::node_cpus(int node) const
 {
-    for (size_t i = 0; i < size; i++) {
-        taskList.push_back(new TaskManager(this));
+    std::vector<int> cpus;
+    for (size_t i = 0; i < cpuList.size(); i++) {
+        if (cpuList[i].node == node) {
+            cpus.push_back(cpuList[i].id);
+        }
     }
+    return cpus;
 }
 
-ThreadPool::ThreadPool(size_t size, size_t stack_size)
-    : stackSize(stack_size)
+int CpuTopology::node_of(int cpu) const
 {
-    for (size_t i = 0; i < size; i++) {
-        taskList.push_back(new TaskManager(this, stackSize));
+    for (size_t i = 0; i < cpuList.size(); i++) {
+        if (cpuList[i].id == cpu) {
+            return cpuList[i].node;
+        }
     }
+    return -1;
 }
 
-ThreadPool::~ThreadPool()
+int CpuTopology::current_node() const
 {
-    ThreadPool::terminate();
-
-    EmptyTaskList();
+#if defined(__linux__) && defined(_GNU_SOURCE)
+    return node_of(sched_getcpu());
+#else
+    return nodeList.empty() ? -1 : nodeList[0];
+#endif
 }
 
-/*--------------------- class QueuedThreadPool --------------------------*/
+/*----------------------- class Affinity ---------------------------*/
 
-QueuedThreadPool::QueuedThreadPool(size_t size)
-    : ThreadPool(size)
-    , thread(*this)
-    , go(true)
+Affinity Affinity::cpu_set(const std::vector<int>& cpus)
 {
-    thread.start();
+    Affinity a(CPU_SET);
+    a.cpus = cpus;
+    return a;
 }
 
-QueuedThreadPool::QueuedThreadPool(size_t size, size_t stack_size)
-    : ThreadPool(size, stack_size)
-    , thread(*this)
-    , go(true)
+Affinity Affinity::numa_node(int node)
 {
-    thread.start();
+    Affinity a(NUMA_NODE);
+    a.node = node;
+    return a;
 }
 
-void QueuedThreadPool::EmptyQueue()
+std::vector<int> Affinity::cpus_of(
+    size_t i, const CpuTopology& topology) const
 {
-    Lock l(thread);
-    while (!queue.empty()) {
-        Runnable* t = queue.front();
-        queue.pop();
-        if (t) {
-            delete t;
-            DTRACE("queue entry (task) deleted");
-        }
+    std::vector<int> result;
+    if (topology.cpus().empty()) {
+        return result;
     }
-}
 
-QueuedThreadPool::~QueuedThreadPool()
+    switch (policy) {
+    case COMPACT: {
+        std::vector<CpuTopology::Cpu> order(topology.cpus());
+        std::sort(order.begin(), order.end(), by_placement);
+        result.push_back(order[i % order.size()].id);
+        break;
+    }
+    case SCATTER: {
+        const std::vector<int> order = scatter_order(topology);
+        result.push_back(order[i % order.size()]);
+        break;
+    }
+    case CPU_SET: {
+        std::vector<int> online; // NOTE: an offline CPU is ignored! CK
+        for (size_t c = 0; c < cpus.size(); c++) {
+            if (topology.node_of(cpus[c]) >= 0) {
+                online.push_back(cpus[c]);
+            }
+        }
+        if (!online.empty()) {
+            result.push_back(online[i % online.size()]);
+        }
+        break;
+    }
+    case NUMA_NODE:
+        result = topology.node_cpus(node);
+        break;
+    default:
+        break;
+    }
+    return result;
+}
+
+/*--------------------- class TaskManager --------------------------*/
+
+TaskManager::TaskManager(ThreadPool* tp, size_t stack_size)
+    : thread(*this)
 {
-    terminate();
+    threadPool = tp;
+    taskQueue  = NULL;
+    slot       = NULL;
+    task       = NULL;
+    keepAlive  = 0;
+    go         = true;
+    thread.set_stack_size(stack_size);
+    thread.start();
+    LOG_BEGIN(loggerModuleName, DEBUG_LOG | 1);
+    LOG("TaskManager: thread started");
+    LOG_END;
+}
 
-    thread.join();
+TaskManager::TaskManager(ThreadPool* tp, TaskQueue* queue, size_t stack_size)
+    : thread(*this)
+{
+    threadPool = tp;
+    taskQueue  = queue;
+    slot       = NULL;
+    task       = NULL;
+    keepAlive  = 0;
+    go         = true;
+    thread.set_stack_size(stack_size);
+    thread.start();
+    LOG_BEGIN(loggerModuleName, DEBUG_LOG | 1);
+    LOG("TaskManager: thread started");
+    LOG_END;
+}
 
-    EmptyQueue();
+TaskManager::TaskManager(ThreadPool* tp, TaskQueue* queue, size_t stack_size,
+    unsigned long keep_alive)
+    : thread(*this)
+{
+    threadPool = tp;
+    taskQueue  = queue;
+    slot       = NULL;
+    task       = NULL;
+    keepAlive  = keep_alive;
+    go         = true;
+    thread.set_stack_size(stack_size);
+    thread.start();
+    LOG_BEGIN(loggerModuleName, DEBUG_LOG | 1);
+    LOG("TaskManager: thread started");
+    LOG_END;
+}
 
-    ThreadPool::terminate();
+TaskManager::TaskManager(ThreadPool* tp, WorkerSlot* s, size_t stack_size)
+    : thread(*this)
+{
+    threadPool = tp;
+    taskQueue  = NULL;
+    slot       = s;
+    task       = NULL;
+    keepAlive  = 0;
+    go         = true;
+    thread.set_stack_size(stack_size);
+    thread.start();
+    LOG_BEGIN(loggerModuleName, DEBUG_LOG | 1);
+    LOG("TaskManager: thread started");
+    LOG_END;
 }
 
-/// NOTE: asserted to be called with lock! CK
-bool QueuedThreadPool::assign(Runnable* t)
+TaskManager::TaskManager(ThreadPool* tp, WorkerSlot* s, size_t stack_size,
+    const std::vector<int>& cpus)
+    : thread(*this)
 {
-    TaskManager* tm = NULL;
-    for (std::vector<TaskManager*>::iterator cur = taskList.begin();
-         cur != taskList.end(); ++cur) {
-        tm = *cur;
-        if (tm->is_idle()) {
-            LOG_BEGIN(loggerModuleName, DEBUG_LOG | 1);
-            LOG("TaskManager: task manager found");
-            LOG_END;
+    threadPool = tp;
+    taskQueue  = NULL;
+    slot       = s;
+    task       = NULL;
+    keepAlive  = 0;
+    go         = true;
+    thread.set_stack_size(stack_size);
+    thread.set_affinity(cpus);
+    thread.start();
+    LOG_BEGIN(loggerModuleName, DEBUG_LOG | 1);
+    LOG("TaskManager: thread started");
+    LOG_END;
+}
+
+namespace
+{
+
+// NOTE: the block header fills a cache line in front of the object! CK
+struct BlockHeader {
+    size_t length; // NOTE: the mapped length or 0 if not mapped
+};
+
+void* allocate_block(size_t size, int node)
+{
+    const size_t header = AGENTPP_CACHE_LINE_SIZE;
+    char* p             = NULL;
+#ifdef __linux__
+    if (node >= 0 && node < 1024) {
+        const size_t page   = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t length = (header + size + page - 1) / page * page;
+        void* m             = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m != MAP_FAILED) {
+            // NOTE: the pages are placed on first touch, so before it! CK
+            unsigned long mask[1024 / (8 * sizeof(unsigned long))] = {};
+            mask[node / (8 * sizeof(unsigned long))] =
+                1UL << (node % (8 * sizeof(unsigned long)));
+            (void)syscall(SYS_mbind, m, length, MPOL_PREFERRED, mask,
+                1024UL, 0U); // NOTE: may fail without NUMA, ignored! CK
+            p = static_cast<char*>(m);
+            reinterpret_cast<BlockHeader*>(p)->length = length;
+            return p + header;
+        }
+    }
+#else
+    (void)node;
+#endif
+#ifdef _WIN32
+    p = static_cast<char*>(_aligned_malloc(header + size, header));
+#else
+    void* m = NULL;
+    if (posix_memalign(&m, header, header + size) == 0) {
+        p = static_cast<char*>(m);
+    }
+#endif
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    reinterpret_cast<BlockHeader*>(p)->length = 0;
+    return p + header;
+}
+
+void free_block(void* object)
+{
+    if (!object) {
+        return;
+    }
+    char* p = static_cast<char*>(object) - AGENTPP_CACHE_LINE_SIZE;
+#ifdef __linux__
+    const size_t length = reinterpret_cast<BlockHeader*>(p)->length;
+    if (length) {
+        (void)munmap(p, length);
+        return;
+    }
+#endif
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+} // namespace
+
+void* TaskManager::operator new(size_t size)
+{
+    return allocate_block(size, -1);
+}
+
+void* TaskManager::operator new(size_t size, int node)
+{
+    return allocate_block(size, node);
+}
+
+void TaskManager::operator delete(void* p) { free_block(p); }
+
+void TaskManager::operator delete(void* p, int /*node*/) { free_block(p); }
+
+TaskManager::~TaskManager()
+{
+    {
+        Lock l(*this);
+        go = false;
+        notify();
+    }
+
+    thread.join();
+    LOG_BEGIN(loggerModuleName, DEBUG_LOG | 1);
+    LOG("TaskManager: thread stopped");
+    LOG_END;
+}
+
+void TaskManager::run()
+{
+    if (taskQueue) {
+        run_queue();
+        return;
+    }
+
+    Lock l(*this);
 
-            if (tm->set_task(t)) {
-                DTRACE("task manager found");
-                return true; // OK
+    while (go) {
+        if (task) {
+            try {
+                task->run(); // NOTE: executes the task
+            } catch (std::exception& ex) {
+                DTRACE("Exception: " << ex.what());
+            } catch (...) {
+                // OK; ignored CK
+            }
+            delete task;
+            task = NULL;
+            if (slot) {
+                slot->idle.store(true, boost::memory_order_release);
             }
+            // NOTE: without our lock, execute() locks us while holding
+            // the pool lock! CK
+            unlock();
+            //==============================
+            threadPool->idle_notification();
+            //==============================
+            lock();
+        }
+
+        while (go && !task) {
+            wait(); // NOTE: until notify signal! CK
         }
-        tm = NULL;
     }
 
-    return false;
+    if (task) {
+        delete task;
+        task = NULL;
+        DTRACE("task deleted after stop()");
+        unlock(); // NOTE: see above, the task is finished too! CK
+        threadPool->idle_notification();
+        lock();
+    }
 }
 
-void QueuedThreadPool::execute(Runnable* t)
+/// NOTE: the queue is closed before this TaskManager is stopped! CK
+void TaskManager::run_queue()
 {
-    Lock l(thread);
+    while (go) {
+        Runnable* t = keepAlive ? taskQueue->pop(keepAlive) : taskQueue->pop();
+        if (!t) {
+            // NOTE: closed, or idle for keepAlive ms! CK
+            if (taskQueue->is_closed() || threadPool->idle_timeout(this)) {
+                break;
+            }
+            continue;
+        }
+
+        {
+            Lock l(*this);
+            task = t;
+        }
+
+        try {
+            t->run(); // NOTE: executes the task
+        } catch (std::exception& ex) {
+            DTRACE("Exception: " << ex.what());
+        } catch (...) {
+            // OK; ignored CK
+        }
 
-    if (is_stopped()) {
+        {
+            Lock l(*this);
+            task = NULL;
+        }
         delete t;
+        taskQueue->done();
+    }
+}
+
+bool TaskManager::is_idle()
+{
+    Lock l(*this);
+    return (!task && thread.is_alive());
+}
+
+bool TaskManager::set_task(Runnable* t)
+{
+    Lock l(*this);
+
+    if (!task) {
+        task = t;
+        notify();
+        LOG_BEGIN(loggerModuleName, DEBUG_LOG | 2);
+        LOG("TaskManager: after notify");
+        LOG_END;
+        return true;
+    }
+
+    LOG_BEGIN(loggerModuleName, DEBUG_LOG | 2);
+    LOG("TaskManager: got already a task");
+    LOG_END;
+    return false;
+}
+
+/*--------------------- class ThreadPool --------------------------*/
+
+void ThreadPool::execute(Runnable* t)
+{
+    Lock l(*this);
+
+    if (!accepting) {
+        delete t; // NOTE: after shutdown()! CK
         return;
     }
 
-    queue.push(t);
-    thread.notify();
+    ++active; // NOTE: until idle_notification()! CK
+    for (;;) {
+        if ((taskList.empty() && !maxSize) || dropping) {
+            delete t;
+            finished(1);
+            return;
+        }
+
+        // NOTE: the first pass prefers a thread on the caller's node! CK
+        const int node =
+            preferLocal ? CpuTopology::instance().current_node() : -1;
+        for (int pass = (node < 0) ? 1 : 0; pass < 2; ++pass) {
+            // NOTE: only the slots are read, no TaskManager is locked! CK
+            for (size_t i = 0; i < taskList.size(); ++i) {
+                if (pass == 0 && slotNode[i] != node) {
+                    continue;
+                }
+                if (slots[i].idle.load(boost::memory_order_acquire)) {
+                    LOG_BEGIN(loggerModuleName, DEBUG_LOG | 1);
+                    LOG("TaskManager: task manager found");
+                    LOG_END;
+
+                    slots[i].idle.store(false, boost::memory_order_relaxed);
+                    if (taskList[i]->set_task(t)) {
+                        return; // done
+                    }
+                }
+            }
+        }
+
+        if (taskList.size() < maxSize) {
+            (void)add_task_manager()->set_task(t);
+            return; // NOTE: a LAZY pool has grown! CK
+        }
+
+        wait(); // NOTE: until idle_notification! CK
+    }
 }
 
-void QueuedThreadPool::run()
+void ThreadPool::execute_bulk(Runnable** tasks, size_t n)
 {
-    Lock l(thread);
+    Lock l(*this);
 
-    do {
-        while (go && !queue.empty()) {
-            LOG_BEGIN(loggerModuleName, DEBUG_LOG | 1);
-            LOG("queue.front");
-            LOG_END;
-            Runnable* t = queue.front();
-            while (go && t) {
-                if (assign(t)) {
-                    queue.pop(); // OK, now we pop this entry
-                    break;
+    if (!accepting) {
+        for (size_t i = 0; i < n; i++) {
+            delete tasks[i]; // NOTE: after shutdown()! CK
+        }
+        return;
+    }
+
+    active += n; // NOTE: until idle_notification()! CK
+    size_t i = 0;
+    while (i < n) {
+        if ((taskList.empty() && !maxSize) || dropping) {
+            finished(n - i);
+            break;
+        }
+
+        // NOTE: one pass assigns a task to each idle task manager! CK
+        for (size_t k = 0; k < taskList.size() && i < n; ++k) {
+            if (slots[k].idle.load(boost::memory_order_acquire)) {
+                slots[k].idle.store(false, boost::memory_order_relaxed);
+                if (taskList[k]->set_task(tasks[i])) {
+                    i++;
                 }
-                thread.wait(); // NOTE: until idle_notification! CK
             }
         }
 
-        while (go && queue.empty()) {
-            thread.wait(); // NOTE: until idle_notification! CK
+        while (i < n && taskList.size() < maxSize) {
+            (void)add_task_manager()->set_task(tasks[i++]);
+        }
+
+        if (i < n) {
+            wait(); // NOTE: until idle_notification! CK
         }
-    } while (go);
+    }
+
+    for (; i < n; i++) {
+        delete tasks[i];
+    }
 }
 
-/// NOTE: should to be called with lock! CK
-void QueuedThreadPool::idle_notification() { thread.notify(); }
+/// NOTE: called with lock! CK
+void ThreadPool::finished(size_t n)
+{
+    active -= n;
+    if (!active && idleWaiters > 0) {
+        notify_all(); // see wait_idle_until()
+    }
+}
 
-bool QueuedThreadPool::is_idle()
+/// NOTE: with lock, a waiting execute() can not miss it! CK
+void ThreadPool::idle_notification()
 {
-    Lock l(thread);
-    bool result = thread.is_alive() && queue.empty() && ThreadPool::is_idle();
+    Lock l(*this);
+    active--;
+    if (idleWaiters > 0) {
+        notify_all(); // NOTE: notify() may wake an idle waiter only! CK
+    } else {
+        notify();
+    }
+}
 
-    return result;
+bool ThreadPool::wait_idle_until(const struct timespec* deadline)
+{
+    Lock l(*this);
+    ++idleWaiters;
+    while (active > 0) {
+        if (!deadline) {
+            wait(); // NOTE: until the last idle_notification! CK
+            continue;
+        }
+#ifndef _WIN32
+        if (wait_until(*deadline)) {
+            break;
+        }
+#endif
+    }
+    --idleWaiters;
+    return !active && (maxSize > 0 || !taskList.empty());
 }
 
-bool QueuedThreadPool::is_busy()
+void ThreadPool::stop_accepting(ShutdownMode mode)
 {
-    Lock l(thread);
-    bool result =
-        !thread.is_alive() || !(queue.empty() && ThreadPool::is_idle());
+    Lock l(*this);
+    accepting = false;
+    if (mode != DRAIN) {
+        dropping = true;
+        notify_all(); // NOTE: the blocked execute() calls drop! CK
+    }
+}
 
-    return result;
+void ThreadPool::cancel()
+{
+    Lock l(*this);
+    accepting = false;
+    dropping  = true;
+    for (size_t i = 0; i < taskList.size(); ++i) {
+        taskList[i]->stop(); // NOTE: no join, see terminate()! CK
+    }
+    notify_all();
 }
 
-void QueuedThreadPool::terminate()
+bool ThreadPool::shutdown_until(
+    ShutdownMode mode, const struct timespec* deadline)
 {
-    Lock l(thread);
-    go = false;
-    thread.notify();
+    stop_accepting(mode);
+
+#ifndef _WIN32
+    struct timespec now;
+    if (mode == CANCEL_NOW) {
+        now      = Synchronized::deadline(0);
+        deadline = &now; // NOTE: only look whether a task runs! CK
+    }
+#endif
+    if (!wait_idle_until(deadline)) {
+        cancel(); // NOTE: the queued tasks are deleted unrun! CK
+        return false;
+    }
+
+    terminate();
+    return true;
+}
+
+/// return true if NONE of the threads in the pool is currently executing any
+/// task.
+bool ThreadPool::is_idle()
+{
+    Lock l(*this);
+
+    if (taskList.empty()) {
+        return maxSize > 0; // NOTE: a LAZY pool before its first task
+    }
+
+    for (size_t i = 0; i < taskList.size(); ++i) {
+        if (!slots[i].idle.load(boost::memory_order_acquire)) {
+            return false;
+        }
+    }
+    return true; // NOTE: all threads are idle
+}
+
+/// return true if ALL of the threads in the pool is currently executing any
+/// task.
+bool ThreadPool::is_busy()
+{
+#if 0
+    // NOTE: this not the same! CK return !ThreadPool::is_idle();
+#else
+    Lock l(*this);
+
+    if (taskList.size() < maxSize) {
+        return false; // NOTE: a LAZY pool can start one more thread
+    }
+
+    if (taskList.empty()) {
+        return true;
+    }
+
+    for (size_t i = 0; i < taskList.size(); ++i) {
+        if (!slots[i].idle.load(boost::memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false; // NOTE: non of the threads are busy
+#endif
+}
+
+void ThreadPool::EmptyTaskList()
+{
+    for (size_t i = 0; i < taskList.size(); i++) {
+        delete taskList[i]; // implizit Thread::join()
+    }
+    taskList.clear();
+}
+
+void ThreadPool::terminate()
+{
+    std::vector<TaskManager*> stopped;
+    {
+        Lock l(*this);
+
+        for (std::vector<TaskManager*>::iterator cur = taskList.begin();
+             cur != taskList.end(); ++cur) {
+            (*cur)->stop();
+        }
+        stopped.swap(taskList);
+        maxSize = 0;
+
+        notify_all(); // see execute()
+    }
+
+    // NOTE: join without lock, the threads may call idle_notification()!
+    for (size_t i = 0; i < stopped.size(); i++) {
+        delete stopped[i]; // implizit Thread::join()
+    }
+}
+
+ThreadPool::ThreadPool(size_t size)
+    : stackSize(AGENTPP_DEFAULT_STACKSIZE)
+    , maxSize(size)
+    , slotMemory(NULL)
+    , slots(NULL)
+    , affinity()
+    , preferLocal(false)
+    , active(0)
+    , idleWaiters(0)
+    , accepting(true)
+    , dropping(false)
+{
+    start(size, EAGER);
+}
+
+ThreadPool::ThreadPool(size_t size, size_t stack_size)
+    : stackSize(stack_size)
+    , maxSize(size)
+    , slotMemory(NULL)
+    , slots(NULL)
+    , affinity()
+    , preferLocal(false)
+    , active(0)
+    , idleWaiters(0)
+    , accepting(true)
+    , dropping(false)
+{
+    start(size, EAGER);
+}
+
+ThreadPool::ThreadPool(size_t size, size_t stack_size, Startup startup)
+    : stackSize(stack_size)
+    , maxSize(size)
+    , slotMemory(NULL)
+    , slots(NULL)
+    , affinity()
+    , preferLocal(false)
+    , active(0)
+    , idleWaiters(0)
+    , accepting(true)
+    , dropping(false)
+{
+    start(size, startup);
+}
+
+ThreadPool::ThreadPool(
+    size_t size, size_t stack_size, Startup startup, const Affinity& a)
+    : stackSize(stack_size)
+    , maxSize(size)
+    , slotMemory(NULL)
+    , slots(NULL)
+    , affinity(a)
+    , preferLocal(false)
+    , active(0)
+    , idleWaiters(0)
+    , accepting(true)
+    , dropping(false)
+{
+    start(size, startup);
+}
+
+namespace
+{
+
+// NOTE: a starter thread pays off only for a larger number of threads! CK
+const size_t threads_per_starter = 16;
+
+struct TaskManagerStarter {
+    ThreadPool* pool;
+    WorkerSlot* slots;
+    TaskManager** managers;
+    const Affinity* affinity;
+    const int* nodes; // NOTE: the NUMA node of each slot or -1
+    size_t first, step, size, stackSize;
+    pthread_t tid;
+};
+
+void* start_task_managers(void* arg)
+{
+    TaskManagerStarter* s = static_cast<TaskManagerStarter*>(arg);
+    for (size_t i = s->first; i < s->size; i += s->step) {
+        s->managers[i] = new (s->nodes[i]) TaskManager(s->pool, &s->slots[i],
+            s->stackSize, s->affinity->cpus_of(i, CpuTopology::instance()));
+    }
+    return arg;
+}
+
+} // namespace
+
+void ThreadPool::start(size_t size, Startup startup)
+{
+    if (!size) {
+        return; // NOTE: the derived pools manage their threads! CK
+    }
+
+    // NOTE: new[] does not align to a cache line in C++98! CK
+    slotMemory = new char[(size + 1) * sizeof(WorkerSlot)];
+    const size_t offset =
+        reinterpret_cast<size_t>(slotMemory) % AGENTPP_CACHE_LINE_SIZE;
+    slots = reinterpret_cast<WorkerSlot*>(
+        slotMemory + (offset ? AGENTPP_CACHE_LINE_SIZE - offset : 0));
+    for (size_t i = 0; i < size; i++) {
+        new (&slots[i]) WorkerSlot();
+    }
+
+    // NOTE: a slot is on a node if all CPUs of its thread are there! CK
+    const CpuTopology& topology = CpuTopology::instance();
+    slotNode.resize(size, -1);
+    for (size_t i = 0; i < size; i++) {
+        const std::vector<int> cpus = affinity.cpus_of(i, topology);
+        for (size_t c = 0; c < cpus.size(); c++) {
+            const int node = topology.node_of(cpus[c]);
+            slotNode[i]    = (c == 0 || slotNode[i] == node) ? node : -1;
+        }
+        preferLocal = preferLocal || (slotNode[i] != slotNode[0]);
+    }
+
+    // NOTE: a LAZY pool must not reallocate while it grows! CK
+    taskList.reserve(size);
+    if (startup == LAZY) {
+        return;
+    }
+
+    size_t starters = 1;
+    if (startup == PARALLEL) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        starters        = (size + threads_per_starter - 1) / threads_per_starter;
+        if (cpus > 0 && starters > static_cast<size_t>(cpus)) {
+            starters = static_cast<size_t>(cpus);
+        }
+    }
+
+    taskList.resize(size, NULL);
+    std::vector<TaskManagerStarter> starter(starters);
+    for (size_t k = 0; k < starters; k++) {
+        starter[k].pool      = this;
+        starter[k].slots     = slots;
+        starter[k].managers  = &taskList[0];
+        starter[k].affinity  = &affinity;
+        starter[k].nodes     = &slotNode[0];
+        starter[k].first     = k;
+        starter[k].step      = starters;
+        starter[k].size      = size;
+        starter[k].stackSize = stackSize;
+    }
+
+    // NOTE: this thread is the first starter, failed ones are done here
+    std::vector<bool> started(starters, false);
+    for (size_t k = 1; k < starters; k++) {
+        started[k] = (pthread_create(&starter[k].tid, NULL,
+                          start_task_managers, &starter[k])
+            == 0);
+    }
+    for (size_t k = 0; k < starters; k++) {
+        if (!started[k]) {
+            (void)start_task_managers(&starter[k]);
+        }
+    }
+    for (size_t k = 1; k < starters; k++) {
+        if (started[k]) {
+            (void)pthread_join(starter[k].tid, NULL);
+        }
+    }
+}
+
+/// NOTE: called with lock, the slot of the new TaskManager is not idle! CK
+TaskManager* ThreadPool::add_task_manager()
+{
+    const size_t i = taskList.size();
+    slots[i].idle.store(false, boost::memory_order_relaxed);
+    taskList.push_back(new (slotNode[i]) TaskManager(this, &slots[i],
+        stackSize, affinity.cpus_of(i, CpuTopology::instance())));
+    return taskList.back();
+}
+
+ThreadPool::~ThreadPool()
+{
+    ThreadPool::terminate();
+
+    EmptyTaskList();
+
+    // NOTE: the slots are used until the TaskManagers are joined! CK
+    delete[] slotMemory;
+}
+
+/*-------------------- class MPMCRingBuffer ------------------------*/
+
+static size_t ring_capacity(size_t capacity)
+{
+    size_t n = 2;
+    while (n < capacity) {
+        n <<= 1;
+    }
+    return n;
+}
+
+MPMCRingBuffer::MPMCRingBuffer(size_t capacity)
+    : tail(0)
+    , head(0)
+    , buffer(NULL)
+    , mask(ring_capacity(capacity) - 1)
+{
+    buffer = new Cell[mask + 1];
+    for (size_t i = 0; i <= mask; i++) {
+        buffer[i].sequence.store(i, boost::memory_order_relaxed);
+        buffer[i].task = NULL;
+    }
+}
+
+MPMCRingBuffer::~MPMCRingBuffer() { delete[] buffer; }
+
+bool MPMCRingBuffer::push(Runnable* task)
+{
+    size_t pos = tail.load(boost::memory_order_relaxed);
+    for (;;) {
+        Cell& cell = buffer[pos & mask];
+        size_t seq = cell.sequence.load(boost::memory_order_acquire);
+        long diff  = (long)seq - (long)pos;
+        if (diff == 0) {
+            // NOTE: the cell is free in this lap, try to claim it! CK
+            if (tail.compare_exchange_weak(
+                    pos, pos + 1, boost::memory_order_relaxed)) {
+                cell.task = task;
+                cell.sequence.store(pos + 1, boost::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // full
+        } else {
+            pos = tail.load(boost::memory_order_relaxed);
+        }
+    }
+}
+
+Runnable* MPMCRingBuffer::pop()
+{
+    size_t pos = head.load(boost::memory_order_relaxed);
+    for (;;) {
+        Cell& cell = buffer[pos & mask];
+        size_t seq = cell.sequence.load(boost::memory_order_acquire);
+        long diff  = (long)seq - (long)(pos + 1);
+        if (diff == 0) {
+            // NOTE: the cell is filled in this lap, try to claim it! CK
+            if (head.compare_exchange_weak(
+                    pos, pos + 1, boost::memory_order_relaxed)) {
+                Runnable* task = cell.task;
+                cell.sequence.store(pos + mask + 1, boost::memory_order_release);
+                return task;
+            }
+        } else if (diff < 0) {
+            return NULL; // empty
+        } else {
+            pos = head.load(boost::memory_order_relaxed);
+        }
+    }
+}
+
+size_t MPMCRingBuffer::size() const
+{
+    size_t t = tail.load(boost::memory_order_relaxed);
+    size_t h = head.load(boost::memory_order_relaxed);
+    return (t > h) ? t - h : 0;
+}
+
+/*---------------------- class TaskQueue ---------------------------*/
+
+TaskQueue::TaskQueue(size_t capacity, OverflowPolicy p)
+    : ring(NULL)
+    , policy(p)
+    , pending(0)
+    , waiting(0)
+    , blocked(0)
+    , taken(0)
+    , idleWaiters(0)
+    , sealed(false)
+    , closed(false)
+{
+    if (capacity > 0) {
+        ring = new MPMCRingBuffer(capacity);
+    }
+}
+
+TaskQueue::~TaskQueue()
+{
+    clear();
+    delete ring;
+}
+
+bool TaskQueue::try_push(Runnable* t, int priority)
+{
+    if (ring) {
+        return ring->push(t);
+    }
+
+    Lock l(queueLock);
+    push_locked(t, priority);
+    return true;
+}
+
+Runnable* TaskQueue::try_pop()
+{
+    if (ring) {
+        return ring->pop();
+    }
+
+    Lock l(queueLock);
+    return pop_locked();
+}
+
+Runnable* TaskQueue::pop_locked()
+{
+    if (queue.empty()) {
+        return NULL;
+    }
+    Runnable* t = queue.front();
+    queue.pop();
+    return t;
+}
+
+bool TaskQueue::enqueue(Runnable* t, int priority)
+{
+    if (sealed) {
+        return false;
+    }
+
+    ++pending;
+    while (!try_push(t, priority)) {
+        if (policy == REJECT) {
+            release(1);
+            return false;
+        }
+
+        if (policy == RUN_IN_CALLER) {
+            try {
+                t->run(); // NOTE: executes the task in this thread! CK
+            } catch (std::exception& ex) {
+                DTRACE("Exception: " << ex.what());
+            } catch (...) {
+                // OK; ignored CK
+            }
+            delete t;
+            release(1); // NOTE: not before, a wait_for_idle() waits! CK
+            return true;
+        }
+
+        if (policy == DROP_OLDEST) {
+            Runnable* oldest = try_pop();
+            if (oldest) {
+                delete oldest;
+                release(1);
+                DTRACE("oldest queue entry (task) dropped");
+            }
+            continue;
+        }
+
+        // BLOCK: wait until a consumer made room
+        Lock l(notFull);
+        ++blocked;
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        bool pushed = false;
+        while (!sealed && !(pushed = try_push(t, priority))) {
+            notFull.wait(); // NOTE: until pop(), seal() or close()! CK
+        }
+        --blocked;
+        if (!pushed) {
+            release(1); // NOTE: the task is still owned by the caller
+            return false;
+        }
+        break;
+    }
+
+    wake(1);
+    return true;
+}
+
+size_t TaskQueue::push_bulk(Runnable** tasks, size_t n)
+{
+    size_t queued = 0;
+    if (ring) {
+        for (size_t i = 0; i < n; i++) {
+            if (push(tasks[i])) {
+                queued++;
+            } else {
+                delete tasks[i];
+            }
+        }
+        return queued;
+    }
+
+    {
+        Lock l(queueLock);
+        if (!sealed) {
+            pending += n;
+            for (; queued < n; queued++) {
+                push_locked(tasks[queued], 0);
+            }
+        }
+    }
+
+    for (size_t i = queued; i < n; i++) {
+        delete tasks[i]; // NOTE: already sealed! CK
+    }
+
+    wake(queued);
+    return queued;
+}
+
+void TaskQueue::wake(size_t n)
+{
+    // NOTE: pairs with the fence in pop(), no wakeup can be lost! CK
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    if (n > 0 && waiting > 0) {
+        Lock l(*this);
+        // NOTE: only one consumer is needed for one task! CK
+        for (size_t i = 0; i < n && i < waiting; i++) {
+            notify();
+        }
+    }
+}
+
+Runnable* TaskQueue::pop() { return pop_until(NULL); }
+
+Runnable* TaskQueue::pop(unsigned long timeout)
+{
+#ifndef _WIN32
+    const struct timespec deadline = Synchronized::deadline(timeout);
+    return pop_until(&deadline);
+#else
+    (void)timeout; // NOTE: PoolSizing rejects a keepAlive on _WIN32! CK
+    throw std::runtime_error("not implemented function called!");
+#endif
+}
+
+Runnable* TaskQueue::pop_until(const struct timespec* deadline)
+{
+    if (closed) {
+        return NULL;
+    }
+
+    Runnable* t = try_pop();
+    if (!t) {
+        Lock l(*this);
+        ++waiting;
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        while (!closed && (t = try_pop()) == NULL) {
+            if (!deadline) {
+                wait(); // NOTE: until push() or close()! CK
+                continue;
+            }
+#ifndef _WIN32
+            if (wait_until(*deadline)) {
+                t = try_pop(); // NOTE: the last chance after the timeout
+                break;
+            }
+#endif
+        }
+        --waiting;
+    }
+
+    if (!t) {
+        return NULL;
+    }
+    taken.fetch_add(1, boost::memory_order_relaxed);
+
+    if (ring) {
+        // NOTE: pairs with the fence in push(), see above! CK
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        if (blocked > 0) {
+            Lock l(notFull);
+            notFull.notify();
+        }
+    }
+    return t;
+}
+
+void TaskQueue::done() { release(1); }
+
+void TaskQueue::release(size_t n)
+{
+    // NOTE: pairs with the idleWaiters increment in wait_for_idle()! CK
+    if (pending.fetch_sub(n) == n && idleWaiters > 0) {
+        Lock l(drained);
+        drained.notify_all();
+    }
+}
+
+bool TaskQueue::wait_for_idle(const struct timespec* deadline)
+{
+    Lock l(drained);
+    ++idleWaiters;
+    while (pending > 0) {
+        if (!deadline) {
+            drained.wait(); // NOTE: until the last done() or clear()! CK
+            continue;
+        }
+#ifndef _WIN32
+        if (drained.wait_until(*deadline)) {
+            break;
+        }
+#endif
+    }
+    --idleWaiters;
+    return pending == 0;
+}
+
+void TaskQueue::seal()
+{
+    sealed = true;
+    Lock l(notFull);
+    notFull.notify_all();
+}
+
+void TaskQueue::close()
+{
+    sealed = true;
+    closed = true;
+    {
+        Lock l(*this);
+        notify_all();
+    }
+    Lock l(notFull);
+    notFull.notify_all();
+}
+
+void TaskQueue::clear()
+{
+    Runnable* t = NULL;
+    while ((t = try_pop()) != NULL) {
+        delete t;
+        release(1);
+        DTRACE("queue entry (task) deleted");
+    }
+}
+
+size_t TaskQueue::size()
+{
+    if (ring) {
+        return ring->size();
+    }
+
+    Lock l(queueLock);
+    return size_locked();
+}
+
+bool TaskQueue::is_idle() { return pending == 0; }
+
+/*------------------- class PriorityTaskQueue ----------------------*/
+
+namespace
+{
+
+/// @return the microseconds of a clock which does not follow the time
+boost::int64_t monotonic_us()
+{
+#ifndef _WIN32
+    struct timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<boost::int64_t>(now.tv_sec) * 1000000
+        + now.tv_nsec / 1000;
+#else
+    return static_cast<boost::int64_t>(GetTickCount64()) * 1000;
+#endif
+}
+
+} // namespace
+
+PriorityTaskQueue::PriorityTaskQueue(unsigned long a)
+    : TaskQueue(0, BLOCK)
+    , sequence(0)
+    , aging(a)
+{ }
+
+// NOTE: ~TaskQueue() can not reach the heap any more! CK
+PriorityTaskQueue::~PriorityTaskQueue() { clear(); }
+
+void PriorityTaskQueue::push_locked(Runnable* t, int priority)
+{
+    // NOTE: a task waiting since t0 has at time now the priority
+    //     priority + (now - t0) / aging,
+    // now is the same for all tasks, so the order of the rank
+    //     priority * aging - t0
+    // never changes while the tasks are queued! CK
+    Entry e;
+    e.rank = priority;
+    if (aging) {
+        e.rank = e.rank * static_cast<boost::int64_t>(aging) * 1000
+            - monotonic_us();
+    }
+    e.sequence = sequence++;
+    e.task     = t;
+    heap.push_back(e);
+    std::push_heap(heap.begin(), heap.end(), Before());
+}
+
+Runnable* PriorityTaskQueue::pop_locked()
+{
+    if (heap.empty()) {
+        return NULL;
+    }
+    std::pop_heap(heap.begin(), heap.end(), Before());
+    Runnable* t = heap.back().task;
+    heap.pop_back();
+    return t;
+}
+
+/*--------------------- class QueuedThreadPool --------------------------*/
+
+/**
+ * The Watchdog grows a QueuedThreadPool whose queue is not served for
+ * PoolSizing::maxWait milliseconds.
+ */
+class QueuedThreadPool::Watchdog : public Runnable {
+public:
+    explicit Watchdog(QueuedThreadPool& tp)
+        : pool(tp)
+        , thread(*this)
+    { }
+
+    ~Watchdog() BOOST_OVERRIDE { thread.join(); }
+
+    void start() { thread.start(); }
+
+    void run() BOOST_OVERRIDE { pool.watch(); }
+
+private:
+    QueuedThreadPool& pool;
+    Thread thread;
+};
+
+QueuedThreadPool::QueuedThreadPool(size_t size)
+    : ThreadPool(0)
+    , tasks(new TaskQueue())
+    , sizing(size)
+    , threads(0)
+    , peak(0)
+    , parked(false)
+    , watchdog(NULL)
+{
+    start_workers();
+}
+
+QueuedThreadPool::QueuedThreadPool(size_t size, size_t stack_size)
+    : ThreadPool(0, stack_size)
+    , tasks(new TaskQueue())
+    , sizing(size)
+    , threads(0)
+    , peak(0)
+    , parked(false)
+    , watchdog(NULL)
+{
+    start_workers();
+}
+
+QueuedThreadPool::QueuedThreadPool(size_t size, size_t stack_size,
+    size_t capacity, TaskQueue::OverflowPolicy policy)
+    : ThreadPool(0, stack_size)
+    , tasks(new TaskQueue(capacity, policy))
+    , sizing(size)
+    , threads(0)
+    , peak(0)
+    , parked(false)
+    , watchdog(NULL)
+{
+    start_workers();
+}
+
+QueuedThreadPool::QueuedThreadPool(const PoolSizing& s, size_t stack_size,
+    size_t capacity, TaskQueue::OverflowPolicy policy)
+    : ThreadPool(0, stack_size)
+    , tasks(new TaskQueue(capacity, policy))
+    , sizing(s)
+    , threads(0)
+    , peak(0)
+    , parked(false)
+    , watchdog(NULL)
+{
+    start_workers();
+}
+
+QueuedThreadPool::QueuedThreadPool(
+    const PoolSizing& s, size_t stack_size, TaskQueue* queue)
+    : ThreadPool(0, stack_size)
+    , tasks(queue)
+    , sizing(s)
+    , threads(0)
+    , peak(0)
+    , parked(false)
+    , watchdog(NULL)
+{
+    start_workers();
+}
+
+QueuedThreadPool::~QueuedThreadPool()
+{
+    terminate();
+    delete tasks;
+}
+
+void QueuedThreadPool::start_workers()
+{
+#ifdef _WIN32
+    if (sizing.maxThreads > sizing.minThreads
+        && (sizing.keepAlive || sizing.maxWait)) {
+        delete tasks; // NOTE: our destructor is not called! CK
+        tasks = NULL;
+        throw std::invalid_argument(
+            "PoolSizing: no keepAlive or maxWait without a timed wait");
+    }
+#endif
+
+    Lock l(*this);
+    for (size_t i = 0; i < sizing.minThreads; i++) {
+        add_worker();
+    }
+
+    if (sizing.maxWait && sizing.maxThreads > sizing.minThreads) {
+        watchdog = new Watchdog(*this);
+        watchdog->start();
+    }
+}
+
+/// NOTE: called with lock! CK
+void QueuedThreadPool::add_worker()
+{
+    // NOTE: the threads of a fixed size pool never time out! CK
+    const unsigned long keepAlive =
+        (sizing.maxThreads > sizing.minThreads) ? sizing.keepAlive : 0;
+    taskList.push_back(
+        new TaskManager(this, tasks, get_stack_size(), keepAlive));
+    threads = taskList.size();
+    if (threads > peak) {
+        peak = threads.load();
+    }
+}
+
+/// @return the number of queued tasks which no idle thread will take
+size_t QueuedThreadPool::backlog()
+{
+    const size_t queued = tasks->size();
+    const size_t idle   = tasks->waiting_consumers();
+    return (queued > idle) ? queued - idle : 0;
+}
+
+/// NOTE: called without lock after tasks are queued! CK
+void QueuedThreadPool::grow()
+{
+    if (threads >= sizing.maxThreads) {
+        return; // NOTE: the fast path of a fixed size pool
+    }
+
+    size_t waiting = backlog();
+    if (waiting > sizing.queueThreshold) {
+        std::vector<TaskManager*> reaped;
+        {
+            Lock l(*this);
+            waiting = backlog();
+            // NOTE: one new thread for each task above the threshold! CK
+            for (size_t i = sizing.queueThreshold; i < waiting
+                 && taskList.size() < sizing.maxThreads
+                 && !tasks->is_closed();
+                 i++) {
+                add_worker();
+            }
+            reaped.swap(retired);
+        }
+        for (size_t i = 0; i < reaped.size(); i++) {
+            delete reaped[i]; // implizit Thread::join()
+        }
+    } else if (waiting > 0 && parked) {
+        Lock l(*this);
+        notify_all(); // NOTE: the watchdog is needed now! CK
+    }
+}
+
+/// NOTE: grows the pool if no task is taken for maxWait ms! CK
+void QueuedThreadPool::watch()
+{
+    Lock l(*this);
+    while (!tasks->is_closed()) {
+        parked = true;
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        if (taskList.size() >= sizing.maxThreads || backlog() == 0) {
+            wait(); // NOTE: until grow(), idle_timeout() or terminate()
+            parked = false;
+            continue;
+        }
+        parked = false;
+
+        const size_t served = tasks->served();
+        (void)wait(static_cast<long>(sizing.maxWait));
+        if (!tasks->is_closed() && tasks->served() == served
+            && taskList.size() < sizing.maxThreads && backlog() > 0) {
+            add_worker();
+        }
+    }
+}
+
+void QueuedThreadPool::execute(Runnable* t)
+{
+    if (!tasks->push(t)) {
+        delete t; // NOTE: terminated or rejected! CK
+        return;
+    }
+    grow();
+}
+
+void QueuedThreadPool::execute_bulk(Runnable** bulk, size_t n)
+{
+    if (tasks->push_bulk(bulk, n) > 0) {
+        grow();
+    }
+}
+
+bool QueuedThreadPool::try_execute(Runnable* t)
+{
+    if (!tasks->push(t)) {
+        return false;
+    }
+    grow();
+    return true;
+}
+
+bool QueuedThreadPool::idle_timeout(TaskManager* tm)
+{
+    std::vector<TaskManager*> reaped;
+    {
+        Lock l(*this);
+        if (tasks->is_closed() || taskList.size() <= sizing.minThreads) {
+            return false;
+        }
+        std::vector<TaskManager*>::iterator it =
+            std::find(taskList.begin(), taskList.end(), tm);
+        if (it == taskList.end()) {
+            return false; // NOTE: terminate() has it already! CK
+        }
+        taskList.erase(it);
+        threads = taskList.size();
+
+        // NOTE: a thread cannot join itself, the next one deletes it! CK
+        reaped.swap(retired);
+        retired.push_back(tm);
+        notify_all(); // NOTE: the watchdog may grow again
+    }
+
+    for (size_t i = 0; i < reaped.size(); i++) {
+        delete reaped[i]; // implizit Thread::join()
+    }
+    return true;
+}
+
+bool QueuedThreadPool::is_idle()
+{
+    Lock l(*this);
+
+    if (!sizing.maxThreads || tasks->is_closed()) {
+        return false;
+    }
+    return tasks->is_idle();
+}
+
+bool QueuedThreadPool::is_busy()
+{
+    Lock l(*this);
+
+    if (!sizing.maxThreads || tasks->is_closed()) {
+        return true;
+    }
+    return taskList.size() >= sizing.maxThreads && !tasks->is_idle();
+}
+
+bool QueuedThreadPool::wait_idle_until(const struct timespec* deadline)
+{
+    if (!sizing.maxThreads) {
+        return false;
+    }
+    return tasks->wait_for_idle(deadline) && !tasks->is_closed();
+}
+
+void QueuedThreadPool::stop_accepting(ShutdownMode mode)
+{
+    tasks->seal(); // NOTE: the TaskManagers still take queued tasks! CK
+    if (mode != DRAIN) {
+        tasks->clear();
+    }
+}
+
+void QueuedThreadPool::cancel()
+{
+    tasks->close(); // NOTE: each TaskManager exits after its task! CK
+    tasks->clear();
+}
+
+void QueuedThreadPool::terminate()
+{
+    tasks->close(); // NOTE: wakes up all waiting TaskManagers! CK
+
+    ThreadPool::terminate(); // NOTE: wakes up the watchdog too! CK
+
+    std::vector<TaskManager*> reaped;
+    {
+        Lock l(*this);
+        reaped.swap(retired);
+        threads = 0;
+    }
+    for (size_t i = 0; i < reaped.size(); i++) {
+        delete reaped[i]; // implizit Thread::join()
+    }
+    delete watchdog; // implizit Thread::join()
+    watchdog = NULL;
+
+    tasks->clear();
+}
+
+/*----------------- class PriorityQueuedThreadPool -----------------*/
+
+PriorityQueuedThreadPool::PriorityQueuedThreadPool(
+    size_t size, unsigned long a)
+    : QueuedThreadPool(PoolSizing(size), AGENTPP_DEFAULT_STACKSIZE,
+          new PriorityTaskQueue(a))
+    , aging(a)
+{ }
+
+PriorityQueuedThreadPool::PriorityQueuedThreadPool(
+    const PoolSizing& sizing, unsigned long a, size_t stack_size)
+    : QueuedThreadPool(sizing, stack_size, new PriorityTaskQueue(a))
+    , aging(a)
+{ }
+
+void PriorityQueuedThreadPool::execute(Runnable* t, int priority)
+{
+    if (!static_cast<PriorityTaskQueue*>(task_queue())->push(t, priority)) {
+        delete t; // NOTE: terminated! CK
+        return;
+    }
+    grow();
+}
+
+/*------------------- class WorkStealingDeque ----------------------*/
+
+static long deque_capacity(size_t capacity)
+{
+    long n = 2;
+    while (n < (long)capacity) {
+        n <<= 1;
+    }
+    return n;
+}
+
+WorkStealingDeque::WorkStealingDeque(size_t capacity)
+    : top(0)
+    , bottom(0)
+    , buffer(NULL)
+    , mask(deque_capacity(capacity) - 1)
+{
+    buffer = new boost::atomic<Runnable*>[mask + 1];
+    for (long i = 0; i <= mask; i++) {
+        buffer[i].store(NULL, boost::memory_order_relaxed);
+    }
+}
+
+WorkStealingDeque::~WorkStealingDeque() { delete[] buffer; }
+
+bool WorkStealingDeque::push(Runnable* task)
+{
+    long b = bottom.load(boost::memory_order_relaxed);
+    long t = top.load(boost::memory_order_acquire);
+    if (b - t > mask) {
+        return false; // full
+    }
+
+    buffer[b & mask].store(task, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+    bottom.store(b + 1, boost::memory_order_relaxed);
+    return true;
+}
+
+Runnable* WorkStealingDeque::pop()
+{
+    long b = bottom.load(boost::memory_order_relaxed) - 1;
+    bottom.store(b, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    long t = top.load(boost::memory_order_relaxed);
+
+    if (t > b) {
+        bottom.store(b + 1, boost::memory_order_relaxed);
+        return NULL; // empty
+    }
+
+    Runnable* task = buffer[b & mask].load(boost::memory_order_relaxed);
+    if (t == b) {
+        // NOTE: the last one, race against steal()! CK
+        if (!top.compare_exchange_strong(t, t + 1,
+                boost::memory_order_seq_cst, boost::memory_order_relaxed)) {
+            task = NULL;
+        }
+        bottom.store(b + 1, boost::memory_order_relaxed);
+    }
+    return task;
+}
+
+Runnable* WorkStealingDeque::steal()
+{
+    long t = top.load(boost::memory_order_acquire);
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    long b = bottom.load(boost::memory_order_acquire);
+
+    if (t >= b) {
+        return NULL; // empty
+    }
+
+    Runnable* task = buffer[t & mask].load(boost::memory_order_relaxed);
+    if (!top.compare_exchange_strong(t, t + 1, boost::memory_order_seq_cst,
+            boost::memory_order_relaxed)) {
+        return NULL; // lost the race
+    }
+    return task;
+}
+
+size_t WorkStealingDeque::size() const
+{
+    long b = bottom.load(boost::memory_order_relaxed);
+    long t = top.load(boost::memory_order_relaxed);
+    return (b > t) ? (size_t)(b - t) : 0;
+}
+
+/*----------------- class WorkStealingThreadPool -------------------*/
+
+static pthread_key_t current_worker_key;
+static pthread_once_t current_worker_once = PTHREAD_ONCE_INIT;
+
+static void create_current_worker_key()
+{
+    (void)pthread_key_create(&current_worker_key, NULL);
+}
+
+/**
+ * The Worker runs the task loop of one thread of a WorkStealingThreadPool.
+ * Besides its WorkStealingDeque it has an inbox for tasks executed from
+ * outside of the pool.
+ */
+class WorkStealingThreadPool::Worker : public Runnable {
+public:
+    Worker(WorkStealingThreadPool& tp, unsigned id, size_t stack_size)
+        : pool(tp)
+        , seed(id * 2654435761U + 1)
+        , thread(*this)
+    {
+        thread.set_stack_size(stack_size);
+    }
+
+    ~Worker() BOOST_OVERRIDE { thread.join(); }
+
+    void start() { thread.start(); }
+    void join() { thread.join(); }
+
+    void post(Runnable* task)
+    {
+        Lock l(inbox_lock);
+        inbox.push(task);
+    }
+
+    Runnable* take(bool wait_for_lock)
+    {
+        if (wait_for_lock) {
+            Lock l(inbox_lock);
+            return take_front();
+        }
+        if (inbox_lock.trylock() != Synchronized::LOCKED) {
+            return NULL;
+        }
+        Runnable* task = take_front();
+        inbox_lock.unlock();
+        return task;
+    }
+
+    unsigned random()
+    {
+        // NOTE: xorshift, good enough to choose a victim! CK
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    }
+
+    void run() BOOST_OVERRIDE;
+
+    void clear()
+    {
+        Runnable* task = NULL;
+        while ((task = deque.pop()) != NULL) {
+            delete task;
+        }
+        while ((task = take(true)) != NULL) {
+            delete task;
+        }
+    }
+
+    WorkStealingThreadPool& pool;
+    WorkStealingDeque deque;
+
+private:
+    Runnable* take_front()
+    {
+        if (inbox.empty()) {
+            return NULL;
+        }
+        Runnable* task = inbox.front();
+        inbox.pop();
+        return task;
+    }
+
+    unsigned seed;
+    Synchronized inbox_lock;
+    std::queue<Runnable*> inbox;
+    Thread thread;
+};
+
+void WorkStealingThreadPool::Worker::run()
+{
+    (void)pthread_setspecific(current_worker_key, this);
+
+    while (pool.go) {
+        Runnable* task = pool.next_task(this);
+        if (!task) {
+            pool.park();
+            continue;
+        }
+
+        ++pool.active;
+        --pool.pending;
+        if (!pool.dropping) {
+            try {
+                task->run(); // NOTE: executes the task
+            } catch (std::exception& ex) {
+                DTRACE("Exception: " << ex.what());
+            } catch (...) {
+                // OK; ignored CK
+            }
+        }
+        delete task;
+        --pool.active;
+
+        // NOTE: pairs with the increment in wait_idle_until()! CK
+        if (pool.idleWaiters > 0 && pool.pending == 0 && pool.active == 0) {
+            Lock l(pool);
+            pool.notify_all();
+        }
+    }
+
+    (void)pthread_setspecific(current_worker_key, NULL);
+}
+
+WorkStealingThreadPool::WorkStealingThreadPool(size_t size)
+    : ThreadPool(0)
+    , pending(0)
+    , active(0)
+    , sleepers(0)
+    , next_worker(0)
+    , idleWaiters(0)
+    , accepting(true)
+    , dropping(false)
+    , go(true)
+{
+    start(size);
+}
+
+WorkStealingThreadPool::WorkStealingThreadPool(
+    size_t size, size_t stack_size)
+    : ThreadPool(0, stack_size)
+    , pending(0)
+    , active(0)
+    , sleepers(0)
+    , next_worker(0)
+    , idleWaiters(0)
+    , accepting(true)
+    , dropping(false)
+    , go(true)
+{
+    start(size);
+}
+
+WorkStealingThreadPool::~WorkStealingThreadPool() { terminate(); }
+
+void WorkStealingThreadPool::start(size_t size)
+{
+    (void)pthread_once(&current_worker_once, create_current_worker_key);
+
+    for (size_t i = 0; i < size; i++) {
+        workers.push_back(new Worker(*this, (unsigned)i, get_stack_size()));
+    }
+    // NOTE: start only after all victims exist! CK
+    for (size_t i = 0; i < size; i++) {
+        workers[i]->start();
+    }
+}
+
+void WorkStealingThreadPool::execute(Runnable* t)
+{
+    if (!go || !accepting || workers.empty()) {
+        delete t;
+        return;
+    }
+
+    ++pending;
+
+    Worker* self = static_cast<Worker*>(pthread_getspecific(current_worker_key));
+    if (!self || &self->pool != this || !self->deque.push(t)) {
+        workers[next_worker++ % workers.size()]->post(t);
+    }
+
+    if (sleepers > 0) {
+        idle_notification();
+    }
+}
+
+void WorkStealingThreadPool::execute_bulk(Runnable** tasks, size_t n)
+{
+    if (!go || !accepting || workers.empty()) {
+        for (size_t i = 0; i < n; i++) {
+            delete tasks[i];
+        }
+        return;
+    }
+
+    pending += n;
+
+    Worker* self = static_cast<Worker*>(pthread_getspecific(current_worker_key));
+    for (size_t i = 0; i < n; i++) {
+        if (!self || &self->pool != this || !self->deque.push(tasks[i])) {
+            workers[next_worker++ % workers.size()]->post(tasks[i]);
+        }
+    }
+
+    if (sleepers > 0) {
+        Lock l(*this);
+        for (size_t i = 0; i < n && i < sleepers; i++) {
+            notify();
+        }
+    }
+}
+
+Runnable* WorkStealingThreadPool::next_task(Worker* self)
+{
+    Runnable* task = self->deque.pop();
+    if (task) {
+        return task;
+    }
+
+    task = self->take(true);
+    if (task) {
+        return task;
+    }
+
+    const size_t n = workers.size();
+    size_t victim  = self->random() % n;
+    for (size_t i = 0; i < n; i++, victim = (victim + 1) % n) {
+        Worker* w = workers[victim];
+        if (w == self) {
+            continue;
+        }
+        task = w->deque.steal();
+        if (!task) {
+            task = w->take(false);
+        }
+        if (task) {
+            DTRACE("task stolen");
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+void WorkStealingThreadPool::park()
+{
+    if (pending > 0) {
+        sched_yield(); // NOTE: the task is on its way, try again! CK
+        return;
+    }
+
+    Lock l(*this);
+    ++sleepers;
+    while (go && pending == 0) {
+        wait(); // NOTE: until idle_notification! CK
+    }
+    --sleepers;
+}
+
+/// NOTE: called without lock! CK
+void WorkStealingThreadPool::idle_notification()
+{
+    Lock l(*this);
+    notify();
+}
+
+bool WorkStealingThreadPool::is_idle()
+{
+    return go && !workers.empty() && pending == 0 && active == 0;
+}
+
+bool WorkStealingThreadPool::is_busy()
+{
+    // NOTE: queued tasks alone do not make the pool busy! CK
+    return !go || workers.empty() || active >= workers.size();
+}
+
+bool WorkStealingThreadPool::wait_idle_until(const struct timespec* deadline)
+{
+    Lock l(*this);
+    ++idleWaiters;
+    while (go && (pending > 0 || active > 0)) {
+        if (!deadline) {
+            wait(); // NOTE: until the last task is finished! CK
+            continue;
+        }
+#ifndef _WIN32
+        if (wait_until(*deadline)) {
+            break;
+        }
+#endif
+    }
+    --idleWaiters;
+    return is_idle();
+}
+
+void WorkStealingThreadPool::stop_accepting(ShutdownMode mode)
+{
+    accepting = false;
+    if (mode != DRAIN) {
+        dropping = true;
+    }
+}
+
+void WorkStealingThreadPool::cancel()
+{
+    Lock l(*this);
+    accepting = false;
+    dropping  = true;
+    go        = false; // NOTE: see terminate(), but without join! CK
+    notify_all();
+}
+
+void WorkStealingThreadPool::terminate()
+{
+    {
+        Lock l(*this);
+        go = false;
+        notify_all();
+    }
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->join();
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->clear(); // NOTE: queued tasks are deleted unrun! CK
+        delete workers[i];
+    }
+    workers.clear();
+    pending = 0;
 
     ThreadPool::terminate();
 }
@@ -55,12 +55,22 @@ unifdef -U_WIN32THREADS -UWIN32 -DPOSIX_THREADS -DAGENTPP_NAMESPACE -D_THREADS
 #include <queue>
 #include <vector>
 
+#include <boost/atomic.hpp>
 #include <boost/config.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/current_function.hpp>
 #include <boost/noncopyable.hpp>
 
-#define AGENTPP_SYNCHRONIZED_UNLOCK_RETRIES 10
+#define AGENTPP_SYNCHRONIZED_DESTROY_TIMEOUT 100 // ms
+#ifndef _WIN32
+#    define AGENTPP_KEEP_ALIVE_MS 60000UL
+#else
+#    define AGENTPP_KEEP_ALIVE_MS 0UL // NOTE: no timed wait, see PoolSizing
+#endif
+#define AGENTPP_PRIORITY_AGING_MS 100UL
 #define AGENTPP_DEFAULT_STACKSIZE 0x10000UL
+#define AGENTPP_CACHE_LINE_SIZE 64
+#define AGENTPP_WORK_STEALING_DEQUE_SIZE 1024
 #define AGENTPP_OPAQUE_PTHREAD_T void*
 #define AGENTX_DEFAULT_PRIORITY 32
 #define AGENTX_DEFAULT_THREAD_NAME "ThreadPool::Thread"
@@ -171,6 +181,30 @@ public:
      */
     bool wait(long timeout);
 
+#ifndef _WIN32
+    /**
+     * Causes current thread to wait until either another
+     * thread invokes the notify() method or the notifyAll()
+     * method for this object, or the deadline is reached.
+     * A caller which waits in a loop computes the deadline once.
+     *
+     * @param abstime
+     *    the absolute timeout, see deadline().
+     * @return
+     *    true if timeout occured, false otherwise.
+     */
+    bool wait_until(const struct timespec& abstime);
+
+    /**
+     * The absolute time on the clock of the timed waits (CLOCK_MONOTONIC
+     * if available) for wait_until().
+     *
+     * @param timeout
+     *    timeout in milliseconds from now.
+     */
+    static struct timespec deadline(unsigned long timeout);
+#endif
+
     /**
      * Wakes up a single thread that is waiting on this
      * object's monitor.
@@ -237,7 +271,10 @@ private:
 #ifndef _WIN32
     int cond_timed_wait(const timespec& ts);
 #endif
+    void left_wait();
 
+    unsigned waiters; // threads in wait(), guarded by the monitor
+    bool draining;    // the destructor waits on cond, guarded by the monitor
     pthread_cond_t cond;
     pthread_mutex_t monitor;
 };
@@ -407,6 +444,15 @@ public:
      */
     void set_stack_size(size_t s) { stackSize = s; }
 
+    /**
+     * Before calling the start method this method can be used
+     * to pin the thread to some CPUs (on Linux only).
+     *
+     * @param cpus
+     *    the ids of the CPUs the thread may run on, empty for any.
+     */
+    void set_affinity(const std::vector<int>& cpus) { affinity = cpus; }
+
     /**
      * Check whether thread is alive.
      *
@@ -425,6 +471,7 @@ private:
     ThreadStatus status;
     Runnable& runnable;
     size_t stackSize;
+    std::vector<int> affinity;
     pthread_t tid;
     static ThreadList threadList;
     static void nsleep(time_t secs, long nanos);
@@ -467,296 +514,1391 @@ private:
     std::list<Thread*> list;
 };
 
-class TaskManager;
-
 /**
- * The ThreadPool class provides a pool of threads that can be
- * used to perform an arbitrary number of tasks.
+ * The MPMCRingBuffer class implements a bounded lock-free queue of tasks
+ * for multiple producers and multiple consumers (see D. Vyukov, "Bounded
+ * MPMC queue", 1024cores.net).
  *
- * @author Frank Fock
- * @version 3.5.19
+ * Each cell carries a sequence number which tells the producers and
+ * consumers whether the cell is free or filled for the current lap.
  */
-class AGENTPP_DECL ThreadPool : public Synchronized {
-private:
-    size_t stackSize;
-    void EmptyTaskList();
-
-protected:
-    std::vector<TaskManager*> taskList;
-
+class AGENTPP_DECL MPMCRingBuffer : private boost::noncopyable {
 public:
     /**
-     * Create a ThreadPool with a given number of threads.
+     * Create a MPMCRingBuffer.
      *
-     * @param size
-     *    the number of threads started for performing tasks.
-     *    The default value is 4 threads.
+     * @param capacity
+     *    the maximal number of tasks, rounded up to a power of two.
      */
-    explicit ThreadPool(size_t size = 4);
+    explicit MPMCRingBuffer(size_t capacity);
+    ~MPMCRingBuffer();
 
     /**
-     * Create a ThreadPool with a given number of threads and
-     * stack size.
+     * Append a task (any thread).
      *
-     * @param size
-     *    the number of threads started for performing tasks.
-     *    The default value is 4 threads.
-     * @param stack_size
-     *    the stack size for each thread.
+     * @return
+     *    false if the ring buffer is full.
      */
-    ThreadPool(size_t size, size_t stack_size);
+    bool push(Runnable* task);
 
     /**
-     * Destructor will wait for termination of all threads.
+     * Remove the oldest task (any thread).
+     *
+     * @return
+     *    the task or NULL if the ring buffer is empty.
      */
-    virtual ~ThreadPool();
+    Runnable* pop();
 
     /**
-     * Execute a task. The task will be deleted after call of
-     * its run() method.
+     * Gets the approximate number of queued tasks.
      */
-    virtual void execute(Runnable* task);
+    size_t size() const;
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    struct Cell {
+        boost::atomic<size_t> sequence;
+        Runnable* task;
+    };
+
+    boost::atomic<size_t> tail;
+    char pad_tail[AGENTPP_CACHE_LINE_SIZE - sizeof(boost::atomic<size_t>)];
+    boost::atomic<size_t> head;
+    char pad_head[AGENTPP_CACHE_LINE_SIZE - sizeof(boost::atomic<size_t>)];
+    Cell* buffer;
+    const size_t mask;
+};
 
+/**
+ * The TaskQueue class implements a FIFO queue of tasks which is shared
+ * by any number of producers and consumers. The TaskManagers of a
+ * QueuedThreadPool take their tasks directly from it.
+ *
+ * Without a capacity the queue is unbounded. With a capacity the tasks
+ * are kept in a lock-free MPMCRingBuffer and the OverflowPolicy decides
+ * what happens to a task pushed to the full queue.
+ *
+ * A consumer is only woken up if there is one waiting for a task.
+ */
+class AGENTPP_DECL TaskQueue : public Synchronized {
+public:
     /**
-     * Check whether the ThreadPool is idle or not.
-     *
-     * @return
-     *    true if non of the threads in the pool is currently
-     *    executing any task.
+     * What to do with a task if the bounded queue is full.
      */
-    virtual bool is_idle();
+    enum OverflowPolicy {
+        BLOCK,         ///< wait until there is room in the queue
+        REJECT,        ///< do not queue the task, push() returns false
+        RUN_IN_CALLER, ///< run the task in the calling thread
+        DROP_OLDEST    ///< delete the oldest queued task to make room
+    };
 
     /**
-     * Check whether the ThreadPool is busy (i.e., all threads are
-     * running a task) or not.
+     * Create a TaskQueue.
      *
-     * @return
-     *    true if all of the threads in the pool is currently
-     *    executing any task.
+     * @param capacity
+     *    the maximal number of queued tasks, rounded up to a power of
+     *    two. 0 means unbounded.
+     * @param policy
+     *    the OverflowPolicy used if a bounded queue is full.
      */
-    virtual bool is_busy();
+    explicit TaskQueue(size_t capacity = 0, OverflowPolicy policy = BLOCK);
 
     /**
-     * Get the size of the thread pool.
-     * @return
-     *    the number of threads in the pool.
+     * Destructor deletes all still queued tasks.
      */
-    size_t size() const { return taskList.size(); }
+    virtual ~TaskQueue();
 
     /**
-     * Get the stack size.
+     * Append a task to the queue. If the bounded queue is full, the
+     * OverflowPolicy is applied.
      *
+     * @param task
+     *    a Runnable instance.
      * @return
-     *   the stack size of each thread in this thread pool.
+     *    false if the queue is closed or the task is rejected; the task
+     *    is not queued then and still owned by the caller.
      */
-    size_t get_stack_size() const { return stackSize; }
-    size_t stack_size() const { return stackSize; }
+    bool push(Runnable* task) { return enqueue(task, 0); }
 
     /**
-     * Notifies the thread pool about an idle thread
+     * Append a number of tasks to the queue. The unbounded queue is
+     * locked only once and at most min(n, waiting consumers) are woken
+     * up. For the bounded queue each task is pushed like with push().
+     *
+     * @param tasks
+     *    an array of n Runnable instances.
+     * @param n
+     *    the number of tasks.
+     * @return
+     *    the number of queued tasks. The tasks which are not queued are
+     *    deleted.
      */
-    virtual void idle_notification();
+    size_t push_bulk(Runnable** tasks, size_t n);
 
     /**
-     * Gracefully stops all running task managers after their current
-     * task execution. The ThreadPool cannot be used thereafter and should
-     * be destroyed. This call blocks until all threads are stopped.
+     * Take the next task from the queue. This will block until a task
+     * is available or the queue is closed. The task counts as active
+     * until done() is called.
+     *
+     * @return
+     *    the next task or NULL if the queue is closed.
      */
-    virtual void terminate();
-};
-
-/**
- * The QueuedThreadPool class provides a pool of threads that can be
- * used to perform an arbitrary number of tasks. If a task is added
- * and there is currently no idle thread available to perform the task,
- * then the task will be queued for later processing. Consequently,
- * the execute method never blocks (in contrast to ThreadPool).
- *
- * The QueuedThreadPool uses an extra Thread to process queued messages
- * asynchronously.
- *
- * @author Frank Fock
- * @version 3.5.18
- */
-class AGENTPP_DECL QueuedThreadPool : public ThreadPool, public Runnable {
-
-    Thread thread;
-
-    std::queue<Runnable*> queue;
-    volatile bool go;
+    Runnable* pop();
 
-public:
     /**
-     * Create a ThreadPool with a given number of threads.
+     * Take the next task from the queue like pop(), but wait at most
+     * timeout milliseconds for it.
      *
-     * @param size
-     *    the number of threads started for performing tasks.
-     *    The default value is 1 threads.
+     * @param timeout
+     *    the maximal time to wait in milliseconds.
+     * @return
+     *    the next task or NULL if the queue is closed or empty after
+     *    the timeout.
      */
-    explicit QueuedThreadPool(size_t size = 1);
+    Runnable* pop(unsigned long timeout);
 
     /**
-     * Create a ThreadPool with a given number of threads and
-     * stack size.
-     *
-     * @param size
-     *    the number of threads started for performing tasks.
-     *    The default value is 4 threads.
-     * @param stack_size
-     *    the stack size for each thread.
+     * Signals that a task returned by pop() has been finished.
      */
-    QueuedThreadPool(size_t size, size_t stack_size);
+    void done();
 
     /**
-     * Destructor will wait for termination of all threads.
+     * Refuse new tasks, the queued tasks are still taken by pop(). The
+     * producers blocked in push() are woken up, their tasks are not
+     * queued.
      */
-    ~QueuedThreadPool() BOOST_OVERRIDE;
+    void seal();
 
     /**
-     * Execute a task. The task will be deleted after call of
-     * its run() method.
+     * Close the queue and wake up all waiting consumers and producers.
      */
-    void execute(Runnable* task) BOOST_OVERRIDE;
+    void close();
+
+    /**
+     * Delete all queued tasks.
+     */
+    void clear();
 
     /**
-     * Gets the current number of queued tasks.
-     *
      * @return
-     *    the number of tasks that are currently queued.
+     *    the number of queued tasks.
      */
-    size_t queue_length()
-    {
-        Lock l(thread);
-        return queue.size();
-    }
+    size_t size();
 
     /**
-     * Check whether QueuedThreadPool is idle
-     *
      * @return
-     *    true if non of the threads in the pool are currently
-     *    executing a task and the queue is emtpy().
+     *    true if the queue is empty and no task taken by pop() is
+     *    still active.
      */
-    bool is_idle() BOOST_OVERRIDE;
+    bool is_idle();
 
     /**
-     * Check whether the ThreadPool is busy
+     * Wait until the queue is idle, see is_idle(). The caller is woken
+     * up by the done() or clear() which releases the last task.
      *
+     * @param deadline
+     *    the absolute timeout or NULL to wait without timeout.
      * @return
-     *    true if all of the threads in the pool are currently
-     *    executing a task and the queue is not empty.
+     *    true if the queue is idle, false after the timeout.
      */
-    bool is_busy() BOOST_OVERRIDE;
+    bool wait_for_idle(const struct timespec* deadline);
+
+    bool is_closed() { return closed.load(); }
+    bool is_sealed() { return sealed.load(); }
 
     /**
-     * Terminate the QueuedThreadPool.
-     *
-     * This call blocks until all threads are stopped.
+     * @return
+     *    the number of consumers blocked in pop().
      */
-    void terminate() BOOST_OVERRIDE;
+    size_t waiting_consumers() const { return waiting.load(); }
 
-private:
     /**
-     * Notifies the thread pool about an idle thread.
+     * @return
+     *    the number of tasks taken from the queue so far.
      */
-    void idle_notification() BOOST_OVERRIDE;
+    size_t served() const { return taken.load(boost::memory_order_relaxed); }
 
     /**
-     * Runs the queue processing loop.
+     * @return
+     *    the capacity of the queue or 0 if unbounded.
      */
-    void run() BOOST_OVERRIDE;
+    size_t capacity() const { return ring ? ring->capacity() : 0; }
+
+    OverflowPolicy overflow_policy() const { return policy; }
 
+protected:
     /**
-     * @note asserted to be called with lock! CK
-     **/
-    bool assign(Runnable* task);
+     * Append a task like push(), the priority is passed on to
+     * push_locked().
+     */
+    bool enqueue(Runnable* task, int priority);
 
     /**
-     * @note asserted to be called with lock! CK
-     **/
-    bool is_stopped() const { return !go; }
+     * The unbounded queue. These are called with the queue lock held,
+     * a derived queue may order its tasks differently.
+     */
+    virtual void push_locked(Runnable* task, int /*priority*/)
+    {
+        queue.push(task);
+    }
+    virtual Runnable* pop_locked();
+    virtual size_t size_locked() const { return queue.size(); }
 
-    void EmptyQueue();
+private:
+    bool try_push(Runnable* task, int priority);
+    Runnable* try_pop();
+    Runnable* pop_until(const struct timespec* deadline);
+    void wake(size_t n);
+    void release(size_t n);
+
+    std::queue<Runnable*> queue; // NOTE: only used if unbounded! CK
+    Synchronized queueLock;
+    MPMCRingBuffer* ring;
+    const OverflowPolicy policy;
+
+    Synchronized notFull;
+    Synchronized drained;
+    boost::atomic<size_t> pending;     // queued and active tasks
+    boost::atomic<size_t> waiting;     // consumers blocked in pop()
+    boost::atomic<size_t> blocked;     // producers blocked in push()
+    boost::atomic<size_t> taken;       // tasks returned by pop()
+    boost::atomic<size_t> idleWaiters; // threads in wait_for_idle()
+    boost::atomic<bool> sealed;        // NOTE: no push(), but pop()! CK
+    boost::atomic<bool> closed;
 };
 
 /**
- * The TaskManager class controls the execution of tasks on
- * a Thread of a ThreadPool.
+ * The PriorityTaskQueue is an unbounded TaskQueue which returns the task
+ * with the highest priority first, tasks of the same priority in FIFO
+ * order. A queued task gains one priority level each aging milliseconds,
+ * so a task of a low priority is not starved by a steady stream of
+ * tasks of a higher priority.
  *
- * @author Frank Fock
- * @version 3.5.19
+ * The tasks are kept in a binary heap of one array: push() and pop() are
+ * O(log n) and no memory is allocated per task.
  */
-class AGENTPP_DECL TaskManager : public Synchronized, public Runnable {
-    friend class ThreadPool;
-
+class AGENTPP_DECL PriorityTaskQueue : public TaskQueue {
 public:
     /**
-     * Create a TaskManager and insert the created thread
-     * into the given ThreadPool.
+     * Create a PriorityTaskQueue.
      *
-     * @param threadPool
-     *    a pointer to a ThreadPool instance.
-     * @param stack_size
-     *    the stack size for the managed thread.
+     * @param aging
+     *    the time in milliseconds after which a queued task has gained
+     *    one priority level, 0 disables the aging.
      */
-    explicit TaskManager(
-        ThreadPool* tp, size_t stack_size = AGENTPP_DEFAULT_STACKSIZE);
+    explicit PriorityTaskQueue(unsigned long aging = AGENTPP_PRIORITY_AGING_MS);
 
     /**
-     * Destructor will wait for thread to terminate.
+     * Destructor deletes all still queued tasks.
      */
-    ~TaskManager() BOOST_OVERRIDE;
+    ~PriorityTaskQueue() BOOST_OVERRIDE;
+
+    using TaskQueue::push;
 
     /**
-     * Check whether this thread is idle or not.
+     * Append a task to the queue.
      *
+     * @param task
+     *    a Runnable instance.
+     * @param priority
+     *    the priority of the task, the higher the earlier it is run.
      * @return
-     *   true if the thread managed by this TaskManager does
-     *   not currently execute any task; false otherwise.
+     *    false if the queue is closed; the task is not queued then and
+     *    still owned by the caller.
      */
-    bool is_idle();
+    bool push(Runnable* task, int priority) { return enqueue(task, priority); }
+
+    unsigned long get_aging() const { return aging; }
+
+protected:
+    void push_locked(Runnable* task, int priority) BOOST_OVERRIDE;
+    Runnable* pop_locked() BOOST_OVERRIDE;
+    size_t size_locked() const BOOST_OVERRIDE { return heap.size(); }
+
+private:
+    struct Entry {
+        boost::int64_t rank; // NOTE: the priority minus the aging
+        boost::uint64_t sequence;
+        Runnable* task;
+    };
+
+    /// the heap order: the greatest rank, then the oldest entry on top
+    struct Before {
+        bool operator()(const Entry& a, const Entry& b) const
+        {
+            return (a.rank != b.rank) ? a.rank < b.rank
+                                      : a.sequence > b.sequence;
+        }
+    };
+
+    std::vector<Entry> heap;
+    boost::uint64_t sequence;
+    const unsigned long aging;
+};
+
+class TaskManager;
+
+/**
+ * The CpuTopology describes the online CPUs of the host as found in
+ * sysfs: the NUMA node, the package (socket) and the core of each CPU.
+ * Without sysfs all CPUs of sysconf(_SC_NPROCESSORS_ONLN) are on node 0.
+ */
+class AGENTPP_DECL CpuTopology {
+public:
+    struct Cpu {
+        int id, node, package, core;
+    };
 
     /**
-     * Set the next task for execution. This will block until
-     * current task has finished execution.
+     * Read the topology.
      *
-     * @param task
-     *   a Runnable instance.
+     * @param root
+     *    the sysfs directory with the cpu and node subdirectories.
+     */
+    explicit CpuTopology(const char* root = "/sys/devices/system");
+
+    /**
      * @return
-     *   true if the task could be assigned successfully and
-     *   false if another thread has assigned a task concurrently.
-     *   In the latter case, the task has not been assigned!
+     *    the topology of this host, read once.
      */
-    bool set_task(Runnable* it);
+    static const CpuTopology& instance();
 
     /**
-     * Clone this TaskManager.
+     * @return
+     *    the online CPUs ordered by their id.
      */
-    TaskManager* clone()
-    {
-        return new TaskManager(
-            new ThreadPool(threadPool->size(), threadPool->get_stack_size()));
-    }
+    const std::vector<Cpu>& cpus() const { return cpuList; }
 
-private:
-    Thread thread;
-    ThreadPool* threadPool;
-    Runnable* task;
-    volatile bool go;
+    /**
+     * @return
+     *    the ids of the NUMA nodes with CPUs, in ascending order.
+     */
+    const std::vector<int>& nodes() const { return nodeList; }
 
     /**
-     * Start thread execution.
+     * @return
+     *    the ids of the online CPUs of a node.
      */
-    void start() { thread.start(); }
+    std::vector<int> node_cpus(int node) const;
+
     /**
-     * Stop thread execution after having finished current task.
+     * @return
+     *    the node of an online CPU or -1.
      */
-    void stop()
-    {
-        Lock l(*this);
-        go = false;
-    }
-    void run() BOOST_OVERRIDE;
+    int node_of(int cpu) const;
+
+    /**
+     * @return
+     *    the node of the CPU the calling thread runs on or -1.
+     */
+    int current_node() const;
+
+private:
+    std::vector<Cpu> cpuList;
+    std::vector<int> nodeList;
+};
+
+/**
+ * The Affinity of a ThreadPool places its threads on the CPUs of the
+ * host, see CpuTopology. The per thread state of a thread pinned to one
+ * node is allocated on this node, its stack is first touched there.
+ */
+struct AGENTPP_DECL Affinity {
+    enum Policy {
+        NONE,     ///< the threads may run on any CPU (the default)
+        COMPACT,  ///< thread i on the i-th CPU, one core after the other
+        SCATTER,  ///< thread i on the next node, package and core
+        CPU_SET,  ///< thread i on cpus[i % cpus.size()]
+        NUMA_NODE ///< all threads on any CPU of the node
+    };
+
+    explicit Affinity(Policy p = NONE)
+        : policy(p)
+        , node(0)
+    { }
+
+    /// @return the CPU_SET Affinity with the given CPUs
+    static Affinity cpu_set(const std::vector<int>& cpus);
+
+    /// @return the NUMA_NODE Affinity, e.g. for one pool per node
+    static Affinity numa_node(int node);
+
+    /**
+     * Get the CPUs a thread of a pool may run on.
+     *
+     * @param i
+     *    the index of the thread in its pool.
+     * @param topology
+     *    the CPUs of the host, CPUs which are not online are ignored.
+     * @return
+     *    the CPUs of the thread, empty if it may run on any CPU.
+     */
+    std::vector<int> cpus_of(size_t i, const CpuTopology& topology) const;
+
+    Policy policy;
+    std::vector<int> cpus; // NOTE: only used with CPU_SET
+    int node;              // NOTE: only used with NUMA_NODE
+};
+
+/**
+ * The WorkerSlot holds the state of a TaskManager which is read by the
+ * dispatcher of a ThreadPool. The slots of a pool are kept in one array,
+ * each slot fills a cache line of its own. So the dispatcher scans them
+ * without locking any TaskManager and a thread changing its state does
+ * not invalidate the cache line of its neighbour.
+ */
+struct AGENTPP_DECL WorkerSlot {
+    WorkerSlot()
+        : idle(true)
+    { }
+
+    boost::atomic<bool> idle; // set by the thread, reset by the dispatcher
+    char pad[AGENTPP_CACHE_LINE_SIZE - sizeof(boost::atomic<bool>)];
+};
+
+/**
+ * The PoolSizing of a QueuedThreadPool bounds its number of threads. The
+ * pool starts minThreads threads and grows up to maxThreads while there
+ * are queued tasks which no idle thread will take: more than
+ * queueThreshold of them, or any if no task has been taken from the
+ * queue for maxWait milliseconds. A thread above minThreads which has
+ * been idle for keepAlive milliseconds exits.
+ *
+ * Without a max (or with max == min) the pool has a fixed size.
+ *
+ * On _WIN32 there is no timed wait: the QueuedThreadPool throws
+ * std::invalid_argument if it could grow and keepAlive or maxWait is
+ * not 0. The threads of a grown pool are kept there.
+ */
+struct AGENTPP_DECL PoolSizing {
+    explicit PoolSizing(size_t min = 1, size_t max = 0,
+        unsigned long keep_alive = AGENTPP_KEEP_ALIVE_MS,
+        size_t queue_threshold = 0, unsigned long max_wait = 0)
+        : minThreads(min)
+        , maxThreads(max < min ? min : max)
+        , keepAlive(keep_alive)
+        , queueThreshold(queue_threshold)
+        , maxWait(max_wait)
+    { }
+
+    size_t minThreads;
+    size_t maxThreads;
+    unsigned long keepAlive; // ms, 0 means forever
+    size_t queueThreshold;   // queued tasks tolerated without growing
+    unsigned long maxWait;   // ms, 0 means not used
+};
+
+/**
+ * The ThreadPool class provides a pool of threads that can be
+ * used to perform an arbitrary number of tasks.
+ *
+ * @author Frank Fock
+ * @version 3.5.19
+ */
+class AGENTPP_DECL ThreadPool : public Synchronized {
+public:
+    /**
+     * How the threads of a ThreadPool are started.
+     */
+    enum Startup {
+        EAGER,    ///< all threads are started by the constructor
+        PARALLEL, ///< like EAGER, but by several threads at once
+        LAZY      ///< a thread is started by execute() if none is idle
+    };
+
+    /**
+     * What shutdown() does with the tasks which are not yet finished.
+     */
+    enum ShutdownMode {
+        DRAIN,       ///< run the queued tasks, then stop
+        DROP_QUEUED, ///< finish the running tasks, delete the queued ones
+        CANCEL_NOW   ///< delete the queued tasks, do not wait at all
+    };
+
+private:
+    size_t stackSize;
+    size_t maxSize; // NOTE: 0 after terminate(), no more threads! CK
+    char* slotMemory;
+    WorkerSlot* slots; // NOTE: slots[i] belongs to taskList[i]! CK
+    Affinity affinity;
+    std::vector<int> slotNode; // NOTE: the node of slots[i] or -1
+    bool preferLocal;          // NOTE: the threads are on several nodes
+    size_t active;      // tasks accepted by execute(), not yet finished
+    size_t idleWaiters; // threads in wait_for_idle()
+    bool accepting;     // NOTE: false after shutdown()
+    bool dropping;      // NOTE: execute() deletes its task, see shutdown()
+    void EmptyTaskList();
+    void start(size_t size, Startup startup);
+    TaskManager* add_task_manager();
+    void finished(size_t n);
+
+protected:
+    std::vector<TaskManager*> taskList;
+
+    /**
+     * Wait until the pool is idle, see wait_for_idle().
+     *
+     * @param deadline
+     *    the absolute timeout or NULL to wait without timeout.
+     */
+    virtual bool wait_idle_until(const struct timespec* deadline);
+
+    /**
+     * Refuse new tasks, see shutdown(). With DROP_QUEUED and CANCEL_NOW
+     * the tasks which wait for a thread are deleted.
+     */
+    virtual void stop_accepting(ShutdownMode mode);
+
+    /**
+     * Delete the tasks which wait for a thread and let each thread exit
+     * after its current task. The threads are joined by terminate().
+     */
+    virtual void cancel();
+
+public:
+    /**
+     * Create a ThreadPool with a given number of threads.
+     *
+     * @param size
+     *    the number of threads started for performing tasks.
+     *    The default value is 4 threads.
+     */
+    explicit ThreadPool(size_t size = 4);
+
+    /**
+     * Create a ThreadPool with a given number of threads and
+     * stack size.
+     *
+     * @param size
+     *    the number of threads started for performing tasks.
+     *    The default value is 4 threads.
+     * @param stack_size
+     *    the stack size for each thread.
+     */
+    ThreadPool(size_t size, size_t stack_size);
+
+    /**
+     * Create a ThreadPool with a given number of threads, stack size
+     * and startup mode.
+     *
+     * @param size
+     *    the maximal number of threads for performing tasks.
+     * @param stack_size
+     *    the stack size for each thread.
+     * @param startup
+     *    LAZY starts no thread before it is needed, PARALLEL starts
+     *    the threads of a large pool concurrently.
+     */
+    ThreadPool(size_t size, size_t stack_size, Startup startup);
+
+    /**
+     * Create a ThreadPool with a given number of threads, stack size,
+     * startup mode and placement of the threads.
+     *
+     * @param size
+     *    the maximal number of threads for performing tasks.
+     * @param stack_size
+     *    the stack size for each thread.
+     * @param startup
+     *    LAZY starts no thread before it is needed, PARALLEL starts
+     *    the threads of a large pool concurrently.
+     * @param affinity
+     *    the CPUs of the threads. If they are on several NUMA nodes,
+     *    execute() prefers an idle thread on the node of the caller.
+     */
+    ThreadPool(size_t size, size_t stack_size, Startup startup,
+        const Affinity& affinity);
+
+    /**
+     * Destructor will wait for termination of all threads.
+     */
+    virtual ~ThreadPool();
+
+    /**
+     * Execute a task. The task will be deleted after call of
+     * its run() method.
+     */
+    virtual void execute(Runnable* task);
+
+    /**
+     * Execute a number of tasks at once. The idle TaskManagers are
+     * searched with one lock acquisition for all tasks, so at most
+     * min(n, idle threads) threads are woken up. The call blocks until
+     * all tasks are assigned.
+     *
+     * @param tasks
+     *    an array of n Runnable instances, each is deleted after call
+     *    of its run() method.
+     * @param n
+     *    the number of tasks.
+     */
+    virtual void execute_bulk(Runnable** tasks, size_t n);
+
+    /**
+     * Check whether the ThreadPool is idle or not.
+     *
+     * @return
+     *    true if non of the threads in the pool is currently
+     *    executing any task.
+     */
+    virtual bool is_idle();
+
+    /**
+     * Check whether the ThreadPool is busy (i.e., all threads are
+     * running a task) or not.
+     *
+     * @return
+     *    true if all of the threads in the pool is currently
+     *    executing any task.
+     */
+    virtual bool is_busy();
+
+    /**
+     * Get the size of the thread pool.
+     * @return
+     *    the number of threads in the pool, of a LAZY pool only the
+     *    threads started so far.
+     */
+    virtual size_t size() const { return taskList.size(); }
+
+    /**
+     * Get the stack size.
+     *
+     * @return
+     *   the stack size of each thread in this thread pool.
+     */
+    size_t get_stack_size() const { return stackSize; }
+    size_t stack_size() const { return stackSize; }
+
+    /**
+     * Get the placement of the threads.
+     *
+     * @return
+     *   the Affinity given at construction.
+     */
+    const Affinity& get_affinity() const { return affinity; }
+
+    /**
+     * Notifies the thread pool about an idle thread
+     */
+    virtual void idle_notification();
+
+    /**
+     * Notifies the thread pool about a thread which has been idle for
+     * its keep-alive time.
+     *
+     * @param tm
+     *    the TaskManager of the idle thread.
+     * @return
+     *    true if the thread shall exit, the pool has released it then.
+     */
+    virtual bool idle_timeout(TaskManager* /*tm*/) { return false; }
+
+    /**
+     * Wait until all tasks executed so far have finished. The caller is
+     * woken up by the thread which finishes the last task, there is no
+     * polling of is_idle().
+     *
+     * @return
+     *    true if the pool is idle, false if it has been terminated.
+     */
+    bool wait_for_idle() { return wait_idle_until(NULL); }
+
+    /**
+     * Wait like wait_for_idle(), but at most until the deadline.
+     *
+     * @param deadline
+     *    the absolute timeout, see Synchronized::deadline().
+     * @return
+     *    true if the pool is idle, false after the timeout or if it has
+     *    been terminated.
+     */
+    bool wait_for_idle(const struct timespec& deadline)
+    {
+        return wait_idle_until(&deadline);
+    }
+
+    /**
+     * Stop the pool: new tasks are deleted at once, the pending tasks
+     * are treated as the ShutdownMode says. If no task runs anymore
+     * the threads are joined like with terminate().
+     *
+     * With DRAIN the queued tasks are run, with DROP_QUEUED they are
+     * deleted and the running tasks are finished. With CANCEL_NOW the
+     * queued tasks are deleted and the running tasks are not waited
+     * for; their threads exit afterwards and are joined by terminate()
+     * or the destructor.
+     *
+     * @param mode
+     *    what to do with the pending tasks.
+     * @return
+     *    true if all threads are stopped, false if a task still runs.
+     */
+    bool shutdown(ShutdownMode mode = DRAIN)
+    {
+        return shutdown_until(mode, NULL);
+    }
+
+    /**
+     * Stop the pool like shutdown(), but wait at most until the
+     * deadline. The tasks which are still queued then are deleted.
+     *
+     * @param mode
+     *    what to do with the pending tasks.
+     * @param deadline
+     *    the absolute timeout, see Synchronized::deadline().
+     * @return
+     *    true if all threads are stopped, false if a task still runs
+     *    after the deadline.
+     */
+    bool shutdown(ShutdownMode mode, const struct timespec& deadline)
+    {
+        return shutdown_until(mode, &deadline);
+    }
+
+    /**
+     * Gracefully stops all running task managers after their current
+     * task execution. The ThreadPool cannot be used thereafter and should
+     * be destroyed. This call blocks until all threads are stopped.
+     */
+    virtual void terminate();
+
+private:
+    bool shutdown_until(ShutdownMode mode, const struct timespec* deadline);
+};
+
+/**
+ * The QueuedThreadPool class provides a pool of threads that can be
+ * used to perform an arbitrary number of tasks. If a task is added
+ * and there is currently no idle thread available to perform the task,
+ * then the task will be queued for later processing. Consequently,
+ * the execute method never blocks (in contrast to ThreadPool).
+ *
+ * The threads of the QueuedThreadPool take the queued tasks directly
+ * from a shared TaskQueue, there is no extra dispatcher Thread. Within
+ * the bounds of its PoolSizing the pool starts a thread for tasks which
+ * wait in the queue and lets a thread exit which stays idle too long.
+ * With a maxWait a watchdog Thread starts a thread for a queue which has
+ * not been served in time, even if no more tasks are executed.
+ *
+ * @author Frank Fock
+ * @version 3.5.18
+ */
+class AGENTPP_DECL QueuedThreadPool : public ThreadPool {
+    class Watchdog;
+    friend class Watchdog;
+
+    TaskQueue* tasks; // NOTE: owned, a derived pool may give its own
+    PoolSizing sizing;
+    boost::atomic<size_t> threads; // NOTE: taskList.size(), read unlocked
+    boost::atomic<size_t> peak;
+    boost::atomic<bool> parked;        // the watchdog waits for a backlog
+    std::vector<TaskManager*> retired; // exited, not yet deleted
+    Watchdog* watchdog;
+
+public:
+    /**
+     * Create a ThreadPool with a given number of threads.
+     *
+     * @param size
+     *    the number of threads started for performing tasks.
+     *    The default value is 1 threads.
+     */
+    explicit QueuedThreadPool(size_t size = 1);
+
+    /**
+     * Create a ThreadPool with a given number of threads and
+     * stack size.
+     *
+     * @param size
+     *    the number of threads started for performing tasks.
+     *    The default value is 4 threads.
+     * @param stack_size
+     *    the stack size for each thread.
+     */
+    QueuedThreadPool(size_t size, size_t stack_size);
+
+    /**
+     * Create a ThreadPool with a bounded queue.
+     *
+     * @param size
+     *    the number of threads started for performing tasks.
+     * @param stack_size
+     *    the stack size for each thread.
+     * @param capacity
+     *    the maximal number of queued tasks, rounded up to a power of
+     *    two. 0 means unbounded.
+     * @param policy
+     *    what to do with a task if the queue is full.
+     */
+    QueuedThreadPool(size_t size, size_t stack_size, size_t capacity,
+        TaskQueue::OverflowPolicy policy);
+
+    /**
+     * Create an elastic ThreadPool which grows and shrinks with its load.
+     *
+     * @param sizing
+     *    the minimal and maximal number of threads, the keep-alive time
+     *    of an idle thread and when to start another thread.
+     * @param stack_size
+     *    the stack size for each thread.
+     * @param capacity
+     *    the maximal number of queued tasks, rounded up to a power of
+     *    two. 0 means unbounded.
+     * @param policy
+     *    what to do with a task if the queue is full.
+     */
+    explicit QueuedThreadPool(const PoolSizing& sizing,
+        size_t stack_size                = AGENTPP_DEFAULT_STACKSIZE,
+        size_t capacity                  = 0,
+        TaskQueue::OverflowPolicy policy = TaskQueue::BLOCK);
+
+    /**
+     * Destructor will wait for termination of all threads.
+     */
+    ~QueuedThreadPool() BOOST_OVERRIDE;
+
+    /**
+     * Execute a task. The task will be deleted after call of
+     * its run() method.
+     *
+     * @note A task rejected by the queue is deleted too.
+     */
+    void execute(Runnable* task) BOOST_OVERRIDE;
+
+    /**
+     * Execute a number of tasks at once, see TaskQueue::push_bulk().
+     *
+     * @note Tasks rejected by the queue are deleted.
+     */
+    void execute_bulk(Runnable** bulk, size_t n) BOOST_OVERRIDE;
+
+    /**
+     * Execute a task like execute(), but report a rejected task.
+     *
+     * @return
+     *    false if the pool is terminated or the queue is full and the
+     *    OverflowPolicy is REJECT. The task is still owned by the caller
+     *    then.
+     */
+    bool try_execute(Runnable* task);
+
+    /**
+     * Gets the current number of queued tasks.
+     *
+     * @return
+     *    the number of tasks that are currently queued.
+     */
+    size_t queue_length() { return tasks->size(); }
+
+    /**
+     * Gets the capacity of the queue.
+     *
+     * @return
+     *    the maximal number of queued tasks or 0 if unbounded.
+     */
+    size_t queue_capacity() const { return tasks->capacity(); }
+
+    /**
+     * Check whether QueuedThreadPool is idle
+     *
+     * @return
+     *    true if non of the threads in the pool are currently
+     *    executing a task and the queue is emtpy().
+     */
+    bool is_idle() BOOST_OVERRIDE;
+
+    /**
+     * Check whether the ThreadPool is busy
+     *
+     * @return
+     *    true if all of the threads in the pool are currently
+     *    executing a task, the queue is not empty and the pool cannot
+     *    grow.
+     */
+    bool is_busy() BOOST_OVERRIDE;
+
+    /**
+     * Get the current size of the thread pool.
+     *
+     * @return
+     *    the number of running threads, between the minimal and the
+     *    maximal size of the PoolSizing.
+     */
+    size_t size() const BOOST_OVERRIDE { return threads; }
+
+    /**
+     * Get the peak size of the thread pool.
+     *
+     * @return
+     *    the largest number of threads which have run at the same time.
+     */
+    size_t peak_size() const { return peak; }
+
+    /**
+     * Get the bounds of the thread pool.
+     *
+     * @return
+     *    the PoolSizing given at construction.
+     */
+    const PoolSizing& get_sizing() const { return sizing; }
+
+    /**
+     * Terminate the QueuedThreadPool.
+     *
+     * This call blocks until all threads are stopped.
+     */
+    void terminate() BOOST_OVERRIDE;
+
+    /**
+     * Release a thread above the minimal size, see PoolSizing.
+     */
+    bool idle_timeout(TaskManager* tm) BOOST_OVERRIDE;
+
+protected:
+    /**
+     * Wait until the queue is idle, see TaskQueue::wait_for_idle().
+     */
+    bool wait_idle_until(const struct timespec* deadline) BOOST_OVERRIDE;
+
+    /**
+     * Seal the queue, with DROP_QUEUED and CANCEL_NOW it is cleared too.
+     */
+    void stop_accepting(ShutdownMode mode) BOOST_OVERRIDE;
+
+    /**
+     * Close and clear the queue, the threads exit after their task.
+     */
+    void cancel() BOOST_OVERRIDE;
+
+    /**
+     * Create an elastic ThreadPool whose threads take their tasks from
+     * the given queue.
+     *
+     * @param sizing
+     *    the minimal and maximal number of threads, see above.
+     * @param stack_size
+     *    the stack size for each thread.
+     * @param queue
+     *    an unbounded TaskQueue which is deleted by the pool.
+     */
+    QueuedThreadPool(
+        const PoolSizing& sizing, size_t stack_size, TaskQueue* queue);
+
+    TaskQueue* task_queue() { return tasks; }
+
+    /**
+     * Start threads for the tasks which no idle thread will take, call
+     * it after tasks are queued.
+     */
+    void grow();
+
+private:
+    /**
+     * Not used, the TaskManagers take their tasks from the queue.
+     */
+    void idle_notification() BOOST_OVERRIDE { }
+
+    void start_workers();
+    void add_worker();
+    size_t backlog();
+    void watch();
+};
+
+/**
+ * The PriorityQueuedThreadPool is a QueuedThreadPool whose threads take
+ * the queued task with the highest priority first, see
+ * PriorityTaskQueue. E.g. a SET request or a trap is not delayed by a
+ * long running walk which has queued many tasks before.
+ */
+class AGENTPP_DECL PriorityQueuedThreadPool : public QueuedThreadPool {
+public:
+    /**
+     * Create a PriorityQueuedThreadPool with a given number of threads.
+     *
+     * @param size
+     *    the number of threads started for performing tasks.
+     * @param aging
+     *    the time in milliseconds after which a queued task has gained
+     *    one priority level, 0 disables the aging.
+     */
+    explicit PriorityQueuedThreadPool(
+        size_t size = 1, unsigned long aging = AGENTPP_PRIORITY_AGING_MS);
+
+    /**
+     * Create an elastic PriorityQueuedThreadPool.
+     *
+     * @param sizing
+     *    the minimal and maximal number of threads, the keep-alive time
+     *    of an idle thread and when to start another thread.
+     * @param aging
+     *    the time in milliseconds after which a queued task has gained
+     *    one priority level, 0 disables the aging.
+     * @param stack_size
+     *    the stack size for each thread.
+     */
+    explicit PriorityQueuedThreadPool(const PoolSizing& sizing,
+        unsigned long aging = AGENTPP_PRIORITY_AGING_MS,
+        size_t stack_size   = AGENTPP_DEFAULT_STACKSIZE);
+
+    using QueuedThreadPool::execute;
+
+    /**
+     * Execute a task with a priority. The task will be deleted after
+     * call of its run() method. execute(task) uses the priority 0.
+     *
+     * @param task
+     *    a Runnable instance.
+     * @param priority
+     *    the priority of the task, the higher the earlier it is run.
+     */
+    void execute(Runnable* task, int priority);
+
+    /**
+     * @return
+     *    the aging time in milliseconds given at construction.
+     */
+    unsigned long get_aging() const { return aging; }
+
+private:
+    const unsigned long aging;
+};
+
+/**
+ * The TaskManager class controls the execution of tasks on
+ * a Thread of a ThreadPool.
+ *
+ * @author Frank Fock
+ * @version 3.5.19
+ */
+class AGENTPP_DECL TaskManager : public Synchronized, public Runnable {
+    friend class ThreadPool;
+
+public:
+    /**
+     * Create a TaskManager and insert the created thread
+     * into the given ThreadPool.
+     *
+     * @param threadPool
+     *    a pointer to a ThreadPool instance.
+     * @param stack_size
+     *    the stack size for the managed thread.
+     */
+    explicit TaskManager(
+        ThreadPool* tp, size_t stack_size = AGENTPP_DEFAULT_STACKSIZE);
+
+    /**
+     * Create a TaskManager which takes its tasks from a TaskQueue
+     * instead of waiting for set_task().
+     *
+     * @param threadPool
+     *    a pointer to the ThreadPool owning this TaskManager.
+     * @param queue
+     *    the queue to take the tasks from.
+     * @param stack_size
+     *    the stack size for the managed thread.
+     */
+    TaskManager(ThreadPool* tp, TaskQueue* queue, size_t stack_size);
+
+    /**
+     * Create a TaskManager which takes its tasks from a TaskQueue and
+     * asks its ThreadPool whether to exit after being idle for a while.
+     *
+     * @param threadPool
+     *    a pointer to the ThreadPool owning this TaskManager.
+     * @param queue
+     *    the queue to take the tasks from.
+     * @param stack_size
+     *    the stack size for the managed thread.
+     * @param keep_alive
+     *    the idle time in milliseconds before ThreadPool::idle_timeout()
+     *    is called, 0 means never.
+     */
+    TaskManager(ThreadPool* tp, TaskQueue* queue, size_t stack_size,
+        unsigned long keep_alive);
+
+    /**
+     * Create a TaskManager which publishes its idle state in a
+     * WorkerSlot of the given ThreadPool.
+     *
+     * @param tp
+     *    the ThreadPool the TaskManager belongs to.
+     * @param s
+     *    the slot of the TaskManager, it must outlive the TaskManager.
+     * @param stack_size
+     *    the stack size of the thread.
+     */
+    TaskManager(ThreadPool* tp, WorkerSlot* s, size_t stack_size);
+
+    /**
+     * Create a TaskManager like above whose thread is pinned to some
+     * CPUs.
+     *
+     * @param tp
+     *    the ThreadPool the TaskManager belongs to.
+     * @param s
+     *    the slot of the TaskManager, it must outlive the TaskManager.
+     * @param stack_size
+     *    the stack size of the thread.
+     * @param cpus
+     *    the CPUs the thread may run on, empty for any.
+     */
+    TaskManager(ThreadPool* tp, WorkerSlot* s, size_t stack_size,
+        const std::vector<int>& cpus);
+
+    /**
+     * A TaskManager starts on a cache line of its own. With a node it
+     * fills whole pages which are allocated on this NUMA node (on Linux
+     * only).
+     */
+    static void* operator new(size_t size);
+    static void* operator new(size_t size, int node);
+    static void operator delete(void* p);
+    static void operator delete(void* p, int node);
+
+    /**
+     * Destructor will wait for thread to terminate.
+     */
+    ~TaskManager() BOOST_OVERRIDE;
+
+    /**
+     * Check whether this thread is idle or not.
+     *
+     * @return
+     *   true if the thread managed by this TaskManager does
+     *   not currently execute any task; false otherwise.
+     */
+    bool is_idle();
+
+    /**
+     * Set the next task for execution. This will block until
+     * current task has finished execution.
+     *
+     * @param task
+     *   a Runnable instance.
+     * @return
+     *   true if the task could be assigned successfully and
+     *   false if another thread has assigned a task concurrently.
+     *   In the latter case, the task has not been assigned!
+     */
+    bool set_task(Runnable* it);
+
+    /**
+     * Clone this TaskManager.
+     */
+    TaskManager* clone()
+    {
+        return new TaskManager(
+            new ThreadPool(threadPool->size(), threadPool->get_stack_size()));
+    }
+
+private:
+    Thread thread;
+    ThreadPool* threadPool;
+    TaskQueue* taskQueue;
+    WorkerSlot* slot;
+    Runnable* task;
+    unsigned long keepAlive; // ms, only used with a taskQueue
+    volatile bool go;
+
+    /**
+     * Start thread execution.
+     */
+    void start() { thread.start(); }
+    /**
+     * Stop thread execution after having finished current task.
+     */
+    void stop()
+    {
+        Lock l(*this);
+        go = false;
+    }
+    void run() BOOST_OVERRIDE;
+    void run_queue();
+};
+
+/**
+ * The WorkStealingDeque class implements the bounded Chase-Lev deque
+ * (see N.M. Le et al. (2013), "Correct and Efficient Work-Stealing for
+ * Weak Memory Models").
+ *
+ * Only the owning thread may call push() and pop() at the bottom end,
+ * any other thread may call steal() at the top end.
+ */
+class AGENTPP_DECL WorkStealingDeque : private boost::noncopyable {
+public:
+    /**
+     * Create a WorkStealingDeque.
+     *
+     * @param capacity
+     *    the maximal number of tasks, rounded up to a power of two.
+     */
+    explicit WorkStealingDeque(
+        size_t capacity = AGENTPP_WORK_STEALING_DEQUE_SIZE);
+    ~WorkStealingDeque();
+
+    /**
+     * Push a task at the bottom (owner only).
+     *
+     * @return
+     *    false if the deque is full.
+     */
+    bool push(Runnable* task);
+
+    /**
+     * Pop the last pushed task from the bottom (owner only).
+     *
+     * @return
+     *    the task or NULL if the deque is empty.
+     */
+    Runnable* pop();
+
+    /**
+     * Steal the oldest task from the top (any thread).
+     *
+     * @return
+     *    the task or NULL if the deque is empty or another thread
+     *    has won the race for the last task.
+     */
+    Runnable* steal();
+
+    /**
+     * Gets the approximate number of queued tasks.
+     */
+    size_t size() const;
+
+private:
+    boost::atomic<long> top;
+    char pad_top[AGENTPP_CACHE_LINE_SIZE - sizeof(boost::atomic<long>)];
+    boost::atomic<long> bottom;
+    char pad_bottom[AGENTPP_CACHE_LINE_SIZE - sizeof(boost::atomic<long>)];
+    boost::atomic<Runnable*>* buffer;
+    const long mask;
+};
+
+/**
+ * The WorkStealingThreadPool class provides a pool of threads where each
+ * thread owns a WorkStealingDeque. Tasks executed from within a running
+ * task are pushed on the deque of the current thread, other tasks are
+ * distributed round robin over the threads. Idle threads steal from
+ * random victims before they go to sleep.
+ *
+ * Like the QueuedThreadPool, the execute method never blocks.
+ */
+class AGENTPP_DECL WorkStealingThreadPool : public ThreadPool {
+    class Worker;
+    friend class Worker;
+
+public:
+    /**
+     * Create a WorkStealingThreadPool with a given number of threads.
+     *
+     * @param size
+     *    the number of threads started for performing tasks.
+     *    The default value is 4 threads.
+     */
+    explicit WorkStealingThreadPool(size_t size = 4);
+
+    /**
+     * Create a WorkStealingThreadPool with a given number of threads and
+     * stack size.
+     *
+     * @param size
+     *    the number of threads started for performing tasks.
+     * @param stack_size
+     *    the stack size for each thread.
+     */
+    WorkStealingThreadPool(size_t size, size_t stack_size);
+
+    /**
+     * Destructor will wait for termination of all threads.
+     */
+    ~WorkStealingThreadPool() BOOST_OVERRIDE;
+
+    /**
+     * Execute a task. The task will be deleted after call of
+     * its run() method.
+     */
+    void execute(Runnable* task) BOOST_OVERRIDE;
+
+    /**
+     * Execute a number of tasks at once. Only min(n, sleeping workers)
+     * threads are woken up.
+     */
+    void execute_bulk(Runnable** tasks, size_t n) BOOST_OVERRIDE;
+
+    /**
+     * Gets the current number of queued tasks.
+     *
+     * @return
+     *    the number of tasks that are currently queued.
+     */
+    size_t queue_length() const { return pending; }
+
+    /**
+     * Check whether WorkStealingThreadPool is idle
+     *
+     * @return
+     *    true if non of the threads in the pool are currently
+     *    executing a task and no task is queued.
+     */
+    bool is_idle() BOOST_OVERRIDE;
+
+    /**
+     * Check whether the WorkStealingThreadPool is busy (i.e., all threads
+     * are running a task) or not.
+     *
+     * @return
+     *    true if all of the threads in the pool is currently
+     *    executing any task.
+     */
+    bool is_busy() BOOST_OVERRIDE;
+
+    /**
+     * Get the size of the thread pool.
+     * @return
+     *    the number of threads in the pool.
+     */
+    size_t size() const BOOST_OVERRIDE { return workers.size(); }
+
+    /**
+     * Terminate the WorkStealingThreadPool. Queued tasks are deleted
+     * without execution.
+     *
+     * This call blocks until all threads are stopped.
+     */
+    void terminate() BOOST_OVERRIDE;
+
+protected:
+    bool wait_idle_until(const struct timespec* deadline) BOOST_OVERRIDE;
+
+    /**
+     * With DROP_QUEUED and CANCEL_NOW the threads delete the queued
+     * tasks instead of running them, each thread clears its own deque.
+     */
+    void stop_accepting(ShutdownMode mode) BOOST_OVERRIDE;
+    void cancel() BOOST_OVERRIDE;
+
+private:
+    /**
+     * Wakes up a sleeping thread.
+     */
+    void idle_notification() BOOST_OVERRIDE;
+
+    void start(size_t size);
+    Runnable* next_task(Worker* self);
+    void park();
+
+    std::vector<Worker*> workers;
+    boost::atomic<size_t> pending;
+    boost::atomic<size_t> active;
+    boost::atomic<size_t> sleepers;
+    boost::atomic<size_t> next_worker;
+    boost::atomic<size_t> idleWaiters; // threads in wait_for_idle()
+    boost::atomic<bool> accepting;
+    boost::atomic<bool> dropping; // NOTE: tasks are deleted unrun! CK
+    volatile bool go;
 };
 
 } // namespace AgentppCK
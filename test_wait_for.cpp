@@ -1,4 +1,7 @@
-#if __cplusplus < 201103L
+#ifdef USE_AGENTPP_CK
+#    include "posix/threadpool.hpp"
+using namespace AgentppCK;
+#elif __cplusplus < 201103L
 // see https://svn.boost.org/trac10/ticket/13599
 #    define BOOST_THREAD_HAS_CONDATTR_SET_CLOCK_MONOTONIC
 #    define BOOST_THREAD_USES_CHRONO
@@ -15,6 +18,8 @@ using namespace std;
 #endif
 
 #include <csignal>
+#include <cstdlib>
+#include <ctime>
 #include <iostream>
 
 #include <unistd.h>
@@ -33,6 +38,63 @@ void handler(int signum)
 volatile bool flag = { false };
 bool predicate() { return flag; }
 
+#ifdef USE_AGENTPP_CK
+long elapsed_ms(const struct timespec& since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since.tv_sec) * 1000L
+        + (now.tv_nsec - since.tv_nsec) / 1000000L;
+}
+
+int main(int /*argc*/, char* /*argv*/[])
+{
+    signal(SIGALRM, &handler);
+    ::ualarm(500000, 0); // us
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+#    if defined(_POSIX_MONOTONIC_CLOCK) && _POSIX_MONOTONIC_CLOCK >= 0
+    // NOTE: the deadline must not be on the system time! CK
+    struct timespec deadline = Synchronized::deadline(2000);
+    long offset = (deadline.tv_sec - start.tv_sec) * 1000L
+        + (deadline.tv_nsec - start.tv_nsec) / 1000000L;
+    if (offset < 2000 || offset > 2100) {
+        std::cerr << "ERROR: deadline not on CLOCK_MONOTONIC!" << std::endl;
+        return EXIT_FAILURE;
+    }
+#    else
+    struct timespec deadline = Synchronized::deadline(2000);
+#    endif
+
+    Synchronized sync;
+    sync.lock();
+    {
+        // NOTE: the loop reuses the deadline after each wakeup
+        while (!predicate()) {
+            if (sync.wait_until(deadline)) {
+                break;
+            }
+        }
+        if (elapsed_ms(start) < 2000) {
+            std::cerr << "ERROR: timeout expected after 2s!" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    std::cout << "wait_until has returned with timout" << std::endl;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!sync.wait(100) || elapsed_ms(start) < 100) {
+        std::cerr << "ERROR: timeout expected after 100ms!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "wait has returned with timout" << std::endl;
+    sync.unlock();
+
+    return EXIT_SUCCESS;
+}
+#else
 int main(int /*argc*/, char* /*argv*/[])
 {
     signal(SIGALRM, &handler);
@@ -56,3 +118,4 @@ int main(int /*argc*/, char* /*argv*/[])
 
     return EXIT_SUCCESS;
 }
+#endif
@@ -36,7 +36,19 @@ src/threads.cpp > threadpool.cpp
 #    include <unistd.h> // _POSIX_THREADS ...
 #endif
 
+#ifdef AGENTPP_USE_FUTEX
+#    include <linux/futex.h>
+#    include <sys/syscall.h>
+
+#    include <cerrno>
+#    include <climits>
+#    include <ctime>
+#endif
+
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <sstream>
 
 #if !defined(NO_LOGGING) && !defined(NDEBUG)
 #    include <boost/current_function.hpp>
@@ -78,36 +90,336 @@ namespace Agentpp
 static const char* loggerModuleName = "agent++.threads";
 #endif
 
+namespace
+{
+
+// NOTE: a hint to the CPU that we are spinning! CK
+inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+} // namespace
+
 /*--------------------- class Synchronized -------------------------*/
 
+#ifdef AGENTPP_USE_FUTEX
+Synchronized::Synchronized()
+    : word(0)
+    , sequence(0)
+    , waiters(0)
+    , draining(0)
+    , signal(false)
+{ }
+#else
 Synchronized::Synchronized()
     : signal(false)
+    , sequence(0)
+    , waiters(0)
+    , draining(false)
     , tid_(boost::thread::id())
 { }
+#endif
 
 Synchronized::~Synchronized()
 {
     DTRACE(signal);
-    // NOTE: give other waiting threads a time window
-    // to return from the wait on our condition_variable
-    if (is_locked_by_this_thread()) {
-        signal = true;
+    // NOTE: each waiter must have returned from wait() before the monitor
+    // is gone. The last one wakes us, so we sleep until then, without any
+    // fixed delay or busy loop! CK
+    if (!is_locked_by_this_thread()) {
+        lock();
+    }
+    signal = true;
+    if (waiters) {
         notify_all();
-        unlock();
-        boost::this_thread::sleep_for(ms(10));
-    } else {
-        while (!signal) {
-            if (lock(50)) {
-                signal = true; // again! CK
-                notify_all();
-                unlock();
-                boost::this_thread::sleep_for(ms(10));
+        drain();
+    }
+    unlock();
+    DTRACE("");
+}
+
+#ifdef AGENTPP_USE_FUTEX
+
+namespace
+{
+
+// NOTE: the same bit as FUTEX_WAITERS of the robust futexes! CK
+const boost::uint32_t WAITERS  = 0x80000000U;
+const boost::uint32_t TID_MASK = 0x3fffffffU;
+
+// NOTE: spinning is useless if the owner can not run meanwhile! CK
+const unsigned spin_rounds =
+    (boost::thread::hardware_concurrency() > 1) ? 100 : 0;
+
+inline boost::uint32_t current_tid()
+{
+    static thread_local boost::uint32_t tid = 0;
+    if (!tid) {
+        tid = static_cast<boost::uint32_t>(syscall(SYS_gettid));
+    }
+    return tid;
+}
+
+inline int* futex_addr(boost::atomic<boost::uint32_t>& word)
+{
+    BOOST_STATIC_ASSERT(sizeof(boost::atomic<boost::uint32_t>) == sizeof(int));
+    return reinterpret_cast<int*>(&word);
+}
+
+/// @return false if the deadline is reached
+bool futex_wait(boost::atomic<boost::uint32_t>& word, boost::uint32_t value,
+    const time_point* deadline)
+{
+    struct timespec timeout;
+    struct timespec* rel = 0;
+    if (deadline) {
+        const ns left = *deadline - Clock::now();
+        if (left <= ns(0)) {
+            return false;
+        }
+        timeout.tv_sec  = static_cast<time_t>(left.count() / 1000000000);
+        timeout.tv_nsec = static_cast<long>(left.count() % 1000000000);
+        rel             = &timeout;
+    }
+
+    // NOTE: FUTEX_WAIT measures the relative timeout with CLOCK_MONOTONIC,
+    // so the deadline has to be on a steady clock too! CK
+    BOOST_STATIC_ASSERT(Clock::is_steady);
+    if (syscall(SYS_futex, futex_addr(word), FUTEX_WAIT_PRIVATE,
+            static_cast<int>(value), rel, 0, 0)
+        == -1) {
+        return errno != ETIMEDOUT; // EAGAIN, EINTR: check again
+    }
+    return true;
+}
+
+inline void futex_wake(boost::atomic<boost::uint32_t>& word, int count)
+{
+    syscall(SYS_futex, futex_addr(word), FUTEX_WAKE_PRIVATE, count, 0, 0, 0);
+}
+
+} // namespace
+
+bool Synchronized::is_locked_by_this_thread() const
+{
+    return (word.load(boost::memory_order_relaxed) & TID_MASK)
+        == current_tid();
+}
+
+bool Synchronized::lock_contended(const time_point* deadline, bool spin)
+{
+    const boost::uint32_t tid = current_tid();
+
+    for (unsigned i = 0; spin && i < spin_rounds; ++i) {
+        boost::uint32_t v = 0;
+        if (word.load(boost::memory_order_relaxed) == 0
+            && word.compare_exchange_weak(
+                v, tid, boost::memory_order_acquire)) {
+            return true;
+        }
+        cpu_relax();
+    }
+
+    for (;;) {
+        boost::uint32_t v = word.load(boost::memory_order_relaxed);
+        if (v == 0) {
+            // NOTE: there may be more waiters, unlock() has to wake them!
+            if (word.compare_exchange_strong(
+                    v, tid | WAITERS, boost::memory_order_acquire)) {
+                return true;
+            }
+            continue;
+        }
+        if (!(v & WAITERS)) {
+            if (!word.compare_exchange_strong(
+                    v, v | WAITERS, boost::memory_order_relaxed)) {
+                continue;
             }
+            v |= WAITERS;
+        }
+        if (!futex_wait(word, v, deadline)) {
+            return false;
+        }
+    }
+}
+
+bool Synchronized::wait_until(const time_point* deadline)
+{
+    BOOST_ASSERT(is_locked_by_this_thread());
+
+    // NOTE: the sequence is read after waiters is incremented, see notify()
+    signal = false;
+    waiters.fetch_add(1);
+    const boost::uint32_t seq = sequence.load();
+    bool notified             = false;
+    for (;;) {
+        unlock();
+        //=================================
+        const bool in_time = futex_wait(sequence, seq, deadline);
+        //=================================
+        // NOTE: we may be requeued to the lock word by notify_all(), so
+        // the lock is taken with the waiters bit set! CK
+        (void)lock_contended(0, false);
+        notified = (sequence.load(boost::memory_order_relaxed) != seq);
+        if (notified || !in_time) {
+            break;
+        }
+    }
+    // NOTE: the last waiter wakes the destructor, see drain()! CK
+    if (waiters.fetch_sub(1, boost::memory_order_relaxed) == 1
+        && draining.load(boost::memory_order_relaxed)) {
+        draining.store(0, boost::memory_order_relaxed);
+        futex_wake(draining, 1);
+    }
+
+    return notified;
+}
+
+void Synchronized::drain()
+{
+    BOOST_ASSERT(is_locked_by_this_thread());
+
+    // NOTE: waiters and draining are changed with the lock only! CK
+    draining.store(1, boost::memory_order_relaxed);
+    while (waiters.load(boost::memory_order_relaxed)) {
+        unlock();
+        //=================================
+        (void)futex_wait(draining, 1, 0);
+        //=================================
+        lock();
+    }
+    draining.store(0, boost::memory_order_relaxed);
+}
+
+void Synchronized::wait()
+{
+    DTRACE(signal);
+    (void)wait_until(0);
+}
+
+bool Synchronized::wait_for(unsigned long timeout)
+{
+    DTRACE(signal);
+    const time_point deadline = Clock::now() + ms(timeout);
+    return wait_until(&deadline);
+}
+
+void Synchronized::notify()
+{
+    DTRACE(signal);
+    signal = true;
+    sequence.fetch_add(1);
+    if (waiters.load()) {
+        futex_wake(sequence, 1);
+    }
+}
+
+void Synchronized::notify_all()
+{
+    DTRACE(signal);
+    signal = true;
+    const boost::uint32_t seq = sequence.fetch_add(1) + 1;
+    if (!waiters.load()) {
+        return;
+    }
+
+    if (is_locked_by_this_thread()) {
+        // NOTE: wake one waiter, the others are moved to the lock word,
+        // unlock() wakes them one by one! CK
+        word.fetch_or(WAITERS, boost::memory_order_relaxed);
+        if (syscall(SYS_futex, futex_addr(sequence), FUTEX_CMP_REQUEUE_PRIVATE,
+                1, INT_MAX, futex_addr(word), static_cast<int>(seq))
+            != -1) {
+            return;
         }
     }
+    futex_wake(sequence, INT_MAX);
+}
+
+bool Synchronized::lock()
+{
+    DTRACE("");
+
+    boost::uint32_t v = 0;
+    if (word.compare_exchange_strong(
+            v, current_tid(), boost::memory_order_acquire)) {
+        return true;
+    }
+
+    if ((v & TID_MASK) == current_tid()) {
+
+#    ifndef NDEBUG
+        throw std::runtime_error("Synchronized::lock(): recursive used!");
+#    endif
+
+        return false; // NOTE: no recursive locking! CK
+    }
+
+    return lock_contended(0, true);
+}
+
+bool Synchronized::lock(unsigned long timeout)
+{
+    DTRACE(timeout);
+
+    boost::uint32_t v = 0;
+    if (word.compare_exchange_strong(
+            v, current_tid(), boost::memory_order_acquire)) {
+        return true;
+    }
+
+    if ((v & TID_MASK) == current_tid()) {
+        return false; // NOTE: no recursive locking! CK
+    }
+
+    const time_point deadline = Clock::now() + ms(timeout);
+    return lock_contended(&deadline, true);
+}
+
+bool Synchronized::unlock()
+{
     DTRACE("");
+
+    const boost::uint32_t tid = current_tid();
+    boost::uint32_t v         = tid;
+    if (word.compare_exchange_strong(v, 0, boost::memory_order_release)) {
+        return true;
+    }
+
+    if ((v & TID_MASK) != tid) {
+        return false; // NOTE: not locked by this thread
+    }
+
+    // NOTE: only we may clear the waiters bit! CK
+    word.store(0, boost::memory_order_release);
+    futex_wake(word, 1);
+    return true;
+}
+
+Synchronized::TryLockResult Synchronized::trylock()
+{
+    boost::uint32_t v = 0;
+    if (word.compare_exchange_strong(
+            v, current_tid(), boost::memory_order_acquire)) {
+        DTRACE("LOCKED");
+        return LOCKED; // true
+    }
+
+    if ((v & TID_MASK) == current_tid()) {
+        DTRACE("OWNED");
+        return OWNED; // true
+    }
+
+    return BUSY; // false
 }
 
+#else // AGENTPP_USE_FUTEX
+
 void Synchronized::wait()
 {
     DTRACE(signal);
@@ -118,7 +430,11 @@ void Synchronized::wait()
 
     // NOTE: now we wait for a call to notify or notify_all! CK
     signal = false;
-    wait_for_signal_if_needed(l, signal);
+    ++waiters;
+    wait_for_signal_if_needed(l, sequence);
+    if (!--waiters && draining) {
+        cond.notify_all(); // NOTE: the destructor, see drain()! CK
+    }
     l.release(); // ownership
 }
 
@@ -137,21 +453,45 @@ bool Synchronized::wait_for(unsigned long timeout)
     time_point t = Clock::now() + d;
 
     // NOTE: now we wait for a call to notify or notify_all! CK
-    signal = false;
-    while (!signal) {
+    signal                  = false;
+    const unsigned long seq = sequence;
+    bool notified           = true;
+    ++waiters;
+    while (sequence == seq) {
         //=================================
         tid_ = boost::thread::id();
         if (cond.wait_until(l, t) == boost::cv_status::timeout) {
-            tid_ = boost::this_thread::get_id();
-            l.release(); // ownership
-            return false;
+            tid_     = boost::this_thread::get_id();
+            notified = false;
+            break;
         }
         tid_ = boost::this_thread::get_id();
         //=================================
     }
+    if (!--waiters && draining) {
+        cond.notify_all(); // NOTE: the destructor, see drain()! CK
+    }
 
     l.release(); // ownership
-    return true;
+    return notified;
+}
+
+void Synchronized::drain()
+{
+    BOOST_ASSERT(is_locked_by_this_thread());
+
+    // NOTE: this may throw! CK
+    scoped_lock l(mutex, boost::adopt_lock);
+    draining = true;
+    while (waiters) {
+        //=================================
+        tid_ = boost::thread::id();
+        cond.wait(l); // NOTE: until the last waiter has left wait()
+        tid_ = boost::this_thread::get_id();
+        //=================================
+    }
+    draining = false;
+    l.release(); // ownership
 }
 
 void Synchronized::notify()
@@ -162,6 +502,7 @@ void Synchronized::notify()
     // NOTE: this may throw! CK
     scoped_lock l(mutex, boost::adopt_lock);
     signal = true;
+    ++sequence;
     cond.notify_one();
     l.release(); // ownership
 }
@@ -174,6 +515,7 @@ void Synchronized::notify_all()
     // NOTE: this may throw! CK
     scoped_lock l(mutex, boost::adopt_lock);
     signal = true;
+    ++sequence;
     cond.notify_all();
     l.release(); // ownership
 }
@@ -199,21 +541,20 @@ bool Synchronized::lock()
     return true;
 }
 
-// TODO: should be bool try_lock_for(duration)
 bool Synchronized::lock(unsigned long timeout)
 {
     DTRACE(timeout);
 
-    duration d = ms(timeout);
-    while (!mutex.try_lock()) {
-        boost::this_thread::sleep_for(ms(10));
-        d = d - ms(10);
-        if (d <= ms(0)) {
-            return false;
-        }
+    if (is_locked_by_this_thread()) {
+        return false; // NOTE: no recursive locking! CK
+    }
+
+    // NOTE: the deadline is on the steady clock, boost rechecks it after
+    // each wakeup, so a step of the system time does not matter! CK
+    if (!mutex.try_lock_until(Clock::now() + ms(timeout))) {
+        return false;
     }
 
-    BOOST_ASSERT(!is_locked_by_this_thread());
     tid_ = boost::this_thread::get_id();
     return true; // OK
 }
@@ -249,6 +590,8 @@ Synchronized::TryLockResult Synchronized::trylock()
     return BUSY; // false
 }
 
+#endif // AGENTPP_USE_FUTEX
+
 /*------------------------ class Thread ----------------------------*/
 
 // XXX ThreadList Thread::threadList;
@@ -444,306 +787,1981 @@ void Thread::nsleep(time_t secs, long nanos)
     boost::this_thread::sleep_for(sec(secs) + ns(nanos));
 }
 
-/*--------------------- class TaskManager --------------------------*/
+/*--------------------- class TaskAllocator ------------------------*/
 
-TaskManager::TaskManager( // TODO std::shared_ptr<ThreadPool> tp,
-    ThreadPool* tp, size_t stack_size)
-    : thread(this)
-    , threadPool(0)
+namespace
 {
-    DTRACE("");
-    threadPool = tp;
-    task       = 0;
-    go         = true;
-    thread.set_stack_size(stack_size);
-    thread.start();
-    DTRACE("thread started");
-}
 
-TaskManager::~TaskManager()
-{
+const std::size_t granularity  = 16;
+const std::size_t size_classes = AGENTPP_TASK_ALLOCATOR_MAX_SIZE / granularity;
+const std::size_t batch_size   = AGENTPP_TASK_ALLOCATOR_BATCH;
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+// NOTE: only the owning thread writes its counters, any thread reads! CK
+struct Counters {
+    Counters()
+        : allocations(0)
+        , deallocations(0)
+        , cache_hits(0)
+        , depot_transfers(0)
+        , heap_allocations(0)
+    { }
+
+    static void inc(boost::atomic<size_t>& counter)
     {
-        Lock l(*this);
-        DTRACE("");
-        go = false;
-        l.notify();
+        counter.store(counter.load(boost::memory_order_relaxed) + 1,
+            boost::memory_order_relaxed);
     }
 
-    thread.join();
-    DTRACE("thread joined");
-}
+    boost::atomic<size_t> allocations;
+    boost::atomic<size_t> deallocations;
+    boost::atomic<size_t> cache_hits;
+    boost::atomic<size_t> depot_transfers;
+    boost::atomic<size_t> heap_allocations;
+};
 
-void TaskManager::run()
+struct ThreadCache {
+    ThreadCache()
+    {
+        for (std::size_t c = 0; c < size_classes; c++) {
+            head[c]  = nullptr;
+            count[c] = 0;
+        }
+    }
+
+    FreeBlock* head[size_classes];
+    std::size_t count[size_classes];
+    Counters counters;
+};
+
+// the batches given back by the threads and the counters of all threads
+struct Depot {
+    Depot()
+        : retired()
+    { }
+
+    boost::mutex mutex;
+    std::vector<FreeBlock*> batches[size_classes];
+    std::list<ThreadCache*> caches;
+    TaskAllocator::Statistics retired;
+};
+
+Depot& depot()
 {
-    scoped_lock l(mutex);
-    //=================================
-    tid_ = boost::this_thread::get_id();
+    // NOTE: never destroyed, blocks may be freed during static
+    // destruction! CK
+    static Depot* instance = new Depot();
+    return *instance;
+}
 
-    DTRACE("");
-    while (go) {
-        wait_until_condition(l, boost::bind(&TaskManager::has_task, this));
+void add(TaskAllocator::Statistics& sum, const Counters& c)
+{
+    sum.allocations += c.allocations;
+    sum.deallocations += c.deallocations;
+    sum.cache_hits += c.cache_hits;
+    sum.depot_transfers += c.depot_transfers;
+    sum.heap_allocations += c.heap_allocations;
+}
 
-        if (!go)
-            break;
+thread_local ThreadCache* current_cache = nullptr;
+thread_local bool cache_destroyed       = false;
 
-        if (task) {
-            try {
-                //=====================================
-                task->run();
-                //=====================================
-            } catch (std::exception& e) {
-                DTRACE(e.what());
-            } catch (...) {
-                // TODO: log ... but ignored! CK
+// returns the free lists of a terminating thread to the depot
+struct CacheOwner {
+    ~CacheOwner()
+    {
+        ThreadCache* cache = current_cache;
+        current_cache      = nullptr;
+        cache_destroyed    = true;
+
+        Depot& d = depot();
+        boost::lock_guard<boost::mutex> l(d.mutex);
+        for (std::size_t c = 0; c < size_classes; c++) {
+            if (cache->head[c]) {
+                d.batches[c].push_back(cache->head[c]);
             }
-            delete task;
-            task = 0;
-            threadPool->idle_notification();
         }
+        add(d.retired, cache->counters);
+        d.caches.remove(cache);
+        delete cache;
     }
+};
 
-    if (task) {
-        delete task;
-        task = 0;
-        DTRACE("task deleted after stop()");
+ThreadCache* local_cache()
+{
+    if (current_cache || cache_destroyed) {
+        return current_cache;
     }
 
-    tid_ = boost::thread::id();
-    //=================================
+    static thread_local CacheOwner owner;
+    (void)owner;
+    ThreadCache* cache = new ThreadCache();
+    {
+        Depot& d = depot();
+        boost::lock_guard<boost::mutex> l(d.mutex);
+        d.caches.push_back(cache);
+    }
+    current_cache = cache;
+    return cache;
 }
 
-bool TaskManager::set_task(Runnable* t)
+} // namespace
+
+void* TaskAllocator::allocate(std::size_t size)
 {
-#ifndef AGENTPP_SET_TASK_USE_TRY_LOCK
-    // FIXME: may deadlock when called from ThreadPool::execute()! CK
-    Lock l(*this);
-    if (!task) {
-        task = t;
-        l.notify();
-        DTRACE("after notify");
-        return true;
+    const std::size_t c = (size + granularity - 1) / granularity - 1;
+    ThreadCache* cache  = local_cache();
+    if (size == 0 || c >= size_classes || !cache) {
+        return ::operator new(size);
     }
-#else
-    //=====================<<<
-    if (!task && try_lock()) {
-        if (task) {
-            DTRACE("Busy; too late!");
-            (void)unlock();
-            //=============>>>
-            return false;
+
+    Counters::inc(cache->counters.allocations);
+    FreeBlock* block = cache->head[c];
+    if (block) {
+        Counters::inc(cache->counters.cache_hits);
+    } else {
+        Depot& d = depot();
+        boost::unique_lock<boost::mutex> l(d.mutex);
+        if (!d.batches[c].empty()) {
+            block = d.batches[c].back();
+            d.batches[c].pop_back();
+            l.unlock();
+
+            std::size_t n = 0;
+            for (FreeBlock* b = block; b; b = b->next) {
+                n++;
+            }
+            cache->count[c] = n;
+            Counters::inc(cache->counters.depot_transfers);
+        } else {
+            l.unlock();
+            Counters::inc(cache->counters.heap_allocations);
+            return ::operator new((c + 1) * granularity);
+        }
+    }
+
+    cache->head[c] = block->next;
+    cache->count[c]--;
+    return block;
+}
+
+void TaskAllocator::deallocate(void* p, std::size_t size) noexcept
+{
+    const std::size_t c = (size + granularity - 1) / granularity - 1;
+    ThreadCache* cache  = local_cache();
+    if (!p) {
+        return;
+    }
+    if (size == 0 || c >= size_classes || !cache) {
+        ::operator delete(p);
+        return;
+    }
+
+    Counters::inc(cache->counters.deallocations);
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    block->next      = cache->head[c];
+    cache->head[c]   = block;
+    cache->count[c]++;
+
+    if (cache->count[c] >= 2 * batch_size) {
+        // NOTE: keep one batch, give one batch to the depot! CK
+        FreeBlock* last = block;
+        for (std::size_t i = 1; i < batch_size; i++) {
+            last = last->next;
+        }
+        cache->head[c] = last->next;
+        last->next     = nullptr;
+        cache->count[c] -= batch_size;
+        Counters::inc(cache->counters.depot_transfers);
+
+        Depot& d = depot();
+        boost::lock_guard<boost::mutex> l(d.mutex);
+        d.batches[c].push_back(block);
+    }
+}
+
+TaskAllocator::Statistics TaskAllocator::statistics()
+{
+    Depot& d = depot();
+    boost::lock_guard<boost::mutex> l(d.mutex);
+    Statistics sum = d.retired;
+    for (std::list<ThreadCache*>::const_iterator it = d.caches.begin();
+         it != d.caches.end(); ++it) {
+        add(sum, (*it)->counters);
+    }
+    return sum;
+}
+
+/*-------------------- class SharedStateBase -----------------------*/
+
+namespace detail
+{
+
+void SharedStateBase::set_ready()
+{
+    ready = true;
+    if (waiting) {
+        boost::unique_lock<boost::mutex> l(mutex);
+        cond.notify_all();
+    }
+}
+
+void SharedStateBase::wait()
+{
+    if (ready) {
+        return;
+    }
+
+    boost::unique_lock<boost::mutex> l(mutex);
+    waiting = true; // NOTE: pairs with set_ready(), seq_cst! CK
+    while (!ready) {
+        cond.wait(l);
+    }
+}
+
+bool SharedStateBase::wait_for(const duration& rel_time)
+{
+    if (ready) {
+        return true;
+    }
+
+    const time_point deadline = Clock::now() + rel_time;
+    boost::unique_lock<boost::mutex> l(mutex);
+    waiting = true;
+    while (!ready) {
+        if (cond.wait_until(l, deadline) == boost::cv_status::timeout) {
+            return ready;
+        }
+    }
+    return true;
+}
+
+} // namespace detail
+
+/*------------------------- class Task -----------------------------*/
+
+const Task::Ops Task::runnable_ops = { &Task::run_runnable,
+    &Task::move_runnable, &Task::delete_runnable };
+
+/*----------------------- class Histogram --------------------------*/
+
+Histogram::Histogram()
+    : total(0)
+    , valueSum(0)
+    , maxValue(0)
+{
+    std::fill(counts, counts + BUCKETS, 0);
+}
+
+size_t Histogram::bucket_of(boost::uint64_t value)
+{
+    if (value < SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+    if (value >> MAX_BITS) {
+        return BUCKETS - 1;
+    }
+
+#if defined(__GNUC__)
+    const unsigned msb = 63 - __builtin_clzll(value);
+#else
+    unsigned msb = SUB_BUCKET_BITS;
+    while (value >> (msb + 1)) {
+        ++msb;
+    }
+#endif
+    // NOTE: the bits below the highest one select the sub-bucket! CK
+    const unsigned shift = msb - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS
+        + static_cast<size_t>((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+boost::uint64_t Histogram::lower_bound(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    const size_t shift = bucket / SUB_BUCKETS - 1;
+    return boost::uint64_t(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+}
+
+boost::uint64_t Histogram::upper_bound(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    const size_t shift = bucket / SUB_BUCKETS - 1;
+    return lower_bound(bucket) + (boost::uint64_t(1) << shift) - 1;
+}
+
+void Histogram::record(boost::uint64_t value)
+{
+    ++counts[bucket_of(value)];
+    ++total;
+    valueSum += value;
+    maxValue = std::max(maxValue, value);
+}
+
+Histogram& Histogram::operator+=(const Histogram& other)
+{
+    for (size_t i = 0; i < BUCKETS; i++) {
+        counts[i] += other.counts[i];
+    }
+    total += other.total;
+    valueSum += other.valueSum;
+    maxValue = std::max(maxValue, other.maxValue);
+    return *this;
+}
+
+double Histogram::mean() const
+{
+    return total ? static_cast<double>(valueSum) / total : 0.0;
+}
+
+boost::uint64_t Histogram::percentile(double p) const
+{
+    if (!total) {
+        return 0;
+    }
+
+    const double rank = std::ceil(p / 100.0 * total);
+    boost::uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank && seen > 0) {
+            return std::min(upper_bound(i), maxValue);
+        }
+    }
+    return maxValue;
+}
+
+/*---------------------- class PoolMetrics -------------------------*/
+
+namespace
+{
+
+const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+const char* const percentile_names[] = { "p50", "p90", "p99", "p99.9" };
+
+void print_text(std::ostream& os, const char* name, const Histogram& h,
+    double unit)
+{
+    os << name << ": count " << h.count() << ", mean " << h.mean() / unit;
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(double); i++) {
+        os << ", " << percentile_names[i] << ' '
+           << h.percentile(percentiles[i]) / unit;
+    }
+    os << ", max " << h.max() / unit << '\n';
+}
+
+void print_json(std::ostream& os, const char* name, const Histogram& h)
+{
+    os << '"' << name << "\":{\"count\":" << h.count()
+       << ",\"mean\":" << h.mean();
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(double); i++) {
+        os << ",\"" << percentile_names[i]
+           << "\":" << h.percentile(percentiles[i]);
+    }
+    os << ",\"max\":" << h.max() << ",\"buckets\":[";
+    const char* separator = "";
+    for (size_t i = 0; i < Histogram::BUCKETS; i++) {
+        if (h.bucket(i)) {
+            os << separator << '[' << Histogram::lower_bound(i) << ','
+               << h.bucket(i) << ']';
+            separator = ",";
+        }
+    }
+    os << "]}";
+}
+
+double percent(boost::uint64_t part, boost::uint64_t whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+} // namespace
+
+PoolMetrics::PoolMetrics()
+    : threads(0)
+    , idle(0)
+    , queue_length(0)
+    , tasks(0)
+    , rejected(0)
+    , busy(0)
+    , alive(0)
+{ }
+
+double PoolMetrics::utilization() const
+{
+    return alive ? static_cast<double>(busy) / alive : 0.0;
+}
+
+std::string PoolMetrics::to_text() const
+{
+    std::ostringstream os;
+    os.setf(std::ios::fixed);
+    os.precision(1);
+    os << "threads: " << threads << ", idle: " << idle
+       << ", queued: " << queue_length << ", tasks: " << tasks
+       << ", rejected: " << rejected
+       << ", utilization: " << percent(busy, alive) << "%\n";
+    print_text(os, "wait [us]", wait, 1000.0);
+    print_text(os, "run [us]", run, 1000.0);
+    print_text(os, "queue depth", queue_depth, 1.0);
+    for (size_t i = 0; i < workers.size(); i++) {
+        os << "thread " << i << ": tasks " << workers[i].tasks
+           << ", utilization " << percent(workers[i].busy, workers[i].alive)
+           << "%\n";
+    }
+    return os.str();
+}
+
+std::string PoolMetrics::to_json() const
+{
+    std::ostringstream os;
+    os.setf(std::ios::fixed);
+    os.precision(4);
+    os << "{\"threads\":" << threads << ",\"idle\":" << idle
+       << ",\"queue_length\":" << queue_length << ",\"tasks\":" << tasks
+       << ",\"rejected\":" << rejected << ",\"busy\":" << busy
+       << ",\"alive\":" << alive << ",\"utilization\":" << utilization()
+       << ',';
+    print_json(os, "wait", wait);
+    os << ',';
+    print_json(os, "run", run);
+    os << ',';
+    print_json(os, "queue_depth", queue_depth);
+    os << ",\"workers\":[";
+    for (size_t i = 0; i < workers.size(); i++) {
+        os << (i ? "," : "") << "{\"tasks\":" << workers[i].tasks
+           << ",\"busy\":" << workers[i].busy
+           << ",\"alive\":" << workers[i].alive << '}';
+    }
+    os << "]}";
+    return os.str();
+}
+
+/*--------------------- class WorkerMetrics ------------------------*/
+
+/**
+ * The counters of one thread of a ThreadPool. Only this thread writes
+ * them, so a relaxed load and store (a plain move on most CPUs) is used
+ * instead of an atomic increment, any thread may read them.
+ */
+class WorkerMetrics : private boost::noncopyable {
+public:
+    WorkerMetrics()
+        : started(Clock::now())
+    {
+        clear(tasks);
+        clear(busy);
+        clear(wait);
+        clear(run);
+    }
+
+    /// NOTE: called by the owning thread only! CK
+    void record(time_point queued, time_point start, time_point end)
+    {
+        const boost::uint64_t ran = nanoseconds(end - start);
+        add(tasks, 1);
+        add(busy, ran);
+        record(wait, nanoseconds(start - queued));
+        record(run, ran);
+    }
+
+    /**
+     * Add the counters to a snapshot.
+     *
+     * @return
+     *    the counters of this thread.
+     */
+    PoolMetrics::Worker add_to(PoolMetrics& sum, time_point now) const
+    {
+        PoolMetrics::Worker w;
+        w.tasks = tasks.load(boost::memory_order_relaxed);
+        w.busy  = busy.load(boost::memory_order_relaxed);
+        w.alive = nanoseconds(now - started);
+        sum.tasks += w.tasks;
+        sum.busy += w.busy;
+        sum.alive += w.alive;
+        add_to(sum.wait, wait);
+        add_to(sum.run, run);
+        return w;
+    }
+
+private:
+    typedef boost::atomic<boost::uint64_t> Counter;
+
+    struct Recorder {
+        Counter counts[Histogram::BUCKETS];
+        Counter total;
+        Counter sum;
+        Counter max;
+    };
+
+    static boost::uint64_t nanoseconds(duration d)
+    {
+        const long long n = boost::chrono::duration_cast<ns>(d).count();
+        return (n > 0) ? static_cast<boost::uint64_t>(n) : 0;
+    }
+
+    static void clear(Counter& c) { c.store(0, boost::memory_order_relaxed); }
+
+    static void clear(Recorder& r)
+    {
+        for (size_t i = 0; i < Histogram::BUCKETS; i++) {
+            clear(r.counts[i]);
+        }
+        clear(r.total);
+        clear(r.sum);
+        clear(r.max);
+    }
+
+    static void add(Counter& c, boost::uint64_t value)
+    {
+        c.store(c.load(boost::memory_order_relaxed) + value,
+            boost::memory_order_relaxed);
+    }
+
+    static void record(Recorder& r, boost::uint64_t value)
+    {
+        add(r.counts[Histogram::bucket_of(value)], 1);
+        add(r.total, 1);
+        add(r.sum, value);
+        if (value > r.max.load(boost::memory_order_relaxed)) {
+            r.max.store(value, boost::memory_order_relaxed);
+        }
+    }
+
+    static void add_to(Histogram& h, const Recorder& r)
+    {
+        for (size_t i = 0; i < Histogram::BUCKETS; i++) {
+            h.counts[i] += r.counts[i].load(boost::memory_order_relaxed);
+        }
+        h.total += r.total.load(boost::memory_order_relaxed);
+        h.valueSum += r.sum.load(boost::memory_order_relaxed);
+        h.maxValue =
+            std::max(h.maxValue, r.max.load(boost::memory_order_relaxed));
+    }
+
+    const time_point started;
+    Counter tasks;
+    Counter busy; // ns
+    Recorder wait;
+    Recorder run;
+};
+
+/*--------------------- class TaskManager --------------------------*/
+
+TaskManager::TaskManager( // TODO std::shared_ptr<ThreadPool> tp,
+    ThreadPool* tp, size_t stack_size)
+    : threadPool(tp)
+    , go(true)
+    , assigned(false)
+    , spinWait(tp->get_spin_wait())
+    , spinNanos(0)
+    , averageGap(0)
+    , meter(new WorkerMetrics())
+    , thread(this)
+{
+    DTRACE("");
+    if (spinWait.mode == SpinWait::FIXED) {
+        spinNanos = spinWait.nanoseconds;
+    } else if (spinWait.mode == SpinWait::ADAPTIVE
+        && boost::thread::hardware_concurrency() < 2) {
+        spinWait.mode = SpinWait::PARK;
+    }
+    thread.set_stack_size(stack_size);
+    thread.start();
+    DTRACE("thread started");
+}
+
+TaskManager::~TaskManager()
+{
+    {
+        Lock l(*this);
+        DTRACE("");
+        go = false;
+        l.notify();
+    }
+
+    thread.join();
+    DTRACE("thread joined");
+}
+
+void TaskManager::run()
+{
+    Lock l(*this);
+    //=================================
+
+    DTRACE("");
+    time_point idle_since = Clock::now();
+    while (go) {
+        if (!has_task() && spinNanos) {
+            spin_for_task();
+        }
+        while (!has_task()) {
+            l.wait(-1); // NOTE: until assign() or ~TaskManager() CK
+        }
+
+        if (!go)
+            break;
+
+        if (task) {
+            if (spinWait.mode == SpinWait::ADAPTIVE) {
+                tune_spin(idle_since);
+            }
+            const time_point started = Clock::now();
+            try {
+                //=====================================
+                task();
+                //=====================================
+            } catch (std::exception& e) {
+                DTRACE(e.what());
+            } catch (...) {
+                // TODO: log ... but ignored! CK
+            }
+            const time_point ended = Clock::now();
+            meter->record(queuedAt, started, ended);
+            task.reset();
+            assigned.store(false, boost::memory_order_relaxed);
+            idle_since = ended;
+            if (go) {
+                // NOTE: without our lock, the woken caller of execute()
+                // does not block in assign() until we wait! CK
+                unlock();
+                threadPool->idle_notification(this);
+                lock();
+            }
+        }
+    }
+
+    if (task) {
+        task.reset();
+        DTRACE("task deleted after stop()");
+    }
+    //=================================
+}
+
+bool TaskManager::set_task(Runnable* t)
+{
+#ifndef AGENTPP_SET_TASK_USE_TRY_LOCK
+    // FIXME: may deadlock when called from ThreadPool::execute()! CK
+    Lock l(*this);
+    if (!task) {
+        task     = Task(t);
+        queuedAt = Clock::now();
+        assigned.store(true, boost::memory_order_release);
+        l.notify();
+        DTRACE("after notify");
+        return true;
+    }
+#else
+    //=====================<<<
+    if (!task && try_lock()) {
+        if (task) {
+            DTRACE("Busy; too late!");
+            (void)unlock();
+            //=============>>>
+            return false;
+        }
+
+        task     = Task(t);
+        queuedAt = Clock::now();
+        assigned.store(true, boost::memory_order_release);
+        notify();
+        DTRACE("after notify");
+        (void)unlock();
+        //==================>>>
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+void TaskManager::assign(Task t, time_point queued)
+{
+    Lock l(*this);
+    BOOST_ASSERT(!task);
+    task     = std::move(t);
+    queuedAt = queued;
+    if (spinWait.mode == SpinWait::ADAPTIVE) {
+        assignedAt = Clock::now();
+    }
+    assigned.store(true, boost::memory_order_release);
+    l.notify(); // NOTE: cheap if the thread is still spinning! CK
+    DTRACE("after notify");
+}
+
+void TaskManager::spin_for_task()
+{
+    //=================================
+    unlock();
+
+    const time_point deadline = Clock::now() + ns(spinNanos);
+    for (unsigned i = 1; go && !assigned.load(boost::memory_order_acquire);
+         ++i) {
+        cpu_relax();
+        // NOTE: the clock is read only every 64th round! CK
+        if (!(i % 64) && Clock::now() >= deadline) {
+            break;
+        }
+    }
+
+    lock();
+    //=================================
+}
+
+void TaskManager::tune_spin(time_point idle_since)
+{
+    const long long gap =
+        boost::chrono::duration_cast<ns>(assignedAt - idle_since).count();
+    if (gap < 0) {
+        return; // NOTE: the first task was assigned before we started
+    }
+
+    // NOTE: exponential moving average over about 8 tasks! CK
+    const long long average = static_cast<long long>(averageGap);
+    averageGap = static_cast<unsigned long>(average + (gap - average) / 8);
+    spinNanos  = (2 * averageGap <= spinWait.nanoseconds) ? 2 * averageGap : 0;
+}
+
+/*-------------------- class ScheduledTask -------------------------*/
+
+/**
+ * The shared state of a delayed or periodic task. The timer of the next
+ * run holds it, so it lives until the last run or the cancelled timer
+ * and the last handle are gone.
+ */
+struct ScheduledTask::State {
+    /// NOTE: called with lock, sets the timer of the next run! CK
+    static void arm(const std::shared_ptr<State>& self)
+    {
+        std::shared_ptr<TimerService> service = self->timers.lock();
+        if (service) {
+            self->id = service->schedule_at(
+                self->due, [self]() { State::run(self); });
+        }
+    }
+
+    /// NOTE: runs on a thread of the pool! CK
+    static void run(const std::shared_ptr<State>& self)
+    {
+        {
+            boost::lock_guard<boost::mutex> l(self->lock);
+            if (self->cancelled) {
+                return;
+            }
+            self->started = true;
+        }
+
+        self->task(); // NOTE: an exception ends a periodic task too
+
+        if (self->period == TimerService::clock::duration::zero()) {
+            return;
+        }
+        boost::lock_guard<boost::mutex> l(self->lock);
+        if (!self->cancelled) {
+            self->due = self->fixedRate
+                ? self->due + self->period
+                : TimerService::clock::now() + self->period;
+            arm(self);
+        }
+    }
+
+    boost::mutex lock;
+    std::weak_ptr<TimerService> timers; // NOTE: owned by the pool
+    TimerService::TimerId id;
+    Task task;
+    TimerService::clock::duration period; // NOTE: zero if run once
+    TimerService::clock::time_point due;
+    bool fixedRate = true;
+    bool started   = false;
+    bool cancelled = false;
+};
+
+bool ScheduledTask::cancel()
+{
+    if (!state) {
+        return false;
+    }
+
+    std::shared_ptr<TimerService> service;
+    TimerService::TimerId id;
+    {
+        boost::lock_guard<boost::mutex> l(state->lock);
+        const bool once =
+            (state->period == TimerService::clock::duration::zero());
+        if (state->cancelled || (once && state->started)) {
+            return false;
+        }
+        state->cancelled = true;
+        service          = state->timers.lock();
+        id               = state->id;
+    }
+    if (service) {
+        (void)service->cancel(id); // NOTE: may have fired, run() skips it
+    }
+    return true;
+}
+
+bool ScheduledTask::is_cancelled() const
+{
+    if (!state) {
+        return false;
+    }
+    boost::lock_guard<boost::mutex> l(state->lock);
+    return state->cancelled;
+}
+
+/*--------------------- class ThreadPool --------------------------*/
+
+void ThreadPool::execute(Runnable* t) { execute(Task(t)); }
+
+void ThreadPool::execute(Task t)
+{
+    const time_point queued = Clock::now();
+    TaskManager* tm         = 0;
+    {
+        Lock l(*this);
+        DTRACE("");
+
+        while (go && idleList.empty() && !taskList.empty()
+            && taskList.size() >= maxSize) {
+            DTRACE("Busy! Synchronized::wait()");
+            l.wait(-1); // NOTE: forever until idle_notification() CK
+        }
+
+        if (!go) {
+            ++rejected;
+            return; // NOTE: terminated, nobody will run it! CK
+        }
+
+        if (!idleList.empty()) {
+            tm = idleList.back();
+            idleList.pop_back();
+        } else if (taskList.size() < maxSize) {
+            tm = add_task_manager(); // NOTE: a LAZY pool grows! CK
+        } else {
+            ++rejected;
+            return; // NOTE: no threads at all
+        }
+    }
+
+    // NOTE: without our lock, the TaskManager may still hold its lock
+    // while calling idle_notification()! CK
+    DTRACE("task manager found");
+    tm->assign(std::move(t), queued);
+}
+
+bool ThreadPool::try_execute(Task& t)
+{
+    const time_point queued = Clock::now();
+    TaskManager* tm         = 0;
+    {
+        Lock l(*this);
+        if (!go) {
+            return false;
+        }
+
+        if (!idleList.empty()) {
+            tm = idleList.back();
+            idleList.pop_back();
+        } else if (taskList.size() < maxSize) {
+            tm = add_task_manager(); // NOTE: a LAZY pool grows! CK
+        } else {
+            return false; // NOTE: busy, execute() would wait here
+        }
+    }
+
+    tm->assign(std::move(t), queued);
+    return true;
+}
+
+void ThreadPool::execute_bulk(Runnable** tasks, size_t n)
+{
+    const time_point queued = Clock::now();
+    std::vector<TaskManager*> batch;
+    size_t i = 0;
+    while (i < n) {
+        {
+            Lock l(*this);
+            DTRACE("");
+
+            while (go && idleList.empty() && !taskList.empty()
+                && taskList.size() >= maxSize) {
+                DTRACE("Busy! Synchronized::wait()");
+                l.wait(-1); // NOTE: forever until idle_notification() CK
+            }
+
+            if (!go || (idleList.empty() && taskList.size() >= maxSize)) {
+                rejected += n - i;
+                break; // NOTE: terminated, nobody will run them! CK
+            }
+
+            while ((i + batch.size() < n) && !idleList.empty()) {
+                batch.push_back(idleList.back());
+                idleList.pop_back();
+            }
+            while ((i + batch.size() < n) && taskList.size() < maxSize) {
+                batch.push_back(add_task_manager());
+            }
+        }
+
+        // NOTE: each assign() wakes up exactly one TaskManager! CK
+        for (size_t k = 0; k < batch.size(); k++) {
+            batch[k]->assign(Task(tasks[i++]), queued);
+        }
+        batch.clear();
+    }
+
+    for (; i < n; i++) {
+        delete tasks[i];
+    }
+}
+
+void ThreadPool::idle_notification(TaskManager* tm)
+{
+    Lock l(*this);
+    DTRACE("");
+    if (go) {
+        idleList.push_back(tm);
+        l.notify();
+    }
+}
+
+/// return true if NONE of the threads in the pool is currently executing any
+/// task.
+bool ThreadPool::is_idle()
+{
+    Lock l(*this);
+    return idleList.size() == taskList.size(); // NOTE: all threads are idle
+}
+
+/// return true if ALL of the threads in the pool is currently executing
+/// any task.
+bool ThreadPool::is_busy()
+{
+    Lock l(*this);
+    // NOTE: a LAZY pool may start another thread
+    return idleList.empty() && taskList.size() >= maxSize;
+}
+
+PoolMetrics ThreadPool::metrics()
+{
+    const time_point now = Clock::now();
+    PoolMetrics m;
+    Lock l(*this);
+    m.threads  = taskList.size();
+    m.idle     = idleList.size();
+    m.rejected = rejected;
+    for (size_t i = 0; i < taskList.size(); i++) {
+        m.workers.push_back(taskList[i]->metrics().add_to(m, now));
+    }
+    return m;
+}
+
+void ThreadPool::terminate()
+{
+    {
+        Lock l(*this);
+        DTRACE("");
+        go = false;
+        for (std::vector<std::unique_ptr<TaskManager> >::iterator cur =
+                 taskList.begin();
+             cur != taskList.end(); ++cur) {
+            (*cur)->stop();
+        }
+        idleList.clear();
+        l.notify_all(); // NOTE: for wait() at execute()
+    }
+
+    // NOTE: after go = false, try_execute() of the timer thread fails
+    stop_timers();
+}
+
+std::shared_ptr<TimerService> ThreadPool::timer_service()
+{
+    Lock l(*this);
+    if (!timers && !timersStopped) {
+        timers = std::make_shared<TimerService>(*this);
+    }
+    return timers;
+}
+
+void ThreadPool::stop_timers()
+{
+    std::shared_ptr<TimerService> stopped;
+    {
+        Lock l(*this);
+        timersStopped = true;
+        stopped.swap(timers);
+    }
+    if (stopped) {
+        stopped->stop(); // NOTE: without lock, it may be in try_execute()
+    }
+}
+
+ScheduledTask ThreadPool::execute_after(
+    TimerService::clock::duration delay, Runnable* task)
+{
+    return schedule(
+        delay, TimerService::clock::duration::zero(), Task(task), FIXED_RATE);
+}
+
+ScheduledTask ThreadPool::execute_after(
+    TimerService::clock::duration delay, Task task)
+{
+    return schedule(delay, TimerService::clock::duration::zero(),
+        std::move(task), FIXED_RATE);
+}
+
+ScheduledTask ThreadPool::execute_every(
+    TimerService::clock::duration period, Runnable* task, Schedule mode)
+{
+    return schedule(period, period, Task(task), mode);
+}
+
+ScheduledTask ThreadPool::execute_every(
+    TimerService::clock::duration period, Task task, Schedule mode)
+{
+    return schedule(period, period, std::move(task), mode);
+}
+
+ScheduledTask ThreadPool::schedule(TimerService::clock::duration delay,
+    TimerService::clock::duration period, Task task, Schedule mode)
+{
+    std::shared_ptr<ScheduledTask::State> state =
+        std::make_shared<ScheduledTask::State>();
+    state->timers    = timer_service();
+    state->task      = std::move(task);
+    state->period    = period;
+    state->due       = TimerService::clock::now() + delay;
+    state->fixedRate = (mode == FIXED_RATE);
+
+    boost::lock_guard<boost::mutex> l(state->lock);
+    ScheduledTask::State::arm(state);
+    return ScheduledTask(state);
+}
+
+ThreadPool::ThreadPool(size_t size)
+    : stackSize(AGENTPP_DEFAULT_STACKSIZE)
+    , maxSize(size)
+    , go(true)
+    , timersStopped(false)
+    , rejected(0)
+{
+    DTRACE("");
+    start(size, EAGER);
+}
+
+ThreadPool::ThreadPool(size_t size, size_t stack_size)
+    : stackSize(stack_size)
+    , maxSize(size)
+    , go(true)
+    , timersStopped(false)
+    , rejected(0)
+{
+    DTRACE("");
+    start(size, EAGER);
+}
+
+ThreadPool::ThreadPool(size_t size, size_t stack_size, const SpinWait& spin)
+    : stackSize(stack_size)
+    , spinWait(spin)
+    , maxSize(size)
+    , go(true)
+    , timersStopped(false)
+    , rejected(0)
+{
+    DTRACE("");
+    start(size, EAGER);
+}
+
+ThreadPool::ThreadPool(
+    size_t size, size_t stack_size, const SpinWait& spin, Startup startup)
+    : stackSize(stack_size)
+    , spinWait(spin)
+    , maxSize(size)
+    , go(true)
+    , timersStopped(false)
+    , rejected(0)
+{
+    DTRACE("");
+    start(size, startup);
+}
+
+namespace
+{
+
+// NOTE: a starter thread pays off only for a larger number of threads! CK
+const size_t threads_per_starter = 16;
+
+} // namespace
+
+void ThreadPool::start(size_t size, Startup startup)
+{
+    // NOTE: a LAZY pool must not reallocate while it grows! CK
+    taskList.reserve(size);
+    idleList.reserve(size);
+    if (startup == LAZY) {
+        return;
+    }
+
+    size_t starters = 1;
+    if (startup == PARALLEL) {
+        starters = std::min<size_t>(
+            (size + threads_per_starter - 1) / threads_per_starter,
+            std::max(1U, boost::thread::hardware_concurrency()));
+    }
+
+    taskList.resize(size);
+    auto start_task_managers = [this, size, starters](size_t first) {
+        for (size_t i = first; i < size; i += starters) {
+            taskList[i] = std::make_unique<TaskManager>(this, stackSize);
+        }
+    };
+
+    // NOTE: this thread is the first starter! CK
+    std::vector<boost::thread> threads;
+    for (size_t k = 1; k < starters; k++) {
+        threads.push_back(boost::thread(start_task_managers, k));
+    }
+    start_task_managers(0);
+    for (size_t k = 0; k < threads.size(); k++) {
+        threads[k].join();
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        if (taskList[i]->is_idle()) {
+            idleList.push_back(taskList[i].get());
+        }
+    }
+}
+
+/// NOTE: called with lock, the new TaskManager is not on the idle stack!
+TaskManager* ThreadPool::add_task_manager()
+{
+    taskList.push_back(std::make_unique<TaskManager>(this, stackSize));
+    return taskList.back().get();
+}
+
+ThreadPool::~ThreadPool()
+{
+    DTRACE("");
+
+    {
+        Lock l(*this);
+        go = false; // NOTE: no more idle_notification()s accepted! CK
+        idleList.clear();
+        l.notify_all();
+    }
+
+    // NOTE: after go = false, the timer thread hands no task over, see
+    // terminate()! CK
+    stop_timers();
+
+    //    terminate(); // FIXME: warning: Call to virtual function during
+    //    destruction
+    //
+    //    for (size_t i = 0; i < taskList.size(); i++) {
+    //        taskList[i].reset();
+    //    }
+}
+
+/*--------------------- class QueuedThreadPool --------------------------*/
+
+QueuedThreadPool::QueuedThreadPool(size_t size)
+    : QueuedThreadPool(PoolSizing(size))
+{ }
+
+QueuedThreadPool::QueuedThreadPool(size_t size, size_t stack_size)
+    : QueuedThreadPool(PoolSizing(size), stack_size)
+{ }
+
+QueuedThreadPool::QueuedThreadPool(const PoolSizing& s, size_t stack_size)
+    : ThreadPool(0, stack_size)
+    , Thread(this)
+    , sizing(s)
+    , go(true)
+    , idle(0)
+    , peak(0)
+    , lastPop(Clock::now())
+    , rejected(0)
+    , idleWaiters(0)
+    , pending(0)
+    , active(0)
+    , completed(0)
+{
+    DTRACE("");
+    if (!sizing.maxThreads) {
+        this->stop(); // warning: Call to virtual function during construction
+        return;
+    }
+
+    boost::lock_guard<boost::mutex> l(queueLock);
+    for (size_t i = 0; i < sizing.minThreads; i++) {
+        if (!start_worker()) {
+            break;
+        }
+    }
+    if (sizing.maxWait && sizing.maxThreads > sizing.minThreads) {
+        watchdog = boost::thread([this]() { watch(); });
+    }
+}
+
+QueuedThreadPool::~QueuedThreadPool()
+{
+    DTRACE("");
+    QueuedThreadPool::terminate();
+    ThreadPool::terminate(); // FIXME: Call to virtual function during
+                             // destruction
+}
+
+/// NOTE: called with the queue lock, a new thread counts as idle! CK
+bool QueuedThreadPool::start_worker()
+{
+    workers.emplace_back();
+    const WorkerList::iterator self = std::prev(workers.end());
+    try {
+        boost::thread::attributes attrs;
+#ifdef POSIX_THREADS
+        attrs.set_stack_size(stackSize);
+#endif
+        const boost::thread::attributes& a = attrs; // NOTE: not a callable
+        *self = boost::thread(a, [this, self]() { work(self); });
+    } catch (boost::thread_resource_error& e) {
+        DTRACE("Error: cannot start thread: " << e.what());
+        workers.erase(self);
+        return false;
+    }
+    ++idle;
+    peak = std::max(peak, workers.size());
+    return true;
+}
+
+/// @return the number of queued tasks which no idle thread will take
+size_t QueuedThreadPool::backlog() const
+{
+    // NOTE: called with the queue lock, each idle thread takes one! CK
+    return (queue.size() > idle) ? queue.size() - idle : 0;
+}
+
+/// NOTE: called with the queue lock! CK
+bool QueuedThreadPool::must_grow() const
+{
+    if (workers.size() >= sizing.maxThreads) {
+        return false;
+    }
+
+    const size_t waiting = backlog();
+    if (waiting > sizing.queueThreshold) {
+        return true;
+    }
+    return waiting > 0 && sizing.maxWait > 0
+        && Clock::now() - lastPop >= ms(sizing.maxWait);
+}
+
+/// NOTE: grows the pool if the queue is not served for maxWait ms! CK
+void QueuedThreadPool::watch()
+{
+    boost::unique_lock<boost::mutex> l(queueLock);
+    while (go) {
+        if (must_grow()) {
+            if (!start_worker()) {
+                stateChanged.wait_for(l, ms(sizing.maxWait));
+            }
+        } else if (backlog() > 0 && workers.size() < sizing.maxThreads) {
+            stateChanged.wait_until(l, lastPop + ms(sizing.maxWait));
+        } else {
+            stateChanged.wait(l); // NOTE: until execute() or stop()
+        }
+    }
+}
+
+void QueuedThreadPool::work(WorkerList::iterator self)
+{
+    std::vector<boost::thread> joinable;
+    std::unique_ptr<WorkerMetrics> meter(new WorkerMetrics());
+    boost::unique_lock<boost::mutex> l(queueLock);
+    meters.push_back(meter.get());
+
+    for (;;) {
+        // NOTE: an idle thread above the minimal size may time out! CK
+        const time_point deadline = Clock::now() + ms(sizing.keepAlive);
+        bool timedOut             = false;
+        while (go && queue.empty() && !timedOut) {
+            if (sizing.keepAlive && workers.size() > sizing.minThreads) {
+                timedOut = (notEmpty.wait_until(l, deadline)
+                               == boost::cv_status::timeout)
+                    && queue.empty() && workers.size() > sizing.minThreads;
+            } else {
+                notEmpty.wait(l);
+            }
         }
+        --idle;
 
-        task = t;
-        notify();
-        DTRACE("after notify");
-        (void)unlock();
-        //==================>>>
-        return true;
+        if (queue.empty()) {
+            break; // NOTE: stopped and drained, or timed out
+        }
+
+        Queued next = std::move(queue.front());
+        queue.pop_front();
+        // NOTE: a reader which sees the smaller queue sees the task
+        // running! CK
+        active.store(active.load(boost::memory_order_relaxed) + 1,
+            boost::memory_order_relaxed);
+        pending.store(queue.size(), boost::memory_order_release);
+        if (sizing.maxWait) {
+            lastPop = Clock::now();
+        }
+        l.unlock();
+
+        const time_point started = Clock::now();
+        try {
+            next.task();
+        } catch (std::exception& e) {
+            DTRACE(e.what());
+        } catch (...) {
+            // TODO: log ... but ignored! CK
+        }
+        meter->record(next.queuedAt, started, Clock::now());
+        next.task.reset(); // NOTE: a Runnable is deleted without lock
+
+        l.lock();
+        ++idle;
+        completed.store(completed.load(boost::memory_order_relaxed) + 1,
+            boost::memory_order_relaxed);
+        active.store(active.load(boost::memory_order_relaxed) - 1,
+            boost::memory_order_release);
+        if (idleWaiters && queue.empty()
+            && !active.load(boost::memory_order_relaxed)) {
+            stateChanged.notify_all(); // see wait_idle()
+        }
     }
-#endif
 
-    return false;
+    (void)meter->add_to(retired, Clock::now());
+    meters.remove(meter.get());
+
+    // NOTE: a thread cannot join itself, the next one joins it! CK
+    joinable.swap(exited);
+    exited.push_back(std::move(*self));
+    workers.erase(self);
+    if (workers.empty()) {
+        stateChanged.notify_all(); // see terminate()
+    }
+    l.unlock();
+
+    for (size_t i = 0; i < joinable.size(); i++) {
+        joinable[i].join();
+    }
 }
 
-/*--------------------- class ThreadPool --------------------------*/
+void QueuedThreadPool::execute(Runnable* t) { execute(Task(t)); }
 
-void ThreadPool::execute(Runnable* t)
+void QueuedThreadPool::execute(Task t)
+{
+    if (!try_execute(t)) {
+        boost::lock_guard<boost::mutex> l(queueLock);
+        ++rejected; // NOTE: the Task is deleted! CK
+    }
+}
+
+bool QueuedThreadPool::try_execute(Task& t)
 {
-    Lock l(*this);
     DTRACE("");
+    const time_point now = Clock::now();
+    std::vector<boost::thread> joinable;
+    {
+        boost::lock_guard<boost::mutex> l(queueLock);
+        if (!go) {
+            return false;
+        }
 
-    for (;;) {
-        for (std::vector<std::unique_ptr<TaskManager> >::iterator cur =
-                 taskList.begin();
-             cur != taskList.end(); ++cur) {
-            if ((*cur)->is_idle()) {
-                DTRACE("task manager found");
-                if ((*cur)->set_task(t)) {
-                    return; // done
-                }
+        if (queue.empty() && sizing.maxWait) {
+            lastPop = now; // NOTE: the queue was served so far
+        }
+        depth.record(queue.size());
+        queue.push_back(Queued(std::move(t), now));
+        pending.store(queue.size(), boost::memory_order_release);
+        if (idle) {
+            notEmpty.notify_one();
+        }
+        if (must_grow()) {
+            (void)start_worker();
+        } else if (sizing.maxWait && backlog() == 1) {
+            stateChanged.notify_all(); // NOTE: the watchdog is needed now
+        }
+        joinable.swap(exited);
+    }
+
+    for (size_t i = 0; i < joinable.size(); i++) {
+        joinable[i].join();
+    }
+    return true;
+}
+
+void QueuedThreadPool::execute_bulk(Runnable** tasks, size_t n)
+{
+    DTRACE("");
+    const time_point now = Clock::now();
+    std::vector<boost::thread> joinable;
+    {
+        boost::lock_guard<boost::mutex> l(queueLock);
+        if (!go) {
+            for (size_t i = 0; i < n; i++) {
+                delete tasks[i];
             }
+            rejected += n;
+            return;
+        }
+
+        if (queue.empty() && sizing.maxWait) {
+            lastPop = now;
+        }
+        depth.record(queue.size());
+        for (size_t i = 0; i < n; i++) {
+            queue.push_back(Queued(Task(tasks[i]), now));
+        }
+        pending.store(queue.size(), boost::memory_order_release);
+        // NOTE: only one thread is needed for one task! CK
+        for (size_t i = 0; i < n && i < idle; i++) {
+            notEmpty.notify_one();
         }
-        DTRACE("Busy! Synchronized::wait()");
-        wait_for(rand() % 113); // wait_for(ms)
-        // TODO wait(); // NOTE: forever until idle_notification() CK
+        while (must_grow() && start_worker()) { }
+        if (sizing.maxWait && backlog() > 0) {
+            stateChanged.notify_all();
+        }
+        joinable.swap(exited);
+    }
+
+    for (size_t i = 0; i < joinable.size(); i++) {
+        joinable[i].join();
     }
 }
 
-void ThreadPool::idle_notification()
+#if 0
+void QueuedThreadPool::run()
 {
-    Lock l(*this);
     DTRACE("");
-    l.notify();
+    while (go) {
+        ThreadPool::wait();
+
+        if (!go)
+            break;
+    }
 }
+#endif
 
-/// return true if NONE of the threads in the pool is currently executing any
-/// task.
-bool ThreadPool::is_idle()
+size_t QueuedThreadPool::queue_length() const
 {
-    Lock l(*this);
-    for (std::vector<std::unique_ptr<TaskManager> >::iterator cur =
-             taskList.begin();
-         cur != taskList.end(); ++cur) {
-        if (!(*cur)->is_idle()) {
-            return false;
+    return pending.load(boost::memory_order_relaxed);
+}
+
+size_t QueuedThreadPool::active_count() const
+{
+    return active.load(boost::memory_order_relaxed);
+}
+
+boost::uint64_t QueuedThreadPool::completed_count() const
+{
+    return completed.load(boost::memory_order_relaxed);
+}
+
+bool QueuedThreadPool::wait_idle(unsigned long timeout)
+{
+    const time_point deadline = Clock::now() + ms(timeout);
+    boost::unique_lock<boost::mutex> l(queueLock);
+    ++idleWaiters;
+    while (go && sizing.maxThreads
+        && (!queue.empty() || active.load(boost::memory_order_relaxed))) {
+        if (!timeout) {
+            stateChanged.wait(l); // NOTE: until idle or stop()
+        } else if (stateChanged.wait_until(l, deadline)
+            == boost::cv_status::timeout) {
+            break;
         }
     }
-    return true; // NOTE: all threads are idle
+    --idleWaiters;
+    return !sizing.maxThreads
+        || (go && queue.empty() && !active.load(boost::memory_order_relaxed));
 }
 
-/// return true if ALL of the threads in the pool is currently executing
-/// any task.
-bool ThreadPool::is_busy()
+void QueuedThreadPool::idle_notification(TaskManager* /*tm*/) { }
+
+// NOTE: the queue is read before the running tasks, see work()! CK
+bool QueuedThreadPool::is_idle()
 {
-    Lock l(*this);
-    for (std::vector<std::unique_ptr<TaskManager> >::iterator cur =
-             taskList.begin();
-         cur != taskList.end(); ++cur) {
-        if ((*cur)->is_idle()) {
-            return false;
+    return !sizing.maxThreads
+        || (go && !pending.load(boost::memory_order_acquire)
+            && !active.load(boost::memory_order_acquire));
+}
+
+bool QueuedThreadPool::is_busy()
+{
+    return !go || active.load(boost::memory_order_acquire) >= sizing.maxThreads;
+}
+
+PoolMetrics QueuedThreadPool::metrics()
+{
+    const time_point now = Clock::now();
+    boost::lock_guard<boost::mutex> l(queueLock);
+    PoolMetrics m  = retired; // NOTE: without workers
+    m.threads      = workers.size();
+    m.idle         = idle;
+    m.queue_length = queue.size();
+    m.rejected     = rejected;
+    m.queue_depth  = depth;
+    for (std::list<const WorkerMetrics*>::const_iterator it = meters.begin();
+         it != meters.end(); ++it) {
+        m.workers.push_back((*it)->add_to(m, now));
+    }
+    return m;
+}
+
+size_t QueuedThreadPool::size() const
+{
+    boost::lock_guard<boost::mutex> l(queueLock);
+    return workers.size();
+}
+
+size_t QueuedThreadPool::peak_size() const
+{
+    boost::lock_guard<boost::mutex> l(queueLock);
+    return peak;
+}
+
+void QueuedThreadPool::terminate()
+{
+    this->stop();
+    stop_timers(); // NOTE: execute() does not block, the queue is closed
+
+    std::vector<boost::thread> joinable;
+    {
+        boost::unique_lock<boost::mutex> l(queueLock);
+        while (!workers.empty()) {
+            stateChanged.wait(l); // NOTE: the queued tasks are done first
         }
+        joinable.swap(exited);
+    }
+
+    for (size_t i = 0; i < joinable.size(); i++) {
+        joinable[i].join();
+    }
+    if (watchdog.joinable()) {
+        watchdog.join();
     }
-    return true; // NOTE: all threads are busy
 }
 
-void ThreadPool::terminate()
+void QueuedThreadPool::stop()
 {
-    Lock l(*this);
     DTRACE("");
-    for (std::vector<std::unique_ptr<TaskManager> >::iterator cur =
-             taskList.begin();
-         cur != taskList.end(); ++cur) {
-        (*cur)->stop();
+    boost::lock_guard<boost::mutex> l(queueLock);
+    go = false;
+    notEmpty.notify_all();
+    stateChanged.notify_all();
+}
+
+/*----------------------- class TaskGroup --------------------------*/
+
+struct TaskGroup::State {
+    State()
+        : unfinished(0)
+        , waiters(0)
+    { }
+
+    /// @return false if no callable is left to take
+    bool run_one(bool newest);
+
+    boost::mutex lock;
+    boost::condition_variable changed; // NOTE: run() or all finished
+    std::deque<Task> tasks;            // not yet taken
+    size_t unfinished;                 // added by run(), not yet finished
+    size_t waiters;                    // threads in wait()
+    std::exception_ptr error; // NOTE: the first one only
+};
+
+bool TaskGroup::State::run_one(bool newest)
+{
+    Task task;
+    {
+        boost::lock_guard<boost::mutex> l(lock);
+        if (tasks.empty()) {
+            return false;
+        }
+        if (newest) {
+            task = std::move(tasks.back());
+            tasks.pop_back();
+        } else {
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+    }
+
+    std::exception_ptr e;
+    try {
+        task();
+    } catch (...) {
+        e = std::current_exception();
+    }
+    task.reset(); // NOTE: before the waiter may return! CK
+
+    boost::lock_guard<boost::mutex> l(lock);
+    if (e && !error) {
+        error = e;
     }
-    l.notify_all(); // NOTE: for wait() at execute()
+    if (!--unfinished && waiters) {
+        changed.notify_all();
+    }
+    return true;
 }
 
-ThreadPool::ThreadPool(size_t size)
-    : stackSize(AGENTPP_DEFAULT_STACKSIZE)
+TaskGroup::TaskGroup(ThreadPool& tp)
+    : pool(tp)
+    , state(std::make_shared<State>())
+{ }
+
+TaskGroup::~TaskGroup()
 {
-    DTRACE("");
+    try {
+        wait();
+    } catch (...) {
+        // NOTE: ignored, see wait()! CK
+    }
+}
 
-    for (size_t i = 0; i < size; i++) {
-        taskList.push_back(std::make_unique<TaskManager>(this));
-        // TODO
-        // taskList.push_back(std::make_unique<TaskManager>(shared_from_this()));
+void TaskGroup::run(Task task)
+{
+    {
+        boost::lock_guard<boost::mutex> l(state->lock);
+        state->tasks.push_back(std::move(task));
+        ++state->unfinished;
+        if (state->waiters) {
+            state->changed.notify_all(); // NOTE: wait() may help again
+        }
     }
+
+    // NOTE: the oldest callable is taken, the largest of a recursion! CK
+    std::shared_ptr<State> s = state;
+    Task runner([s]() { (void)s->run_one(false); });
+    (void)pool.try_execute(runner); // NOTE: else run by wait()
 }
 
-ThreadPool::ThreadPool(size_t size, size_t stack_size)
-    : stackSize(stack_size)
+void TaskGroup::wait()
 {
-    DTRACE("");
+    for (;;) {
+        while (state->run_one(true)) { }
 
-    for (size_t i = 0; i < size; i++) {
-        taskList.push_back(std::make_unique<TaskManager>(this, stackSize));
-        // TODO std::make_unique<TaskManager>(shared_from_this(), stackSize));
+        boost::unique_lock<boost::mutex> l(state->lock);
+        ++state->waiters;
+        while (state->unfinished && state->tasks.empty()) {
+            state->changed.wait(l); // NOTE: until run() or finished
+        }
+        --state->waiters;
+        if (!state->unfinished) {
+            break;
+        }
+    }
+
+    std::exception_ptr e;
+    {
+        boost::lock_guard<boost::mutex> l(state->lock);
+        e.swap(state->error);
+    }
+    if (e) {
+        std::rethrow_exception(e);
     }
 }
 
-ThreadPool::~ThreadPool()
+/*--------------------- class TimerService -------------------------*/
+
+struct TimerService::Node : TimerService::Link {
+    Task task;
+    boost::uint64_t expires; // the tick
+    boost::uint64_t generation;
+    unsigned level; // NOTE: LEVELS if not linked
+};
+
+TimerService::TimerService(ThreadPool& tp, clock::duration t)
+    : pool(tp)
+    , tick(t > clock::duration::zero() ? t : clock::duration(1))
+    , origin(clock::now())
+    , current(0)
+    , wakeup(~boost::uint64_t(0))
+    , freeList(nullptr)
+    , go(true)
 {
-    DTRACE("");
+    for (unsigned level = 0; level < LEVELS; level++) {
+        counts[level] = 0;
+        for (unsigned slot = 0; slot < SLOTS; slot++) {
+            wheel[level][slot].prev = &wheel[level][slot];
+            wheel[level][slot].next = &wheel[level][slot];
+        }
+    }
 
-    //    terminate(); // FIXME: warning: Call to virtual function during
-    //    destruction
-    //
-    //    for (size_t i = 0; i < taskList.size(); i++) {
-    //        taskList[i].reset();
-    //    }
+    // NOTE: started last, the wheel must be ready! CK
+    expiry = boost::thread([this]() { expire(); });
 }
 
-/*--------------------- class QueuedThreadPool --------------------------*/
+TimerService::~TimerService() { stop(); }
 
-QueuedThreadPool::QueuedThreadPool(size_t size)
-    : ThreadPool(0)
-    , Thread(this)
-    , _size(size)
-    , go(true)
+void TimerService::stop()
 {
-    DTRACE("");
-    if (!_size) {
-        this->stop(); // warning: Call to virtual function during construction
-    } else {
-        ea = std::make_unique<boost::basic_thread_pool>(_size);
+    {
+        boost::lock_guard<boost::mutex> l(lock);
+        go = false;
+        changed.notify_all();
+    }
+    if (expiry.joinable()) {
+        expiry.join();
     }
 }
 
-QueuedThreadPool::QueuedThreadPool(size_t size, size_t stack_size)
-    : ThreadPool(0, stack_size)
-    , Thread(this)
-    , _size(size)
-    , go(true)
+/// @return the first tick at or after the given time
+boost::uint64_t TimerService::tick_of(clock::time_point when) const
 {
-    DTRACE("");
-    if (!_size) {
-        this->stop(); // warning: Call to virtual function during construction
-    } else {
-        ea = std::make_unique<boost::basic_thread_pool>(_size);
+    if (when <= origin) {
+        return 0;
     }
+    const clock::duration::rep elapsed = (when - origin).count();
+    return static_cast<boost::uint64_t>(
+        (elapsed + tick.count() - 1) / tick.count());
 }
 
-QueuedThreadPool::~QueuedThreadPool()
+TimerService::TimerId TimerService::schedule_at(
+    clock::time_point when, Task task)
 {
-    DTRACE("");
-    this->stop();
-    ThreadPool::terminate(); // FIXME: Call to virtual function during
-                             // destruction
+    TimerId id;
+    const boost::uint64_t expires = tick_of(when);
+
+    boost::lock_guard<boost::mutex> l(lock);
+    if (!go) {
+        return id; // NOTE: the task is destroyed, not run! CK
+    }
+
+    Node* node    = make_node();
+    node->task    = std::move(task);
+    node->expires = expires;
+    link(node);
+    id.node       = node;
+    id.generation = node->generation;
+
+    if (expires < wakeup) {
+        wakeup = expires;
+        changed.notify_one(); // NOTE: only if it must wake up earlier
+    }
+    return id;
 }
 
-#if 0
-bool QueuedThreadPool::assign(Runnable* task, bool withQueuing)
+bool TimerService::cancel(TimerId id)
 {
-    DTRACE("");
+    if (!id.node) {
+        return false;
+    }
+
+    Task victim; // NOTE: destroyed without lock
+    {
+        boost::lock_guard<boost::mutex> l(lock);
+        Node* node = static_cast<Node*>(id.node);
+        if (node->generation != id.generation || node->level == LEVELS) {
+            return false; // NOTE: fired or cancelled already! CK
+        }
+        unlink(node);
+        victim = std::move(node->task);
+        recycle(node);
+    }
     return true;
 }
-#endif
 
-void QueuedThreadPool::execute(Runnable* t)
+size_t TimerService::pending() const
 {
-    DTRACE("");
-    std::shared_ptr<Runnable> ptr_t(t);
-    if (ea && !ea->closed()) {
-        boost::future<void> t1 =
-            boost::async(*ea, (boost::bind(&Runnable::run, ptr_t)));
+    boost::lock_guard<boost::mutex> l(lock);
+    size_t n = 0;
+    for (unsigned level = 0; level < LEVELS; level++) {
+        n += counts[level];
     }
+    return n;
 }
 
-#if 0
-void QueuedThreadPool::run()
+/// NOTE: called with lock! CK
+TimerService::Node* TimerService::make_node()
 {
-    DTRACE("");
-    while (go) {
-        ThreadPool::wait();
-
-        if (!go)
-            break;
+    if (freeList) {
+        Node* node = freeList;
+        freeList   = static_cast<Node*>(node->next);
+        return node;
     }
+    nodes.push_back(std::make_unique<Node>());
+    Node* node       = nodes.back().get();
+    node->generation = 0;
+    node->level      = LEVELS;
+    return node;
+}
+
+/// NOTE: called with lock, the node is reused with a new generation! CK
+void TimerService::recycle(Node* node)
+{
+    node->generation++;
+    node->next = freeList;
+    freeList   = node;
 }
-#endif
 
-size_t QueuedThreadPool::queue_length() { return (is_busy() ? 1 : 0); }
+/// NOTE: called with lock, links the node relative to the current tick
+void TimerService::link(Node* node)
+{
+    // NOTE: a timer in the past expires with the current tick! CK
+    boost::uint64_t expires =
+        (node->expires > current) ? node->expires : current;
+    const boost::uint64_t delta = expires - current;
+
+    unsigned level = 0;
+    while (level + 1 < LEVELS
+        && delta >= (boost::uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    const boost::uint64_t span = boost::uint64_t(1)
+        << (SLOT_BITS * LEVELS);
+    if (delta >= span) {
+        expires = current + span - 1; // NOTE: linked again later
+    }
 
-void QueuedThreadPool::idle_notification() { }
+    Link& head =
+        wheel[level][(expires >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    node->prev       = head.prev;
+    node->next       = &head;
+    head.prev->next  = node;
+    head.prev        = node;
+    node->level      = level;
+    counts[level]++;
+}
 
-bool QueuedThreadPool::is_idle()
+/// NOTE: called with lock! CK
+void TimerService::unlink(Node* node)
 {
-    return !_size || (ea && (!ea->closed() && !ea->try_executing_one()));
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    counts[node->level]--;
+    node->level = LEVELS;
 }
 
-bool QueuedThreadPool::is_busy()
+/// NOTE: called with lock, moves the timers of the current slot of the
+/// given level one level down! CK
+void TimerService::cascade(unsigned level)
+{
+    Link& head =
+        wheel[level][(current >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    while (head.next != &head) {
+        Node* node = static_cast<Node*>(head.next);
+        unlink(node);
+        link(node);
+    }
+}
+
+/// NOTE: called with lock, expires all ticks up to target! CK
+void TimerService::advance(boost::uint64_t target, std::vector<Task>& due)
 {
-    return !_size || (ea && (ea->closed() || ea->try_executing_one()));
+    while (current <= target) {
+        unsigned lowest = 0;
+        while (lowest < LEVELS && !counts[lowest]) {
+            lowest++;
+        }
+        if (lowest == LEVELS) {
+            current = target + 1; // NOTE: no timer at all
+            break;
+        }
+
+        // NOTE: skip the ticks until the lowest used level cascades! CK
+        const boost::uint64_t mask =
+            (boost::uint64_t(1) << (SLOT_BITS * lowest)) - 1;
+        if (current & mask) {
+            const boost::uint64_t next = (current | mask) + 1;
+            if (next > target) {
+                current = target + 1;
+                break;
+            }
+            current = next;
+            continue;
+        }
+
+        for (unsigned level = 1; level < LEVELS
+             && !(current & ((boost::uint64_t(1) << (SLOT_BITS * level)) - 1));
+             level++) {
+            cascade(level);
+        }
+
+        Link& head = wheel[0][current & (SLOTS - 1)];
+        while (head.next != &head) {
+            Node* node = static_cast<Node*>(head.next);
+            unlink(node);
+            due.push_back(std::move(node->task));
+            recycle(node);
+        }
+        current++;
+    }
 }
 
-void QueuedThreadPool::terminate() { this->stop(); }
+/// NOTE: called with lock, @return the next tick to wake up at
+boost::uint64_t TimerService::next_wakeup() const
+{
+    unsigned lowest = 0;
+    while (lowest < LEVELS && !counts[lowest]) {
+        lowest++;
+    }
+    if (lowest == LEVELS) {
+        return ~boost::uint64_t(0); // NOTE: until schedule_at()
+    }
+
+    if (lowest == 0) {
+        // NOTE: all timers of level 0 expire within the next SLOTS ticks
+        for (boost::uint64_t t = current; t < current + SLOTS; t++) {
+            const Link& head = wheel[0][t & (SLOTS - 1)];
+            if (head.next != &head) {
+                return t;
+            }
+        }
+    }
+
+    const boost::uint64_t mask =
+        (boost::uint64_t(1) << (SLOT_BITS * lowest)) - 1;
+    return (current & mask) ? (current | mask) + 1 : current;
+}
 
-void QueuedThreadPool::stop()
+void TimerService::expire()
 {
-    DTRACE("");
-    go = false;
-    if (ea) {
-        ea->close();
+    std::vector<Task> due; // NOTE: the earliest first
+    boost::unique_lock<boost::mutex> l(lock);
+    while (go) {
+        const boost::uint64_t now =
+            static_cast<boost::uint64_t>((clock::now() - origin) / tick);
+        advance(now, due);
+        wakeup = next_wakeup();
+
+        if (!due.empty()) {
+            // NOTE: try_execute() never blocks, the Tasks which a busy
+            // pool does not take are kept for the next tick! CK
+            l.unlock();
+            size_t taken = 0;
+            while (taken < due.size() && pool.try_execute(due[taken])) {
+                taken++;
+            }
+            due.erase(due.begin(), due.begin() + static_cast<long>(taken));
+            l.lock();
+            if (due.empty()) {
+                continue;
+            }
+            wakeup = std::min(wakeup, current);
+        }
+
+        if (wakeup == ~boost::uint64_t(0)) {
+            changed.wait(l);
+        } else {
+            (void)changed.wait_until(
+                l, origin + tick * static_cast<clock::duration::rep>(wakeup));
+        }
     }
 }
 
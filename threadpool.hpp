@@ -38,9 +38,21 @@ clang-format -i -style=file threadpool.{cpp,hpp}
 #    include <pthread.h>
 #endif
 
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
 #include <list>
 #include <memory>
+#include <new>
+#include <numeric>
 #include <queue>
+#include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #define BOOST_SYSTEM_NO_DEPRECATED
@@ -52,10 +64,11 @@ clang-format -i -style=file threadpool.{cpp,hpp}
 #define BOOST_CHRONO_DONT_PROVIDE_HYBRID_ERROR_HANDLING 1
 
 #include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/core/noncopyable.hpp>
 #include <boost/function.hpp>
+#include <boost/lockfree/stack.hpp>
 #include <boost/thread/condition_variable.hpp>
-#include <boost/thread/executors/basic_thread_pool.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread_only.hpp>
@@ -98,7 +111,63 @@ using enable_shared_from_this = std::enable_shared_from_this<T>;
 #undef AGENTPP_USE_YIELD
 #undef CREATE_RACE_CONDITION
 
+// NOTE: on Linux Synchronized is a futex based monitor! CK
+#if defined(__linux__) && !defined(AGENTPP_NO_FUTEX)
+#    define AGENTPP_USE_FUTEX
+#endif
+
 #define AGENTPP_DEFAULT_STACKSIZE 0x10000UL
+
+// NOTE: the per thread state is aligned to this size! CK
+#ifndef AGENTPP_CACHE_LINE_SIZE
+#    define AGENTPP_CACHE_LINE_SIZE 64
+#endif
+
+// NOTE: the default limit of the spin phase of an idle TaskManager! CK
+#ifndef AGENTPP_SPIN_WAIT_NS
+#    define AGENTPP_SPIN_WAIT_NS 50000UL
+#endif
+
+// NOTE: callables up to this size are stored inline in a Task! CK
+#ifndef AGENTPP_TASK_INLINE_SIZE
+#    define AGENTPP_TASK_INLINE_SIZE 48
+#endif
+
+// NOTE: the TaskAllocator recycles objects up to this size! CK
+#ifndef AGENTPP_TASK_ALLOCATOR_MAX_SIZE
+#    define AGENTPP_TASK_ALLOCATOR_MAX_SIZE 256
+#endif
+
+// NOTE: the number of blocks moved at once to or from the depot! CK
+#ifndef AGENTPP_TASK_ALLOCATOR_BATCH
+#    define AGENTPP_TASK_ALLOCATOR_BATCH 32
+#endif
+
+// NOTE: the number of freed Future states kept for reuse per size! CK
+#ifndef AGENTPP_FUTURE_POOL_SIZE
+#    define AGENTPP_FUTURE_POOL_SIZE 256
+#endif
+
+// NOTE: an idle thread above the minimal pool size exits after this! CK
+#ifndef AGENTPP_KEEP_ALIVE_MS
+#    define AGENTPP_KEEP_ALIVE_MS 60000UL
+#endif
+
+// NOTE: the default resolution of the TimerService! CK
+#ifndef AGENTPP_TIMER_TICK_US
+#    define AGENTPP_TIMER_TICK_US 1000UL
+#endif
+
+// NOTE: a parallel algorithm does not split a range below this size! CK
+#ifndef AGENTPP_PARALLEL_CUTOFF_BYTES
+#    define AGENTPP_PARALLEL_CUTOFF_BYTES 0x8000UL
+#endif
+
+// NOTE: parallel_sort() sorts runs of this size sequentially, about
+// the size of a L2 cache! CK
+#ifndef AGENTPP_SORT_CUTOFF_BYTES
+#    define AGENTPP_SORT_CUTOFF_BYTES 0x40000UL
+#endif
 #define AGENTX_DEFAULT_PRIORITY 32
 #define AGENTX_DEFAULT_THREAD_NAME "ThreadPool::Thread"
 
@@ -178,10 +247,525 @@ public:
     void operator()() { run(); };
 };
 
+/**
+ * The TaskAllocator class recycles the memory of small task objects
+ * without the global allocator. Each thread keeps a free list per size
+ * class (multiples of 16 bytes up to AGENTPP_TASK_ALLOCATOR_MAX_SIZE).
+ * A thread which frees more blocks than it allocates (i.e., a worker)
+ * moves them in batches of AGENTPP_TASK_ALLOCATOR_BATCH to a global
+ * depot, where a thread with an empty free list (i.e., a submitter)
+ * takes them from. Larger objects are passed to the global allocator.
+ */
+class AGENTPP_DECL TaskAllocator {
+public:
+    /**
+     * The counters of all threads (still running or not).
+     */
+    struct Statistics {
+        size_t allocations;      ///< all calls of allocate()
+        size_t deallocations;    ///< all calls of deallocate()
+        size_t cache_hits;       ///< allocations from the own free list
+        size_t depot_transfers;  ///< batches moved from or to the depot
+        size_t heap_allocations; ///< blocks taken from the global allocator
+    };
+
+    static void* allocate(std::size_t size);
+    static void deallocate(void* block, std::size_t size) noexcept;
+
+    static Statistics statistics();
+};
+
+/**
+ * The PooledRunnable class is a Runnable whose instances are allocated
+ * by the TaskAllocator. Task classes which are created and deleted at a
+ * high rate should be derived from it instead of Runnable.
+ */
+class AGENTPP_DECL PooledRunnable : public Runnable {
+public:
+    static void* operator new(std::size_t size)
+    {
+        return TaskAllocator::allocate(size);
+    }
+    static void operator delete(void* block, std::size_t size) noexcept
+    {
+        TaskAllocator::deallocate(block, size);
+    }
+};
+
+/**
+ * The Task class holds any callable object (i.e., a lambda or function
+ * object with an operator()()) to be executed by a ThreadPool. Callables
+ * of up to AGENTPP_TASK_INLINE_SIZE bytes with a noexcept move
+ * constructor are stored inline, so a Task costs no heap allocation.
+ * Larger callables are moved to the heap.
+ *
+ * A Task is move-only. A Task made of a Runnable* owns it and deletes it
+ * when the Task is destroyed.
+ */
+class AGENTPP_DECL Task {
+public:
+    Task() noexcept
+        : ops(nullptr)
+    { }
+
+    template <class F,
+        class = std::enable_if_t<!std::is_same<std::decay_t<F>, Task>::value
+            && !std::is_pointer<std::decay_t<F> >::value>,
+        class = decltype(std::declval<std::decay_t<F>&>()())>
+    Task(F&& f) // NOLINT: implicit conversion of lambdas is intended! CK
+        : ops(nullptr)
+    {
+        typedef std::decay_t<F> Callable;
+        if (fits_inline<Callable>()) {
+            ::new (static_cast<void*>(storage)) Callable(std::forward<F>(f));
+            ops = &InlineOps<Callable>::table;
+        } else {
+            ::new (static_cast<void*>(storage))
+                Callable*(new Callable(std::forward<F>(f)));
+            ops = &HeapOps<Callable>::table;
+        }
+    }
+
+    /**
+     * Take over a Runnable, it is deleted with this Task.
+     */
+    explicit Task(Runnable* r) noexcept
+        : ops(nullptr)
+    {
+        if (r) {
+            ::new (static_cast<void*>(storage)) Runnable*(r);
+            ops = &runnable_ops;
+        }
+    }
+
+    Task(Task&& other) noexcept
+        : ops(other.ops)
+    {
+        if (ops) {
+            ops->move(storage, other.storage);
+            other.ops = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            if (other.ops) {
+                other.ops->move(storage, other.storage);
+                ops       = other.ops;
+                other.ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    ~Task() { reset(); }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    /**
+     * Run the callable, asserted not to be empty.
+     */
+    void operator()() { ops->invoke(storage); }
+
+    explicit operator bool() const noexcept { return ops != nullptr; }
+
+    /**
+     * Destroy the callable, this Task is empty thereafter.
+     */
+    void reset() noexcept
+    {
+        if (ops) {
+            ops->destroy(storage);
+            ops = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void*);
+        void (*move)(void* dst, void* src) noexcept;
+        void (*destroy)(void*) noexcept;
+    };
+
+    template <class F> static constexpr bool fits_inline()
+    {
+        return sizeof(F) <= AGENTPP_TASK_INLINE_SIZE
+            && alignof(F) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<F>::value;
+    }
+
+    template <class F> struct InlineOps {
+        static void invoke(void* p) { (*static_cast<F*>(p))(); }
+        static void move(void* dst, void* src) noexcept
+        {
+            ::new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* p) noexcept { static_cast<F*>(p)->~F(); }
+        static const Ops table;
+    };
+
+    template <class F> struct HeapOps {
+        static void invoke(void* p) { (**static_cast<F**>(p))(); }
+        static void move(void* dst, void* src) noexcept
+        {
+            ::new (dst) F*(*static_cast<F**>(src));
+        }
+        static void destroy(void* p) noexcept { delete *static_cast<F**>(p); }
+        static const Ops table;
+    };
+
+    static void run_runnable(void* p) { (*static_cast<Runnable**>(p))->run(); }
+    static void move_runnable(void* dst, void* src) noexcept
+    {
+        ::new (dst) Runnable*(*static_cast<Runnable**>(src));
+    }
+    static void delete_runnable(void* p) noexcept
+    {
+        delete *static_cast<Runnable**>(p);
+    }
+    static const Ops runnable_ops;
+
+    alignas(std::max_align_t) unsigned char storage[AGENTPP_TASK_INLINE_SIZE];
+    const Ops* ops;
+};
+
+template <class F>
+const Task::Ops Task::InlineOps<F>::table = { &InlineOps<F>::invoke,
+    &InlineOps<F>::move, &InlineOps<F>::destroy };
+
+template <class F>
+const Task::Ops Task::HeapOps<F>::table = { &HeapOps<F>::invoke,
+    &HeapOps<F>::move, &HeapOps<F>::destroy };
+
+namespace detail
+{
+
+/**
+ * The BlockPool class keeps freed memory blocks of one size in a
+ * lock-free stack to be reused by the next allocation of that size.
+ * Up to AGENTPP_FUTURE_POOL_SIZE blocks are kept, more are freed.
+ */
+template <std::size_t Size> class BlockPool : private boost::noncopyable {
+public:
+    static void* allocate()
+    {
+        void* block = nullptr;
+        if (instance().blocks.pop(block)) {
+            return block;
+        }
+        return ::operator new(Size);
+    }
+
+    static void deallocate(void* block) noexcept
+    {
+        if (!instance().blocks.bounded_push(block)) {
+            ::operator delete(block);
+        }
+    }
+
+private:
+    BlockPool() = default;
+    ~BlockPool()
+    {
+        void* block = nullptr;
+        while (blocks.pop(block)) {
+            ::operator delete(block);
+        }
+    }
+
+    static BlockPool& instance()
+    {
+        static BlockPool pool;
+        return pool;
+    }
+
+    boost::lockfree::stack<void*,
+        boost::lockfree::capacity<AGENTPP_FUTURE_POOL_SIZE> >
+        blocks;
+};
+
+/**
+ * The SharedStateBase class is the reference counted part of a Future
+ * and the task which sets its result. The mutex and condition variable
+ * are only used if get() has to wait.
+ */
+class AGENTPP_DECL SharedStateBase : private boost::noncopyable {
+public:
+    SharedStateBase()
+        : refs(2) // NOTE: the Future and the task! CK
+        , ready(false)
+        , waiting(false)
+    { }
+
+    void release()
+    {
+        if (refs.fetch_sub(1, boost::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    bool is_ready() const { return ready.load(boost::memory_order_acquire); }
+
+    void wait();
+    bool wait_for(const duration& rel_time);
+
+    void set_exception(std::exception_ptr e)
+    {
+        error = e;
+        set_ready();
+    }
+
+protected:
+    virtual ~SharedStateBase() { }
+
+    void set_ready();
+
+    void rethrow()
+    {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    boost::atomic<int> refs;
+    boost::atomic<bool> ready;
+    boost::atomic<bool> waiting;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::exception_ptr error;
+};
+
+template <class R> class SharedState : public SharedStateBase {
+public:
+    SharedState()
+        : has_value(false)
+    { }
+
+    ~SharedState() BOOST_OVERRIDE
+    {
+        if (has_value) {
+            value().~R();
+        }
+    }
+
+    template <class F> void run(F& fn)
+    {
+        ::new (static_cast<void*>(&storage)) R(fn());
+        has_value = true;
+        set_ready();
+    }
+
+    R take()
+    {
+        rethrow();
+        return std::move(value());
+    }
+
+    static void* operator new(std::size_t)
+    {
+        return BlockPool<sizeof(SharedState)>::allocate();
+    }
+    static void operator delete(void* p)
+    {
+        BlockPool<sizeof(SharedState)>::deallocate(p);
+    }
+
+private:
+    R& value() { return *reinterpret_cast<R*>(&storage); }
+
+    typename std::aligned_storage<sizeof(R), alignof(R)>::type storage;
+    bool has_value;
+};
+
+template <> class SharedState<void> : public SharedStateBase {
+public:
+    template <class F> void run(F& fn)
+    {
+        fn();
+        set_ready();
+    }
+
+    void take() { rethrow(); }
+
+    static void* operator new(std::size_t)
+    {
+        return BlockPool<sizeof(SharedState)>::allocate();
+    }
+    static void operator delete(void* p)
+    {
+        BlockPool<sizeof(SharedState)>::deallocate(p);
+    }
+};
+
+/**
+ * The callable which is executed by the ThreadPool for submit(). If it
+ * is destroyed without being run, the Future gets a broken_promise.
+ */
+template <class R, class F> class PackagedTask {
+public:
+    template <class G>
+    PackagedTask(SharedState<R>* s, G&& g)
+        : state(s)
+        , fn(std::forward<G>(g))
+    { }
+
+    PackagedTask(PackagedTask&& other) noexcept(
+        std::is_nothrow_move_constructible<F>::value)
+        : state(other.state)
+        , fn(std::move(other.fn))
+    {
+        other.state = nullptr;
+    }
+
+    ~PackagedTask()
+    {
+        if (state) {
+            state->set_exception(std::make_exception_ptr(
+                std::future_error(std::future_errc::broken_promise)));
+            state->release();
+        }
+    }
+
+    PackagedTask(const PackagedTask&) = delete;
+    PackagedTask& operator=(const PackagedTask&) = delete;
+    PackagedTask& operator=(PackagedTask&&) = delete;
+
+    void operator()()
+    {
+        SharedState<R>* s = state;
+        state             = nullptr;
+        try {
+            s->run(fn);
+        } catch (...) {
+            s->set_exception(std::current_exception());
+        }
+        s->release();
+    }
+
+private:
+    SharedState<R>* state;
+    F fn;
+};
+
+} // namespace detail
+
+/**
+ * The Future class gives access to the result of a callable executed
+ * by ThreadPool::submit(). An exception thrown by the callable is
+ * rethrown by get().
+ *
+ * The shared state is taken from a pool, so a Future costs no heap
+ * allocation in the steady state.
+ */
+template <class R> class Future {
+public:
+    Future() noexcept
+        : state(nullptr)
+    { }
+
+    explicit Future(detail::SharedState<R>* s) noexcept
+        : state(s)
+    { }
+
+    Future(Future&& other) noexcept
+        : state(other.state)
+    {
+        other.state = nullptr;
+    }
+
+    Future& operator=(Future&& other) noexcept
+    {
+        if (this != &other) {
+            if (state) {
+                state->release();
+            }
+            state       = other.state;
+            other.state = nullptr;
+        }
+        return *this;
+    }
+
+    ~Future()
+    {
+        if (state) {
+            state->release();
+        }
+    }
+
+    Future(const Future&) = delete;
+    Future& operator=(const Future&) = delete;
+
+    /**
+     * @return
+     *    true if get() may be called.
+     */
+    bool valid() const noexcept { return state != nullptr; }
+
+    /**
+     * @return
+     *    true if the result (or an exception) is available.
+     */
+    bool is_ready() const { return state->is_ready(); }
+
+    /**
+     * Block until the result is available.
+     */
+    void wait() const { state->wait(); }
+
+    /**
+     * Block until the result is available or the time is elapsed.
+     *
+     * @return
+     *    true if the result is available.
+     */
+    bool wait_for(const duration& rel_time) const
+    {
+        return state->wait_for(rel_time);
+    }
+
+    /**
+     * Wait for and return the result. The Future is not valid()
+     * thereafter.
+     *
+     * @throw
+     *    the exception thrown by the callable or a std::future_error
+     *    with broken_promise if the callable was never run.
+     */
+    R get()
+    {
+        Release guard(state);
+        state = nullptr;
+        guard.state->wait();
+        return guard.state->take();
+    }
+
+private:
+    struct Release {
+        explicit Release(detail::SharedState<R>* s)
+            : state(s)
+        { }
+        ~Release() { state->release(); }
+        detail::SharedState<R>* state;
+    };
+
+    detail::SharedState<R>* state;
+};
+
 /**
  * The Synchronized class implements services for synchronizing
  * access between different threads.
  *
+ * With AGENTPP_USE_FUTEX the monitor is built on two Linux futex words:
+ * the lock word holds the thread id of the owner and a waiters bit, so
+ * an uncontended lock() and unlock() is one compare and swap each. The
+ * condition is a sequence number incremented by notify(). Else a
+ * boost::timed_mutex and a boost::condition_variable_any are used.
+ *
  * @author Frank Fock
  * @version 4.0
  *
@@ -285,12 +869,59 @@ public:
     bool unlock();
 
 protected:
-    // NOTE: the type of the wrapped lockable
-    typedef boost::mutex lockable_type;
+    /**
+     * Sleep until the last waiter has returned from wait(). Called by
+     * the destructor with the lock, which is owned again on return.
+     */
+    void drain();
+
+#ifdef AGENTPP_USE_FUTEX
+    // NOTE: 0 if unlocked, else the owner tid | WAITERS if contended! CK
+    boost::atomic<boost::uint32_t> word;
+    boost::atomic<boost::uint32_t> sequence; // incremented by notify()
+    boost::atomic<boost::uint32_t> waiters;  // threads in wait()
+    boost::atomic<boost::uint32_t> draining; // NOTE: drain() sleeps on it
+    volatile bool signal;
+
+    bool is_locked_by_this_thread() const;
+
+    inline bool is_locked() const
+    {
+        return word.load(boost::memory_order_relaxed) != 0;
+    }
+
+    /**
+     * Wait for the lock until it is free or the deadline is reached.
+     *
+     * @param deadline
+     *    the absolute timeout, or 0 to wait forever.
+     * @param spin
+     *    false if the waiters bit must be set on success, because other
+     *    threads may sleep on the lock word.
+     * @return
+     *    true if the lock is owned, false on timeout.
+     */
+    bool lock_contended(const time_point* deadline, bool spin);
+
+    /**
+     * Wait for a notify() with timeout.
+     *
+     * @param deadline
+     *    the absolute timeout, or 0 to wait forever.
+     * @return
+     *    false if the deadline is reached, otherwise true.
+     */
+    bool wait_until(const time_point* deadline);
+#else
+    // NOTE: the type of the wrapped lockable, timed for lock(timeout)! CK
+    typedef boost::timed_mutex lockable_type;
     lockable_type mutex;
     typedef boost::unique_lock<lockable_type> scoped_lock;
-    boost::condition_variable cond;
+    boost::condition_variable_any cond;
     volatile bool signal;
+    unsigned long sequence; // incremented by notify(), guarded by the mutex
+    unsigned waiters;       // threads in wait(), guarded by the mutex
+    bool draining;          // drain() waits on cond, guarded by the mutex
     boost::atomic<boost::thread::id> tid_;
 
     inline bool is_locked_by_this_thread() const
@@ -300,22 +931,10 @@ protected:
 
     inline bool is_locked() const { return !(boost::thread::id() == tid_); }
 
-    inline void wait_until_condition(
-        scoped_lock& lk, boost::function<bool()> predicate)
-    {
-        while (!predicate()) {
-            //=================================
-            tid_ = boost::thread::id();
-            cond.wait(lk); // forever
-            tid_ = boost::this_thread::get_id();
-            //=================================
-        }
-    }
-
-    inline void wait_for_signal_if_needed(
-        scoped_lock& lk, volatile bool& signal)
+    // NOTE: a later waiter must not take back the notify() of this one! CK
+    inline void wait_for_signal_if_needed(scoped_lock& lk, unsigned long seq)
     {
-        while (!signal) {
+        while (sequence == seq) {
             //=================================
             tid_ = boost::thread::id();
             cond.wait(lk); // forever
@@ -323,6 +942,7 @@ protected:
             //=================================
         }
     }
+#endif
 };
 
 /**
@@ -568,6 +1188,352 @@ protected:
 
 class TaskManager;
 
+/**
+ * The SpinWait option of a ThreadPool defines how an idle TaskManager
+ * waits for its next task. A task assigned while the thread spins is
+ * started without a wakeup by the kernel.
+ *
+ * PARK blocks at once on the condition variable (the default). FIXED
+ * spins up to the given time before it parks. ADAPTIVE spins twice the
+ * average time between the tasks of the thread, if this is below the
+ * given limit, else it parks at once. On a single CPU ADAPTIVE never
+ * spins, the spinning thread would only delay the dispatcher.
+ */
+struct AGENTPP_DECL SpinWait {
+    enum Mode { PARK, FIXED, ADAPTIVE };
+
+    explicit SpinWait(Mode m = PARK, unsigned long limit = AGENTPP_SPIN_WAIT_NS)
+        : mode(m)
+        , nanoseconds(limit)
+    { }
+
+    Mode mode;
+    unsigned long nanoseconds; // upper bound of the spin phase
+};
+
+/**
+ * The PoolSizing of a QueuedThreadPool bounds its number of threads. The
+ * pool starts minThreads threads and grows up to maxThreads while there
+ * are queued tasks which no idle thread will take: more than
+ * queueThreshold of them, or any if the queue has not been served for
+ * maxWait milliseconds. A thread above minThreads which has been idle for
+ * keepAlive milliseconds exits.
+ *
+ * Without a max (or with max == min) the pool has a fixed size.
+ */
+struct AGENTPP_DECL PoolSizing {
+    explicit PoolSizing(size_t min = 1, size_t max = 0,
+        unsigned long keep_alive = AGENTPP_KEEP_ALIVE_MS,
+        size_t queue_threshold = 0, unsigned long max_wait = 0)
+        : minThreads(min)
+        , maxThreads(max < min ? min : max)
+        , keepAlive(keep_alive)
+        , queueThreshold(queue_threshold)
+        , maxWait(max_wait)
+    { }
+
+    size_t minThreads;
+    size_t maxThreads;
+    unsigned long keepAlive; // ms, 0 means forever
+    size_t queueThreshold;   // queued tasks tolerated without growing
+    unsigned long maxWait;   // ms, 0 means not used
+};
+
+/**
+ * The Histogram class counts values (e.g., nanoseconds) in logarithmic
+ * buckets like an HDR histogram: each power of two is split into
+ * SUB_BUCKETS linear buckets, so a value is known within 12.5% whatever
+ * its magnitude. Values from 2^MAX_BITS on (about 18 minutes in
+ * nanoseconds) are counted in the last bucket.
+ */
+class AGENTPP_DECL Histogram {
+    friend class WorkerMetrics;
+
+public:
+    static const unsigned SUB_BUCKET_BITS = 3;
+    static const unsigned MAX_BITS        = 40;
+    static const size_t SUB_BUCKETS       = size_t(1) << SUB_BUCKET_BITS;
+    static const size_t BUCKETS =
+        (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    Histogram();
+
+    /**
+     * Get the bucket of a value.
+     */
+    static size_t bucket_of(boost::uint64_t value);
+
+    /**
+     * Get the smallest value counted in a bucket.
+     */
+    static boost::uint64_t lower_bound(size_t bucket);
+
+    /**
+     * Get the largest value counted in a bucket.
+     */
+    static boost::uint64_t upper_bound(size_t bucket);
+
+    void record(boost::uint64_t value);
+    Histogram& operator+=(const Histogram& other);
+
+    boost::uint64_t count() const { return total; }
+    boost::uint64_t sum() const { return valueSum; }
+    boost::uint64_t max() const { return maxValue; }
+    boost::uint64_t bucket(size_t i) const { return counts[i]; }
+    double mean() const;
+
+    /**
+     * Get a percentile of the recorded values.
+     *
+     * @param p
+     *    the percentile between 0.0 and 100.0, e.g. 99.9.
+     * @return
+     *    the upper bound of the bucket which holds the percentile (but
+     *    not more than the max), or 0 if nothing was recorded.
+     */
+    boost::uint64_t percentile(double p) const;
+
+private:
+    boost::uint64_t counts[BUCKETS];
+    boost::uint64_t total;
+    boost::uint64_t valueSum;
+    boost::uint64_t maxValue;
+};
+
+/**
+ * The PoolMetrics are a snapshot of the counters of a ThreadPool. Each
+ * thread counts its own tasks without any shared atomic operation, the
+ * counters of all threads (still running or not) are added on read. So
+ * a snapshot taken while tasks run is not exact to the last task.
+ */
+struct AGENTPP_DECL PoolMetrics {
+    /**
+     * The counters of one running thread.
+     */
+    struct Worker {
+        boost::uint64_t tasks; ///< tasks run by the thread
+        boost::uint64_t busy;  ///< ns spent running tasks
+        boost::uint64_t alive; ///< ns since the thread was started
+    };
+
+    PoolMetrics();
+
+    size_t threads;               ///< running threads
+    size_t idle;                  ///< threads waiting for a task
+    size_t queue_length;          ///< queued tasks (QueuedThreadPool)
+    boost::uint64_t tasks;        ///< tasks run by all threads
+    boost::uint64_t rejected;     ///< tasks dropped: terminated or no threads
+    boost::uint64_t busy;         ///< ns all threads were running tasks
+    boost::uint64_t alive;        ///< ns all threads were alive
+    Histogram wait;               ///< ns from execute() to the task start
+    Histogram run;                ///< ns a task has run
+    Histogram queue_depth;        ///< queue length seen by execute()
+    std::vector<Worker> workers;  ///< the running threads
+
+    /**
+     * Get the part of the time the threads were busy.
+     *
+     * @return
+     *    busy / alive between 0.0 and 1.0.
+     */
+    double utilization() const;
+
+    /**
+     * Format the metrics for a log, the times in microseconds.
+     */
+    std::string to_text() const;
+
+    /**
+     * Format the metrics as a JSON object, the times in nanoseconds. The
+     * histograms contain their not empty buckets as pairs of the lower
+     * bound and the count.
+     */
+    std::string to_json() const;
+};
+
+class WorkerMetrics;
+class ThreadPool;
+
+/**
+ * The TimerService runs Tasks at a given time on a ThreadPool.
+ *
+ * The timers are kept in a hierarchical timing wheel on a steady_clock:
+ * LEVELS wheels of SLOTS slots each, the slots of a level span SLOTS
+ * times the time of a slot of the level below. A timer is linked into
+ * the slot of the coarsest level which is still finer than its delay and
+ * moved down a level each time the wheel below has turned once. So
+ * schedule_at() and cancel() are O(1) whatever the number of pending
+ * timers, and no timer is touched more than LEVELS times.
+ *
+ * One expiry thread advances the wheel and hands the due Tasks to the
+ * ThreadPool, it never runs a Task itself. A timer never fires before
+ * its time, but up to one tick later.
+ *
+ * The Tasks are handed over with ThreadPool::try_execute(), so a busy
+ * pool does not block the expiry thread. A due Task which no thread
+ * takes is kept, in the order of its time, and handed over again at
+ * the next tick. A QueuedThreadPool takes each Task at once.
+ */
+class AGENTPP_DECL TimerService : private boost::noncopyable {
+public:
+    typedef boost::chrono::steady_clock clock;
+
+    /**
+     * The handle of a scheduled timer. It stays valid (and harmless)
+     * after the timer has fired or is cancelled.
+     */
+    class TimerId {
+        friend class TimerService;
+        void* node;
+        boost::uint64_t generation;
+
+    public:
+        TimerId() noexcept
+            : node(nullptr)
+            , generation(0)
+        { }
+
+        explicit operator bool() const noexcept { return node != nullptr; }
+    };
+
+    /**
+     * Create a TimerService and start its expiry thread.
+     *
+     * @param pool
+     *    the ThreadPool the due Tasks are executed on, it must outlive
+     *    the TimerService.
+     * @param tick
+     *    the resolution of the timers.
+     */
+    explicit TimerService(
+        ThreadPool& pool, clock::duration tick = us(AGENTPP_TIMER_TICK_US));
+
+    /**
+     * Destructor stops the expiry thread, the pending Tasks and the due
+     * ones which the pool has not taken yet are destroyed without being
+     * run.
+     */
+    ~TimerService();
+
+    /**
+     * Run a Task at the given time.
+     *
+     * @param when
+     *    the time at which the Task is handed to the ThreadPool, a time
+     *    in the past means as soon as possible.
+     * @param task
+     *    a not empty Task.
+     * @return
+     *    the handle to cancel the timer, an empty one if the service is
+     *    stopped (the Task is destroyed then).
+     */
+    TimerId schedule_at(clock::time_point when, Task task);
+
+    /**
+     * Run a Task after the given delay, see schedule_at().
+     */
+    TimerId schedule_after(clock::duration delay, Task task)
+    {
+        return schedule_at(clock::now() + delay, std::move(task));
+    }
+
+    /**
+     * Cancel a pending timer, its Task is destroyed without being run.
+     *
+     * @return
+     *    true if the timer was pending, false if it has fired, is
+     *    cancelled already, or the handle is empty.
+     */
+    bool cancel(TimerId id);
+
+    /**
+     * @return
+     *    the number of pending timers.
+     */
+    size_t pending() const;
+
+    /**
+     * Stop the expiry thread, no more timers fire thereafter. This call
+     * blocks until the thread is stopped.
+     */
+    void stop();
+
+private:
+    enum {
+        SLOT_BITS = 6,
+        SLOTS     = 1 << SLOT_BITS, // slots per level
+        LEVELS    = 6               // NOTE: 2^36 ticks, a year of ms
+    };
+
+    struct Link {
+        Link* prev;
+        Link* next;
+    };
+    struct Node;
+
+    Node* make_node();
+    void link(Node* node);
+    void unlink(Node* node);
+    void recycle(Node* node);
+    void cascade(unsigned level);
+    void advance(boost::uint64_t target, std::vector<Task>& due);
+    boost::uint64_t next_wakeup() const;
+    boost::uint64_t tick_of(clock::time_point when) const;
+    void expire();
+
+    ThreadPool& pool;
+    const clock::duration tick;
+    const clock::time_point origin; // NOTE: the time of tick 0
+
+    mutable boost::mutex lock;
+    boost::condition_variable changed; // NOTE: an earlier timer or stop
+    Link wheel[LEVELS][SLOTS];         // NOTE: sentinels of the slots
+    size_t counts[LEVELS];             // timers per level
+    boost::uint64_t current;           // NOTE: the next tick to expire
+    boost::uint64_t wakeup;            // NOTE: the thread sleeps until
+    Node* freeList;
+    std::vector<std::unique_ptr<Node> > nodes; // NOTE: never shrinks
+    bool go;
+    boost::thread expiry;
+};
+
+/**
+ * The ScheduledTask is the handle of a task executed by
+ * ThreadPool::execute_after() or ThreadPool::execute_every(). It may be
+ * copied, all copies refer to the same task.
+ */
+class AGENTPP_DECL ScheduledTask {
+    friend class ThreadPool;
+    struct State;
+
+public:
+    ScheduledTask() noexcept = default;
+
+    /**
+     * Cancel the task: a pending one is not run, a periodic one is not
+     * run again. A run which has started already is not interrupted.
+     *
+     * @return
+     *    true if the task was pending or periodic and is cancelled now.
+     */
+    bool cancel();
+
+    /**
+     * @return
+     *    true if cancel() has been called.
+     */
+    bool is_cancelled() const;
+
+    explicit operator bool() const noexcept { return state != nullptr; }
+
+private:
+    explicit ScheduledTask(std::shared_ptr<State> s) noexcept
+        : state(std::move(s))
+    { }
+
+    std::shared_ptr<State> state;
+};
+
 /**
  * The ThreadPool class provides a pool of threads that can be
  * used to perform an arbitrary number of tasks.
@@ -579,9 +1545,50 @@ class AGENTPP_DECL ThreadPool
     : public Synchronized,
       public std::enable_shared_from_this<ThreadPool> {
 
+public:
+    /**
+     * How the threads of a ThreadPool are started.
+     */
+    enum Startup {
+        EAGER,    ///< all threads are started by the constructor
+        PARALLEL, ///< like EAGER, but by several threads at once
+        LAZY      ///< a thread is started by execute() if none is idle
+    };
+
+    /**
+     * When execute_every() runs a task again.
+     */
+    enum Schedule {
+        FIXED_RATE, ///< one period after the previous run was due
+        FIXED_DELAY ///< one period after the previous run has ended
+    };
+
 protected:
+    // NOTE: must be declared first, TaskManagers use it until joined! CK
+    std::vector<TaskManager*> idleList; // NOTE: LIFO, the hottest one first
     std::vector<std::unique_ptr<TaskManager> > taskList;
     size_t stackSize;
+    SpinWait spinWait;
+    size_t maxSize; // NOTE: a LAZY pool grows up to this size
+    volatile bool go;
+
+private:
+    void start(size_t size, Startup startup);
+    TaskManager* add_task_manager();
+    std::shared_ptr<TimerService> timer_service();
+    ScheduledTask schedule(TimerService::clock::duration delay,
+        TimerService::clock::duration period, Task task, Schedule schedule);
+
+    std::shared_ptr<TimerService> timers; // NOTE: started on demand
+    bool timersStopped;
+    boost::uint64_t rejected; // NOTE: dropped, terminated or no threads
+
+protected:
+    /**
+     * Stop the timer thread, the delayed and periodic tasks which are
+     * not yet due are destroyed without being run.
+     */
+    void stop_timers();
 
 public:
     /**
@@ -605,6 +1612,36 @@ public:
      */
     ThreadPool(size_t size, size_t stack_size);
 
+    /**
+     * Create a ThreadPool with a given number of threads, stack size
+     * and wait strategy of the idle threads.
+     *
+     * @param size
+     *    the number of threads started for performing tasks.
+     * @param stack_size
+     *    the stack size for each thread.
+     * @param spin
+     *    how long an idle thread spins before it blocks.
+     */
+    ThreadPool(size_t size, size_t stack_size, const SpinWait& spin);
+
+    /**
+     * Create a ThreadPool with a given number of threads, stack size,
+     * wait strategy of the idle threads and startup mode.
+     *
+     * @param size
+     *    the maximal number of threads for performing tasks.
+     * @param stack_size
+     *    the stack size for each thread.
+     * @param spin
+     *    how long an idle thread spins before it blocks.
+     * @param startup
+     *    LAZY starts no thread before it is needed, PARALLEL starts
+     *    the threads of a large pool concurrently.
+     */
+    ThreadPool(size_t size, size_t stack_size, const SpinWait& spin,
+        Startup startup);
+
     /**
      * Destructor will wait for termination of all threads.
      */
@@ -616,6 +1653,107 @@ public:
      */
     virtual void execute(Runnable*);
 
+    /**
+     * Execute a callable Task, e.g. a lambda. A small Task is executed
+     * without any heap allocation (SYNCHRONIZED).
+     */
+    virtual void execute(Task task);
+
+    /**
+     * Execute a callable Task only if a thread can take it at once.
+     * Unlike execute() this call never blocks, so a running task may
+     * use it to pass work on to the pool (SYNCHRONIZED).
+     *
+     * @param task
+     *    the Task, it is moved from only if TRUE is returned.
+     * @return
+     *    TRUE if the task is executed, FALSE if all threads are busy or
+     *    the pool is terminated.
+     */
+    virtual bool try_execute(Task& task);
+
+    /**
+     * Execute a task after a delay. No thread of the pool waits for it,
+     * the timer thread of the pool (a TimerService started by the first
+     * delayed or periodic task) executes it when it is due.
+     *
+     * @param delay
+     *    the time to wait before the task is executed.
+     * @param task
+     *    a Runnable instance, it is deleted after its run() method or
+     *    if it is cancelled.
+     * @return
+     *    the handle to cancel the task.
+     */
+    ScheduledTask execute_after(
+        TimerService::clock::duration delay, Runnable* task);
+
+    /**
+     * Execute a callable Task after a delay, see above.
+     */
+    ScheduledTask execute_after(TimerService::clock::duration delay, Task task);
+
+    /**
+     * Execute a task periodically until it is cancelled or the pool is
+     * terminated. A run is never started before the previous one has
+     * ended; if a run takes longer than the period, the next one is
+     * started at once.
+     *
+     * @param period
+     *    the time to the first run and between two runs.
+     * @param task
+     *    a Runnable instance, it is deleted if it is cancelled or the
+     *    pool is terminated.
+     * @param schedule
+     *    FIXED_RATE keeps the runs in step with the period, FIXED_DELAY
+     *    keeps a period between the end of a run and the next one.
+     * @return
+     *    the handle to cancel the task.
+     */
+    ScheduledTask execute_every(TimerService::clock::duration period,
+        Runnable* task, Schedule schedule = FIXED_RATE);
+
+    /**
+     * Execute a callable Task periodically, see above.
+     */
+    ScheduledTask execute_every(TimerService::clock::duration period,
+        Task task, Schedule schedule = FIXED_RATE);
+
+    /**
+     * Submit a callable for execution and get a Future for its result.
+     * An exception thrown by the callable is passed to the Future. If
+     * the pool is terminated, Future::get() throws a broken_promise.
+     *
+     * @param f
+     *    a callable without arguments, e.g. a lambda.
+     * @return
+     *    the Future for the result of f().
+     */
+    template <class F>
+    Future<decltype(std::declval<std::decay_t<F>&>()())> submit(F&& f)
+    {
+        typedef decltype(std::declval<std::decay_t<F>&>()()) R;
+        detail::SharedState<R>* state = new detail::SharedState<R>();
+        Future<R> future(state);
+        execute(Task(detail::PackagedTask<R, std::decay_t<F> >(
+            state, std::forward<F>(f))));
+        return future;
+    }
+
+    /**
+     * Execute a number of tasks at once. The idle TaskManagers are taken
+     * from the idle stack with one lock acquisition, so at most
+     * min(n, idle threads) threads are woken up. The call blocks until
+     * all tasks are assigned (SYNCHRONIZED).
+     *
+     * @param tasks
+     *    an array of n Runnable instances, each is deleted after call of
+     *    its run() method.
+     * @param n
+     *    the number of tasks.
+     */
+    virtual void execute_bulk(Runnable** tasks, size_t n);
+
     /**
      * Check whether the ThreadPool is idle or not (SYNCHRONIZED).
      *
@@ -635,10 +1773,20 @@ public:
      */
     virtual bool is_busy();
 
+    /**
+     * Get a snapshot of the counters of all threads (SYNCHRONIZED).
+     *
+     * @return
+     *    the task counts, the wait and run time histograms and the
+     *    utilization of the threads, see PoolMetrics.
+     */
+    virtual PoolMetrics metrics();
+
     /**
      * Get the size of the thread pool.
      * @return
-     *    the number of threads in the pool.
+     *    the number of threads in the pool, of a LAZY pool only the
+     *    threads started so far.
      */
     virtual size_t size() const { return taskList.size(); }
 
@@ -650,10 +1798,22 @@ public:
      */
     inline size_t get_stack_size() const { return stackSize; }
 
+    /**
+     * Get the wait strategy of the idle threads.
+     *
+     * @return
+     *   the SpinWait option given at construction.
+     */
+    inline const SpinWait& get_spin_wait() const { return spinWait; }
+
     /**
      * Notifies the thread pool about an idle thread (SYNCHRONIZED).
+     *
+     * @param tm
+     *    the TaskManager which has finished its task. It is pushed on
+     *    the idle stack and one thread waiting in execute() is woken up.
      */
-    virtual void idle_notification();
+    virtual void idle_notification(TaskManager* tm);
 
     /**
      * Gracefully stops all running task managers after their current task
@@ -671,16 +1831,31 @@ public:
  * then the task will be queued for later processing. Consequently,
  * the execute method never blocks (in contrast to ThreadPool).
  *
- * The QueuedThreadPool uses an extra Thread to process queued messages
- * asynchronously.
+ * The threads take the queued tasks directly from one FIFO queue. Within
+ * the bounds of its PoolSizing the pool starts a thread for tasks which
+ * wait in the queue and lets a thread exit which stays idle too long.
+ * With a maxWait a watchdog thread starts a thread for a queue which has
+ * not been served in time, even if no more tasks are executed.
  *
  * @author Frank Fock
  * @version 3.5.18
  */
 class AGENTPP_DECL QueuedThreadPool : public ThreadPool, public Thread {
 
-    // XXX std::queue<Runnable*> queue;
-    size_t _size;
+    typedef std::list<boost::thread> WorkerList;
+
+    // NOTE: a queued task remembers when it was executed! CK
+    struct Queued {
+        Queued(Task t, time_point at)
+            : task(std::move(t))
+            , queuedAt(at)
+        { }
+
+        Task task;
+        time_point queuedAt;
+    };
+
+    PoolSizing sizing;
     volatile bool go;
 
 public:
@@ -705,6 +1880,18 @@ public:
      */
     QueuedThreadPool(size_t size, size_t stack_size);
 
+    /**
+     * Create an elastic ThreadPool which grows and shrinks with its load.
+     *
+     * @param sizing
+     *    the minimal and maximal number of threads, the keep-alive time
+     *    of an idle thread and when to start another thread.
+     * @param stack_size
+     *    the stack size for each thread.
+     */
+    explicit QueuedThreadPool(const PoolSizing& sizing,
+        size_t stack_size = AGENTPP_DEFAULT_STACKSIZE);
+
     /**
      * Destructor will wait for termination of all threads.
      */
@@ -717,12 +1904,61 @@ public:
     void execute(Runnable*) BOOST_OVERRIDE;
 
     /**
-     * Gets the current number of queued tasks (SYNCHRONIZED).
+     * Execute a callable Task, e.g. a lambda. The Task is moved into
+     * the queue, a small one without any heap allocation.
+     */
+    void execute(Task task) BOOST_OVERRIDE;
+
+    /**
+     * Queue a callable Task like execute().
+     *
+     * @return
+     *    FALSE only if the pool is terminated, the Task is unchanged then.
+     */
+    bool try_execute(Task& task) BOOST_OVERRIDE;
+
+    /**
+     * Execute a number of tasks at once. The queue is locked only once
+     * and at most min(n, idle threads) threads are woken up.
+     */
+    void execute_bulk(Runnable** tasks, size_t n) BOOST_OVERRIDE;
+
+    /**
+     * Gets the current number of queued tasks. Like is_idle() and
+     * is_busy() it reads a counter without lock, so a monitor may poll
+     * it often without delaying the pool.
      *
      * @return
      *    the number of tasks that are currently queued.
      */
-    size_t queue_length();
+    size_t queue_length() const;
+
+    /**
+     * Gets the current number of running tasks.
+     *
+     * @return
+     *    the number of threads that are currently executing a task.
+     */
+    size_t active_count() const;
+
+    /**
+     * Gets the number of tasks run so far.
+     *
+     * @return
+     *    the number of tasks that have been executed by the pool.
+     */
+    boost::uint64_t completed_count() const;
+
+    /**
+     * Wait until no task is queued or running (SYNCHRONIZED).
+     *
+     * @param timeout
+     *    the maximal time to wait in milliseconds, 0 waits forever.
+     * @return
+     *    TRUE if the pool is idle, FALSE after the timeout or if the
+     *    pool has been terminated.
+     */
+    bool wait_idle(unsigned long timeout = 0);
 
     /**
      * Runs the queue processing loop (SYNCHRONIZED).
@@ -732,10 +1968,10 @@ public:
     /**
      * Notifies the thread pool about an idle thread (SYNCHRONIZED).
      */
-    void idle_notification() BOOST_OVERRIDE;
+    void idle_notification(TaskManager* tm) BOOST_OVERRIDE;
 
     /**
-     * Check whether QueuedThreadPool is idle or not (SYNCHRONIZED).
+     * Check whether QueuedThreadPool is idle or not.
      *
      * @return
      *    TRUE if non of the threads in the pool is currently
@@ -745,45 +1981,103 @@ public:
 
     /**
      * Check whether the ThreadPool is busy (i.e., all threads are
-     * running a task) or not (SYNCHRONIZED).
+     * running a task) or not.
      *
      * @return
      *    TRUE if non of the threads in the pool is currently
-     *    idle (not executing any task).
+     *    idle (not executing any task) and the pool cannot grow.
      */
     bool is_busy() BOOST_OVERRIDE;
 
-    size_t size() const BOOST_OVERRIDE { return _size; }
+    /**
+     * Get a snapshot of the counters of all threads, those which have
+     * exited included, and of the queue (SYNCHRONIZED).
+     */
+    PoolMetrics metrics() BOOST_OVERRIDE;
+
+    /**
+     * Get the current size of the thread pool.
+     *
+     * @return
+     *    the number of running threads, between the minimal and the
+     *    maximal size of the PoolSizing.
+     */
+    size_t size() const BOOST_OVERRIDE;
+
+    /**
+     * Get the peak size of the thread pool.
+     *
+     * @return
+     *    the largest number of threads which have run at the same time.
+     */
+    size_t peak_size() const;
+
+    /**
+     * Get the bounds of the thread pool.
+     *
+     * @return
+     *    the PoolSizing given at construction.
+     */
+    inline const PoolSizing& get_sizing() const { return sizing; }
 
+    /**
+     * Stop queue processing after all queued tasks are done. This call
+     * blocks until all threads are stopped.
+     */
     void terminate() BOOST_OVERRIDE;
 
 protected:
     /**
      * Stop queue processing (SYNCHRONIZED).
      *
-     * @note: the run() returns and the thread terminates too!
+     * @note: the threads run the queued tasks before they terminate!
      */
     virtual void stop();
 
-    // XXX inline bool has_task() { return (!go || !queue.empty()); }
-
 private:
-    /**
-     * @note asserted to be called with lock! CK
-     **/
-    // XXX bool assign(Runnable* task, bool withQueuing = true);
-
-    std::unique_ptr<boost::basic_thread_pool> ea;
+    bool start_worker();
+    size_t backlog() const;
+    bool must_grow() const;
+    void work(WorkerList::iterator self);
+    void watch();
+
+    // NOTE: the queue is not guarded by the Synchronized of the pool! CK
+    mutable boost::mutex queueLock;
+    boost::condition_variable notEmpty;
+    boost::condition_variable stateChanged; // NOTE: stop, backlog, exit, idle
+    std::deque<Queued> queue;
+    WorkerList workers;                // NOTE: a thread owns its entry
+    std::vector<boost::thread> exited; // not yet joined
+    size_t idle;                       // threads waiting for a task
+    size_t peak;
+    time_point lastPop; // NOTE: a task was taken from the queue
+    boost::thread watchdog; // NOTE: only used with a maxWait
+    std::list<const WorkerMetrics*> meters; // of the running threads
+    PoolMetrics retired;                    // of the exited threads
+    Histogram depth;
+    boost::uint64_t rejected;
+    size_t idleWaiters; // threads in wait_idle()
+
+    // NOTE: only written with the queue lock, read without it! CK
+    boost::atomic<size_t> pending;   // queue.size()
+    boost::atomic<size_t> active;    // threads running a task
+    boost::atomic<boost::uint64_t> completed;
 };
 
 /**
  * The TaskManager class controls the execution of tasks on
  * a Thread of a ThreadPool.
  *
+ * Each TaskManager starts on a cache line of its own and fills whole
+ * cache lines, so the lock and the task of one thread never share a
+ * cache line with the state of its neighbour.
+ *
  * @author Frank Fock
  * @version 3.5.19
  */
-class AGENTPP_DECL TaskManager : public Synchronized, public Runnable {
+class AGENTPP_DECL alignas(AGENTPP_CACHE_LINE_SIZE) TaskManager
+    : public Synchronized,
+      public Runnable {
 public:
     /**
      * Create a TaskManager and insert the created thread
@@ -835,6 +2129,24 @@ public:
      */
     bool set_task(Runnable*);
 
+    /**
+     * Hand over the next task to this TaskManager. In contrast to
+     * set_task() this blocks until the lock is acquired, so it must only
+     * be used for a TaskManager which was taken from the idle stack of
+     * its ThreadPool (nobody else assigns a task concurrently).
+     *
+     * @param task
+     *   a not empty Task.
+     * @param queued
+     *   the time the task was given to the ThreadPool.
+     */
+    void assign(Task task, time_point queued);
+
+    /**
+     * Get the counters of the managed thread.
+     */
+    inline const WorkerMetrics& metrics() const { return *meter; }
+
     /**
      * Clone this TaskManager.
      * see too:
@@ -861,13 +2173,406 @@ protected:
 
     inline bool has_task() { return (!go || task); }
 
-    Thread thread;
+    /**
+     * Spin without lock until a task is assigned, the TaskManager is
+     * stopped, or the spin time is over. The lock is held again on
+     * return.
+     */
+    void spin_for_task();
+
+    /**
+     * Adapt the spin time to the time between the last two tasks.
+     */
+    void tune_spin(time_point idle_since);
+
+    // NOTE: the hot members first, next to the lock! CK
     // TODO std::shared_ptr<ThreadPool> threadPool;
     ThreadPool* threadPool;
-    Runnable* task; // TODO: should be a std::unique_ptr<Runnable>
+    Task task;
     volatile bool go;
+    boost::atomic<bool> assigned; // NOTE: read without lock while spinning
+    SpinWait spinWait;
+    unsigned long spinNanos;   // the current spin time
+    unsigned long averageGap;  // nanoseconds between two tasks
+    time_point assignedAt;     // NOTE: set by assign() if ADAPTIVE
+    time_point queuedAt;       // NOTE: execute() was called
+    std::unique_ptr<WorkerMetrics> meter;
+    Thread thread;
+};
+
+/**
+ * The TaskGroup class runs a number of callables on a ThreadPool and
+ * waits until all of them have finished (fork-join).
+ *
+ * The callables are kept by the group. For each one run() passes a
+ * runner to ThreadPool::try_execute() which takes the oldest callable
+ * not yet taken. The thread in wait() runs the newest ones itself until
+ * none is left, and only then blocks. So a task which waits for its
+ * subtasks never waits for a thread of the pool, and a group finishes
+ * even on a busy pool or a pool of one thread.
+ *
+ * A runner which has found no callable is a no-op; it keeps the state
+ * of the group alive, not the group itself.
+ */
+class AGENTPP_DECL TaskGroup : private boost::noncopyable {
+public:
+    /**
+     * Create an empty TaskGroup.
+     *
+     * @param pool
+     *    the ThreadPool which runs the callables along with wait().
+     */
+    explicit TaskGroup(ThreadPool& pool);
+
+    /**
+     * Destructor waits for the callables like wait(), but an exception
+     * thrown by one of them is ignored.
+     */
+    ~TaskGroup();
+
+    /**
+     * Add a callable to the group. It may be run by a thread of the pool
+     * at once or later by wait().
+     */
+    void run(Task task);
+
+    /**
+     * Run the callables no thread has taken yet and wait until all have
+     * finished. A callable may run() more callables meanwhile.
+     *
+     * @throw
+     *    the first exception thrown by a callable, once.
+     */
+    void wait();
+
+private:
+    struct State;
+
+    ThreadPool& pool;
+    std::shared_ptr<State> state;
 };
 
+/**
+ * Call fn(begin, end) for consecutive chunks of [first, last) of at most
+ * grain indices each. The chunks are run by a TaskGroup on the pool and
+ * by the calling thread, which returns after all of them.
+ *
+ * @param pool
+ *    the ThreadPool which helps.
+ * @param first
+ *    the first index.
+ * @param last
+ *    the index after the last one.
+ * @param grain
+ *    the maximal size of a chunk, 0 gives about four chunks for each
+ *    thread of the pool.
+ * @param fn
+ *    a callable taking the begin and end index of a chunk.
+ * @throw
+ *    the first exception thrown by fn.
+ */
+template <class Index, class F>
+void parallel_for(ThreadPool& pool, Index first, Index last, Index grain,
+    const F& fn)
+{
+    if (!(first < last)) {
+        return;
+    }
+    if (!grain) {
+        const Index chunks = static_cast<Index>(4 * (pool.size() + 1));
+        grain              = (last - first + chunks - 1) / chunks;
+    }
+
+    TaskGroup group(pool);
+    Index begin = first;
+    while (last - begin > grain) {
+        const Index end = begin + grain;
+        group.run([&fn, begin, end]() { fn(begin, end); });
+        begin = end;
+    }
+    fn(begin, last); // NOTE: the last chunk in this thread! CK
+    group.wait();
+}
+
+/**
+ * Call all callables, all but the first on the pool, and return after
+ * all of them have finished.
+ *
+ * @param pool
+ *    the ThreadPool which helps.
+ * @throw
+ *    the first exception thrown by one of the callables.
+ */
+template <class F, class... G>
+void parallel_invoke(ThreadPool& pool, F&& f, G&&... g)
+{
+    TaskGroup group(pool);
+    (group.run([&g]() { g(); }), ...);
+    f();
+    group.wait();
+}
+
+namespace detail
+{
+/**
+ * @return
+ *    the number of chunks a range of n elements is split into: about
+ *    four for each thread of the pool, none smaller than cutoff bytes.
+ */
+inline size_t chunk_count(
+    ThreadPool& pool, size_t n, size_t element_size, size_t cutoff)
+{
+    const size_t least  = std::max<size_t>(1, cutoff / element_size);
+    const size_t chunks = 4 * (pool.size() + 1);
+    return std::max<size_t>(1, std::min(chunks, n / least));
+}
+
+/// @return the begin of chunk i of k chunks of n elements
+inline size_t chunk_begin(size_t n, size_t k, size_t i)
+{
+    return static_cast<size_t>(
+        static_cast<unsigned long long>(n) * i / k);
+}
+
+/**
+ * Merge the sorted ranges a and b into dst, split into pieces which are
+ * run by the TaskGroup. The split points are searched before any
+ * element is moved.
+ */
+template <class It, class Out, class Compare>
+void merge_pieces(TaskGroup& group, It a, It aEnd, It b, It bEnd, Out dst,
+    size_t pieces, Compare comp)
+{
+    const size_t na = static_cast<size_t>(aEnd - a);
+    if (na < pieces) {
+        pieces = 1;
+    }
+
+    std::vector<It> splitB(pieces + 1, bEnd);
+    splitB[0] = b;
+    for (size_t j = 1; j < pieces; ++j) {
+        splitB[j] = std::lower_bound(b, bEnd, *(a + chunk_begin(na, pieces, j)),
+            comp); // NOTE: before an element is moved! CK
+    }
+
+    for (size_t j = 0; j < pieces; ++j) {
+        const It a0  = a + chunk_begin(na, pieces, j);
+        const It a1  = a + chunk_begin(na, pieces, j + 1);
+        const It b0  = splitB[j];
+        const It b1  = splitB[j + 1];
+        const Out d0 = dst + (a0 - a) + (b0 - b);
+        group.run([a0, a1, b0, b1, d0, comp]() {
+            std::merge(std::make_move_iterator(a0), std::make_move_iterator(a1),
+                std::make_move_iterator(b0), std::make_move_iterator(b1), d0,
+                comp);
+        });
+    }
+}
+
+} // namespace detail
+
+/**
+ * Sort [first, last) with the threads of the pool. Runs of about
+ * AGENTPP_SORT_CUTOFF_BYTES are sorted by std::sort, then the runs are
+ * merged pairwise, each merge split into pieces so all threads help
+ * until the last one. Like std::sort the sort is not stable.
+ *
+ * The merge needs a buffer of last - first elements, so the value type
+ * must be default constructible and move assignable.
+ *
+ * @param pool
+ *    the ThreadPool which helps.
+ * @param comp
+ *    the strict weak ordering, std::less by default.
+ */
+template <class RandomIt, class Compare = std::less<> >
+void parallel_sort(
+    ThreadPool& pool, RandomIt first, RandomIt last, Compare comp = Compare())
+{
+    typedef typename std::iterator_traits<RandomIt>::value_type T;
+    const size_t n = static_cast<size_t>(last - first);
+
+    // NOTE: a power of two, so each round halves the runs! CK
+    const size_t most = detail::chunk_count(
+        pool, n, sizeof(T), AGENTPP_SORT_CUTOFF_BYTES);
+    size_t runs = 1;
+    while (runs * 2 <= most) {
+        runs *= 2;
+    }
+    if (runs < 2) {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    parallel_for(pool, size_t(0), runs, size_t(1),
+        [first, n, runs, &comp](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                std::sort(first + detail::chunk_begin(n, runs, i),
+                    first + detail::chunk_begin(n, runs, i + 1), comp);
+            }
+        });
+
+    std::vector<T> buffer(n);
+    bool inBuffer = false;
+    for (size_t width = 1; width < runs; width *= 2) {
+        const size_t pieces = 2 * width; // NOTE: runs tasks per round
+        TaskGroup group(pool);
+        for (size_t i = 0; i < runs; i += 2 * width) {
+            const size_t a = detail::chunk_begin(n, runs, i);
+            const size_t b = detail::chunk_begin(n, runs, i + width);
+            const size_t e = detail::chunk_begin(n, runs, i + 2 * width);
+            if (inBuffer) {
+                detail::merge_pieces(group, buffer.begin() + a,
+                    buffer.begin() + b, buffer.begin() + b,
+                    buffer.begin() + e, first + a, pieces, comp);
+            } else {
+                detail::merge_pieces(group, first + a, first + b, first + b,
+                    first + e, buffer.begin() + a, pieces, comp);
+            }
+        }
+        group.wait();
+        inBuffer = !inBuffer;
+    }
+
+    if (inBuffer) {
+        parallel_for(pool, size_t(0), n, size_t(0),
+            [first, &buffer](size_t begin, size_t end) {
+                std::move(buffer.begin() + begin, buffer.begin() + end,
+                    first + begin);
+            });
+    }
+}
+
+/**
+ * Combine init and all elements of [first, last) with op, the chunks of
+ * the range are reduced by the threads of the pool. The op must be
+ * associative, the order of the elements is kept.
+ *
+ * @param init
+ *    the initial value, combined with the first element.
+ * @param op
+ *    the binary operation, std::plus by default.
+ * @return
+ *    the reduced value.
+ */
+template <class RandomIt, class T, class BinaryOp = std::plus<> >
+T parallel_reduce(ThreadPool& pool, RandomIt first, RandomIt last, T init,
+    BinaryOp op = BinaryOp())
+{
+    const size_t n = static_cast<size_t>(last - first);
+    if (!n) {
+        return init;
+    }
+    const size_t chunks = detail::chunk_count(pool, n,
+        sizeof(typename std::iterator_traits<RandomIt>::value_type),
+        AGENTPP_PARALLEL_CUTOFF_BYTES);
+
+    std::vector<T> partial(chunks, init);
+    parallel_for(pool, size_t(0), chunks, size_t(1),
+        [first, n, chunks, &partial, &op](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                RandomIt it = first + detail::chunk_begin(n, chunks, i);
+                const RandomIt stop =
+                    first + detail::chunk_begin(n, chunks, i + 1);
+                T sum = *it;
+                while (++it != stop) {
+                    sum = op(sum, *it);
+                }
+                partial[i] = sum;
+            }
+        });
+
+    for (size_t i = 0; i < chunks; ++i) {
+        init = op(init, partial[i]);
+    }
+    return init;
+}
+
+/**
+ * Write op(x) of each element x of [first, last) to d_first, the chunks
+ * of the range are transformed by the threads of the pool.
+ *
+ * @return
+ *    the end of the written range.
+ */
+template <class RandomIt, class OutputIt, class UnaryOp>
+OutputIt parallel_transform(ThreadPool& pool, RandomIt first, RandomIt last,
+    OutputIt d_first, UnaryOp op)
+{
+    const size_t n = static_cast<size_t>(last - first);
+    const size_t chunks = detail::chunk_count(pool, n,
+        sizeof(typename std::iterator_traits<RandomIt>::value_type),
+        AGENTPP_PARALLEL_CUTOFF_BYTES);
+
+    parallel_for(pool, size_t(0), n, (n + chunks - 1) / chunks,
+        [first, d_first, &op](size_t begin, size_t end) {
+            std::transform(first + begin, first + end, d_first + begin, op);
+        });
+    return d_first + n;
+}
+
+/**
+ * Write the inclusive prefix sums of [first, last) to d_first, which may
+ * be first. The sums of the chunks are computed in parallel, then each
+ * chunk is scanned again from the sum of the chunks before it. So each
+ * element is read twice, but for the first chunk.
+ *
+ * @param op
+ *    the associative binary operation, std::plus by default.
+ * @return
+ *    the end of the written range.
+ */
+template <class RandomIt, class OutputIt, class BinaryOp = std::plus<> >
+OutputIt parallel_scan(ThreadPool& pool, RandomIt first, RandomIt last,
+    OutputIt d_first, BinaryOp op = BinaryOp())
+{
+    typedef typename std::iterator_traits<RandomIt>::value_type T;
+    const size_t n = static_cast<size_t>(last - first);
+    const size_t chunks =
+        detail::chunk_count(pool, n, sizeof(T), AGENTPP_PARALLEL_CUTOFF_BYTES);
+    if (chunks < 2) {
+        return std::partial_sum(first, last, d_first, op);
+    }
+
+    // NOTE: the first chunk is scanned at once, the others summed up
+    std::vector<T> sums(chunks, *first);
+    parallel_for(pool, size_t(0), chunks - 1, size_t(1),
+        [first, d_first, n, chunks, &sums, &op](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const size_t b = detail::chunk_begin(n, chunks, i);
+                const size_t e = detail::chunk_begin(n, chunks, i + 1);
+                if (!i) {
+                    std::partial_sum(first, first + e, d_first, op);
+                    sums[0] = *(d_first + (e - 1));
+                    continue;
+                }
+                T sum = *(first + b);
+                for (size_t k = b + 1; k < e; ++k) {
+                    sum = op(sum, *(first + k));
+                }
+                sums[i] = sum;
+            }
+        });
+
+    for (size_t i = 1; i + 1 < chunks; ++i) {
+        sums[i] = op(sums[i - 1], sums[i]); // NOTE: before chunk i + 1
+    }
+
+    parallel_for(pool, size_t(1), chunks, size_t(1),
+        [first, d_first, n, chunks, &sums, &op](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const size_t b = detail::chunk_begin(n, chunks, i);
+                const size_t e = detail::chunk_begin(n, chunks, i + 1);
+                T sum          = sums[i - 1];
+                for (size_t k = b; k < e; ++k) {
+                    sum = op(sum, *(first + k));
+                    *(d_first + k) = sum;
+                }
+            }
+        });
+    return d_first + n;
+}
+
 } // namespace Agentpp
 
 #endif // agent_pp_threadpool_hpp_
@@ -44,10 +44,18 @@ using namespace Agentpp;
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread_only.hpp>
 
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 
+#ifdef USE_AGENTPP_CK
+#    include <sched.h>    // sched_getcpu()
+#    include <sys/stat.h> // mkdir()
+#endif
+
 #if !defined BOOST_THREAD_TEST_TIME_MS
 #    if defined(__linux__) || defined(__APPLE__)
 #        define BOOST_THREAD_TEST_TIME_MS 75
@@ -564,6 +572,649 @@ BOOST_AUTO_TEST_CASE(QueuedThreadPoolIndependency_test)
     TestTask::reset_counter();
 }
 
+#ifdef USE_AGENTPP_CK
+BOOST_AUTO_TEST_CASE(ThreadPoolBulk_test)
+{
+    result_queue_t result;
+    {
+        ThreadPool threadPool(2UL);
+        QueuedThreadPool queuedThreadPool(2UL);
+
+        std::vector<Runnable*> tasks;
+        for (size_t i = 0; i < 16; ++i) {
+            tasks.push_back(new TestTask("Bulk ...", result, 1));
+        }
+        threadPool.execute_bulk(&tasks[0], 8);
+        queuedThreadPool.execute_bulk(&tasks[8], 8);
+
+        do {
+            BOOST_TEST_MESSAGE(
+                "outstanding tasks: " << TestTask::task_count());
+            Thread::sleep(BOOST_THREAD_TEST_TIME_MS); // ms
+        } while (!threadPool.is_idle() || !queuedThreadPool.is_idle());
+
+        threadPool.terminate();
+        queuedThreadPool.terminate();
+
+        tasks.assign(1, new TestTask("After terminate ...", result));
+        threadPool.execute_bulk(&tasks[0], 1);
+    }
+    BOOST_TEST(TestTask::task_count() == 0UL, "All task has to be deleted!");
+    BOOST_TEST(TestTask::run_count() == 16UL, "All task has to be executed!");
+    TestTask::reset_counter();
+}
+
+class FanOutTask : public Runnable {
+public:
+    FanOutTask(ThreadPool& tp, result_queue_t& rslt, size_t n)
+        : pool(tp)
+        , result(rslt)
+        , count(n)
+    { }
+
+    void run() BOOST_OVERRIDE
+    {
+        // NOTE: executed from within a task: pushed on the local deque! CK
+        for (size_t i = 0; i < count; ++i) {
+            pool.execute(new TestTask("Fan out ...", result));
+        }
+    }
+
+private:
+    ThreadPool& pool;
+    result_queue_t& result;
+    const size_t count;
+};
+
+BOOST_AUTO_TEST_CASE(WorkStealingThreadPool_test)
+{
+    result_queue_t result;
+    {
+        WorkStealingThreadPool threadPool(4UL);
+
+        BOOST_TEST_MESSAGE("threadPool.size: " << threadPool.size());
+        BOOST_TEST(threadPool.size() == 4UL);
+        BOOST_TEST(threadPool.is_idle());
+        BOOST_TEST(!threadPool.is_busy());
+
+        for (size_t i = 0; i < 4; ++i) {
+            threadPool.execute(new FanOutTask(threadPool, result, 4));
+        }
+        threadPool.execute(new TestTask("Under load now!", result));
+
+        BOOST_TEST(threadPool.wait_for_idle());
+        BOOST_TEST(threadPool.queue_length() == 0UL);
+        BOOST_TEST(!threadPool.is_busy());
+
+        threadPool.terminate();
+        BOOST_TEST(threadPool.size() == 0UL);
+
+        threadPool.execute(new TestTask("After terminate ...", result));
+    }
+    BOOST_TEST(TestTask::task_count() == 0UL, "All task has to be deleted!");
+    BOOST_TEST(TestTask::run_count() == 17UL, "All task has to be executed!");
+    TestTask::reset_counter();
+}
+
+class RendezvousTask : public Runnable {
+public:
+    explicit RendezvousTask(boost::latch& l)
+        : all(l)
+    { }
+
+    void run() BOOST_OVERRIDE { all.count_down_and_wait(); }
+
+private:
+    boost::latch& all;
+};
+
+BOOST_AUTO_TEST_CASE(ThreadPoolStartup_test)
+{
+    const ThreadPool::Startup modes[] = { ThreadPool::EAGER,
+        ThreadPool::PARALLEL, ThreadPool::LAZY };
+    const size_t threadCount = 40;
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        ThreadPool threadPool(threadCount, AGENTPP_DEFAULT_STACKSIZE, modes[m]);
+
+        BOOST_TEST_MESSAGE("threadPool.size: " << threadPool.size());
+        BOOST_TEST(threadPool.size()
+            == (modes[m] == ThreadPool::LAZY ? 0UL : threadCount));
+        BOOST_TEST(threadPool.is_idle());
+        BOOST_TEST(!threadPool.is_busy());
+
+        // NOTE: the tasks end only if all of them run at the same time! CK
+        boost::latch all(threadCount);
+        for (size_t i = 0; i < threadCount; ++i) {
+            threadPool.execute(new RendezvousTask(all));
+        }
+        all.wait();
+        BOOST_TEST(threadPool.size() == threadCount);
+
+        threadPool.terminate();
+        BOOST_TEST(threadPool.size() == 0UL);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(QueuedThreadPoolElastic_test)
+{
+    const size_t maxThreads = 8;
+    {
+        // NOTE: the latch must outlive the threads waiting on it! CK
+        boost::latch all(maxThreads);
+        QueuedThreadPool elastic(PoolSizing(1, maxThreads, 50)); // ms
+        BOOST_TEST(elastic.size() == 1UL);
+        BOOST_TEST(elastic.peak_size() == 1UL);
+
+        // NOTE: the tasks end only if the pool grows to its max size! CK
+        for (size_t i = 0; i < maxThreads; ++i) {
+            elastic.execute(new RendezvousTask(all));
+        }
+        all.wait();
+        BOOST_TEST(elastic.size() == maxThreads);
+        BOOST_TEST(elastic.peak_size() == maxThreads);
+
+        // NOTE: the idle threads above the min size time out! CK
+        for (size_t i = 0; i < 100 && elastic.size() > 1; ++i) {
+            Thread::sleep(BOOST_THREAD_TEST_TIME_MS); // ms
+        }
+        BOOST_TEST_MESSAGE("elastic.size: " << elastic.size());
+        BOOST_TEST(elastic.size() == 1UL);
+        BOOST_TEST(elastic.peak_size() == maxThreads);
+        BOOST_TEST(elastic.is_idle());
+    }
+
+    {
+        // NOTE: the queue threshold is never reached, the watchdog has
+        // to grow the pool for the second task! CK
+        boost::latch both(2);
+        QueuedThreadPool watched(PoolSizing(1, 2, 1000, 100, 20)); // ms
+        watched.execute(new RendezvousTask(both));
+        watched.execute(new RendezvousTask(both));
+        both.wait();
+        BOOST_TEST(watched.size() == 2UL);
+        BOOST_TEST(watched.peak_size() == 2UL);
+    }
+}
+
+class OrderTask : public Runnable {
+public:
+    OrderTask(std::vector<int>& o, boost::mutex& m, int i)
+        : order(o)
+        , lock(m)
+        , id(i)
+    { }
+
+    void run() BOOST_OVERRIDE
+    {
+        boost::lock_guard<boost::mutex> l(lock);
+        order.push_back(id);
+    }
+
+private:
+    std::vector<int>& order;
+    boost::mutex& lock;
+    const int id;
+};
+
+BOOST_AUTO_TEST_CASE(PriorityTaskQueue_test)
+{
+    std::vector<int> order;
+    boost::mutex lock;
+    {
+        PriorityTaskQueue queue(0); // NOTE: no aging
+        BOOST_TEST(queue.push(new OrderTask(order, lock, 1), 1));
+        BOOST_TEST(queue.push(new OrderTask(order, lock, 2), 5));
+        BOOST_TEST(queue.push(new OrderTask(order, lock, 3)));
+        BOOST_TEST(queue.push(new OrderTask(order, lock, 4), 5));
+        BOOST_TEST(queue.push(new OrderTask(order, lock, 5), -1));
+        BOOST_TEST(queue.size() == 5UL);
+
+        // NOTE: the highest priority first, FIFO for the same one! CK
+        const int expected[] = { 2, 4, 1, 3, 5 };
+        for (size_t i = 0; i < 5; ++i) {
+            Runnable* t = queue.pop();
+            t->run();
+            delete t;
+            queue.done();
+            BOOST_TEST(order[i] == expected[i]);
+        }
+        BOOST_TEST(queue.is_idle());
+
+        BOOST_TEST(queue.push(new OrderTask(order, lock, 6), 1));
+        queue.close();
+        Runnable* rejected = new OrderTask(order, lock, 7);
+        BOOST_TEST(!queue.push(rejected, 9));
+        delete rejected;
+        // NOTE: the destructor deletes the queued task 6
+    }
+    order.clear();
+
+    {
+        PriorityTaskQueue aging(10); // ms
+        BOOST_TEST(aging.get_aging() == 10UL);
+        BOOST_TEST(aging.push(new OrderTask(order, lock, 1), 0));
+        Thread::sleep(5 * 10); // ms
+        BOOST_TEST(aging.push(new OrderTask(order, lock, 2), 2));
+
+        // NOTE: the older task has gained more than 2 levels! CK
+        for (size_t i = 0; i < 2; ++i) {
+            Runnable* t = aging.pop();
+            t->run();
+            delete t;
+            aging.done();
+        }
+        BOOST_TEST(order[0] == 1);
+        BOOST_TEST(order[1] == 2);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(PriorityQueuedThreadPool_test)
+{
+    std::vector<int> order;
+    boost::mutex lock;
+    {
+        PriorityQueuedThreadPool threadPool(1UL, 0UL);
+        BOOST_TEST(threadPool.size() == 1UL);
+        BOOST_TEST(threadPool.get_aging() == 0UL);
+
+        // NOTE: the only thread waits until all tasks are queued! CK
+        boost::latch gate(2);
+        threadPool.execute(new RendezvousTask(gate));
+        while (threadPool.queue_length() > 0) {
+            Thread::sleep(1); // ms
+        }
+        for (int i = 0; i < 8; ++i) {
+            threadPool.execute(new OrderTask(order, lock, i));
+        }
+        threadPool.execute(new OrderTask(order, lock, 100), 10);
+        threadPool.execute(new OrderTask(order, lock, 101), 10);
+        BOOST_TEST(threadPool.queue_length() == 10UL);
+        gate.count_down_and_wait();
+
+        do {
+            Thread::sleep(BOOST_THREAD_TEST_TIME_MS); // ms
+        } while (!threadPool.is_idle());
+
+        boost::lock_guard<boost::mutex> l(lock);
+        BOOST_TEST(order.size() == 10UL);
+        BOOST_TEST(order[0] == 100);
+        BOOST_TEST(order[1] == 101);
+        BOOST_TEST(order[2] == 0);
+        BOOST_TEST(order[9] == 7);
+    }
+
+    {
+        PriorityQueuedThreadPool elastic(PoolSizing(1, 4, 50));
+        BOOST_TEST(elastic.get_aging() == AGENTPP_PRIORITY_AGING_MS);
+        boost::latch all(4);
+        for (int i = 0; i < 4; ++i) {
+            elastic.execute(new RendezvousTask(all), i);
+        }
+        all.wait();
+        BOOST_TEST(elastic.peak_size() == 4UL);
+
+        elastic.terminate();
+        elastic.execute(new OrderTask(order, lock, 200), 1);
+        BOOST_TEST(elastic.queue_length() == 0UL);
+    }
+}
+
+namespace
+{
+
+// NOTE: 2 nodes with 2 cores of 2 hardware threads each, numbered like
+// on Linux: cpu0 and cpu4 are siblings on node 0! CK
+const char* const fake_sysfs[][2] = {
+    { "cpu/online", "0-7" },
+    { "node/online", "0-1" },
+    { "node/node0/cpulist", "0-1,4-5" },
+    { "node/node1/cpulist", "2-3,6-7" },
+};
+
+std::string fake_topology_root()
+{
+    char root[] = "/tmp/threads_test_sysfs_XXXXXX";
+    BOOST_REQUIRE(mkdtemp(root) != NULL);
+    const std::string dir(root);
+
+    const char* const dirs[] = { "/cpu", "/node", "/node/node0",
+        "/node/node1" };
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); ++i) {
+        BOOST_REQUIRE(mkdir((dir + dirs[i]).c_str(), 0700) == 0);
+    }
+    for (size_t i = 0; i < sizeof(fake_sysfs) / sizeof(fake_sysfs[0]); ++i) {
+        std::ofstream((dir + "/" + fake_sysfs[i][0]).c_str())
+            << fake_sysfs[i][1] << "\n";
+    }
+    for (int cpu = 0; cpu < 8; ++cpu) {
+        const std::string topology = dir + "/cpu/cpu"
+            + boost::lexical_cast<std::string>(cpu) + "/topology";
+        BOOST_REQUIRE(mkdir(topology.substr(0, topology.rfind('/')).c_str(),
+                          0700)
+            == 0);
+        BOOST_REQUIRE(mkdir(topology.c_str(), 0700) == 0);
+        std::ofstream((topology + "/physical_package_id").c_str())
+            << (cpu / 2) % 2 << "\n";
+        std::ofstream((topology + "/core_id").c_str()) << cpu % 2 << "\n";
+    }
+    return dir;
+}
+
+int cpu_of(const Affinity& affinity, size_t i, const CpuTopology& topology)
+{
+    const std::vector<int> cpus = affinity.cpus_of(i, topology);
+    return (cpus.size() == 1) ? cpus[0] : -1;
+}
+
+class CpuTask : public Runnable {
+public:
+    CpuTask(boost::latch& l, boost::atomic<int>& c)
+        : done(l)
+        , cpu(c)
+    { }
+
+    void run() BOOST_OVERRIDE
+    {
+        cpu.store(sched_getcpu());
+        done.count_down();
+    }
+
+private:
+    boost::latch& done;
+    boost::atomic<int>& cpu;
+};
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(CpuTopology_test)
+{
+    const std::string root = fake_topology_root();
+    const CpuTopology topology(root.c_str());
+    (void)std::system(("rm -rf " + root).c_str());
+
+    BOOST_TEST(topology.cpus().size() == 8UL);
+    BOOST_TEST(topology.nodes().size() == 2UL);
+    BOOST_TEST(topology.node_of(4) == 0);
+    BOOST_TEST(topology.node_of(6) == 1);
+    BOOST_TEST(topology.node_of(8) == -1);
+    BOOST_TEST(topology.node_cpus(1).size() == 4UL);
+
+    BOOST_TEST(Affinity().cpus_of(0, topology).empty());
+
+    // NOTE: the siblings of a core first, then the next core! CK
+    const Affinity compact(Affinity::COMPACT);
+    const int compactOrder[] = { 0, 4, 1, 5, 2, 6, 3, 7, 0 };
+    for (size_t i = 0; i < sizeof(compactOrder) / sizeof(int); ++i) {
+        BOOST_TEST(cpu_of(compact, i, topology) == compactOrder[i]);
+    }
+
+    // NOTE: one thread per node, then per core, then the siblings! CK
+    const Affinity scatter(Affinity::SCATTER);
+    const int scatterOrder[] = { 0, 2, 1, 3, 4, 6, 5, 7, 0 };
+    for (size_t i = 0; i < sizeof(scatterOrder) / sizeof(int); ++i) {
+        BOOST_TEST(cpu_of(scatter, i, topology) == scatterOrder[i]);
+    }
+
+    std::vector<int> cpus;
+    cpus.push_back(5);
+    cpus.push_back(42); // NOTE: not online, ignored
+    cpus.push_back(7);
+    const Affinity set = Affinity::cpu_set(cpus);
+    BOOST_TEST(cpu_of(set, 0, topology) == 5);
+    BOOST_TEST(cpu_of(set, 1, topology) == 7);
+    BOOST_TEST(cpu_of(set, 2, topology) == 5);
+
+    const std::vector<int> node = Affinity::numa_node(1).cpus_of(3, topology);
+    BOOST_TEST(node.size() == 4UL);
+    BOOST_TEST(node[0] == 2);
+    BOOST_TEST(node[3] == 7);
+}
+
+BOOST_AUTO_TEST_CASE(ThreadPoolAffinity_test)
+{
+    const CpuTopology& topology = CpuTopology::instance();
+    BOOST_TEST_MESSAGE("cpus: " << topology.cpus().size()
+                                << " nodes: " << topology.nodes().size());
+    BOOST_REQUIRE(!topology.cpus().empty());
+    BOOST_TEST(topology.node_of(topology.cpus()[0].id) >= 0);
+
+    const int last = topology.cpus().back().id;
+    std::vector<int> cpus(1, last);
+    ThreadPool pinned(2UL, AGENTPP_DEFAULT_STACKSIZE, ThreadPool::LAZY,
+        Affinity::cpu_set(cpus));
+    BOOST_TEST(pinned.get_affinity().policy == Affinity::CPU_SET);
+
+    for (size_t i = 0; i < 4; ++i) {
+        boost::latch done(1);
+        boost::atomic<int> cpu(-1);
+        pinned.execute(new CpuTask(done, cpu));
+        done.wait();
+        BOOST_TEST(cpu.load() == last);
+    }
+
+    const Affinity::Policy policies[] = { Affinity::COMPACT,
+        Affinity::SCATTER };
+    for (size_t p = 0; p < 2; ++p) {
+        boost::latch all(4); // NOTE: destroyed after the pool
+        ThreadPool placed(4UL, AGENTPP_DEFAULT_STACKSIZE, ThreadPool::EAGER,
+            Affinity(policies[p]));
+        for (size_t i = 0; i < 4; ++i) {
+            placed.execute(new RendezvousTask(all));
+        }
+        all.wait();
+        BOOST_TEST(placed.size() == 4UL);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(QueuedThreadPoolOverflow_test)
+{
+    result_queue_t result;
+    {
+        // NOTE: without any worker thread, the queues only fill up! CK
+        QueuedThreadPool rejecting(
+            0UL, AGENTPP_DEFAULT_STACKSIZE, 4UL, TaskQueue::REJECT);
+        BOOST_TEST(rejecting.queue_capacity() == 4UL);
+        for (size_t i = 0; i < 4; ++i) {
+            BOOST_TEST(rejecting.try_execute(new TestTask("Queued", result)));
+        }
+        TestTask* rejected = new TestTask("Rejected!", result);
+        BOOST_TEST(!rejecting.try_execute(rejected));
+        delete rejected;
+        rejecting.execute(new TestTask("Rejected and deleted!", result));
+        BOOST_TEST(rejecting.queue_length() == 4UL);
+        BOOST_TEST(TestTask::task_count() == 4UL);
+
+        QueuedThreadPool dropping(
+            0UL, AGENTPP_DEFAULT_STACKSIZE, 4UL, TaskQueue::DROP_OLDEST);
+        for (size_t i = 0; i < 6; ++i) {
+            dropping.execute(new TestTask("Queued or dropped", result));
+        }
+        BOOST_TEST(dropping.queue_length() == 4UL);
+        BOOST_TEST(TestTask::task_count() == 8UL);
+
+        QueuedThreadPool running(
+            0UL, AGENTPP_DEFAULT_STACKSIZE, 4UL, TaskQueue::RUN_IN_CALLER);
+        for (size_t i = 0; i < 6; ++i) {
+            running.execute(new TestTask("Queued or run", result));
+        }
+        BOOST_TEST(running.queue_length() == 4UL);
+        BOOST_TEST(TestTask::task_count() == 12UL);
+        BOOST_TEST(TestTask::run_count() == 2UL);
+    }
+    BOOST_TEST(TestTask::task_count() == 0UL, "All task has to be deleted!");
+    BOOST_TEST(TestTask::run_count() == 2UL);
+    TestTask::reset_counter();
+
+    {
+        QueuedThreadPool blocking(
+            2UL, AGENTPP_DEFAULT_STACKSIZE, 2UL, TaskQueue::BLOCK);
+        for (size_t i = 0; i < 16; ++i) {
+            blocking.execute(new TestTask("Blocking ...", result, 1));
+            BOOST_TEST(blocking.queue_length() <= 2UL);
+        }
+
+        BOOST_TEST(blocking.wait_for_idle());
+        BOOST_TEST(TestTask::run_count() == 16UL);
+
+        blocking.terminate();
+    }
+    BOOST_TEST(TestTask::task_count() == 0UL, "All task has to be deleted!");
+    BOOST_TEST(TestTask::run_count() == 16UL, "All task has to be executed!");
+    TestTask::reset_counter();
+}
+
+class SleepTask : public Runnable {
+public:
+    SleepTask(boost::latch& l, unsigned ms_delay)
+        : started(l)
+        , delay(ms_delay)
+    { }
+
+    void run() BOOST_OVERRIDE
+    {
+        started.count_down();
+        Thread::sleep(delay);
+    }
+
+private:
+    boost::latch& started;
+    const unsigned delay;
+};
+
+void wait_for_idle_test(ThreadPool& pool, result_queue_t& result)
+{
+    for (size_t i = 0; i < 8; ++i) {
+        pool.execute(new TestTask("Wait for idle ...", result));
+    }
+    BOOST_TEST(pool.wait_for_idle());
+    BOOST_TEST(TestTask::run_count() == 8UL); // NOTE: not before! CK
+    BOOST_TEST(pool.is_idle());
+
+    boost::latch started(1);
+    pool.execute(new SleepTask(started, BOOST_THREAD_TEST_TIME_MS));
+    started.wait();
+    BOOST_TEST(!pool.wait_for_idle(Synchronized::deadline(1)));
+    BOOST_TEST(pool.wait_for_idle(Synchronized::deadline(10000)));
+
+    pool.terminate();
+    BOOST_TEST(!pool.wait_for_idle()); // NOTE: does not block! CK
+    BOOST_TEST(TestTask::task_count() == 0UL, "All task has to be deleted!");
+    TestTask::reset_counter();
+}
+
+BOOST_AUTO_TEST_CASE(ThreadPoolWaitForIdle_test)
+{
+    result_queue_t result;
+    {
+        ThreadPool threadPool(2UL);
+        wait_for_idle_test(threadPool, result);
+    }
+    {
+        QueuedThreadPool queuedThreadPool(2UL);
+        wait_for_idle_test(queuedThreadPool, result);
+    }
+    {
+        boost::latch started(1);
+        WorkStealingThreadPool workStealing(2UL);
+        workStealing.execute(
+            new SleepTask(started, BOOST_THREAD_TEST_TIME_MS));
+        started.wait();
+        BOOST_TEST(!workStealing.is_busy()); // NOTE: one thread is idle
+        wait_for_idle_test(workStealing, result);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ThreadPoolShutdown_test)
+{
+    result_queue_t result;
+    {
+        ThreadPool threadPool(2UL);
+        for (size_t i = 0; i < 4; ++i) {
+            threadPool.execute(new TestTask("Drained", result));
+        }
+        BOOST_TEST(threadPool.shutdown(ThreadPool::DRAIN));
+        BOOST_TEST(threadPool.size() == 0UL);
+        threadPool.execute(new TestTask("After shutdown ...", result));
+    }
+    BOOST_TEST(TestTask::task_count() == 0UL, "All task has to be deleted!");
+    BOOST_TEST(TestTask::run_count() == 4UL, "All task has to be executed!");
+    TestTask::reset_counter();
+
+    {
+        boost::latch started(1);
+        QueuedThreadPool queuedThreadPool(1UL);
+        queuedThreadPool.execute(
+            new SleepTask(started, BOOST_THREAD_TEST_TIME_MS));
+        for (size_t i = 0; i < 4; ++i) {
+            queuedThreadPool.execute(new TestTask("Drained", result));
+        }
+        started.wait();
+        BOOST_TEST(queuedThreadPool.shutdown(ThreadPool::DRAIN));
+        BOOST_TEST(TestTask::run_count() == 4UL);
+        queuedThreadPool.execute(new TestTask("After shutdown ...", result));
+    }
+    BOOST_TEST(TestTask::task_count() == 0UL, "All task has to be deleted!");
+    TestTask::reset_counter();
+
+    {
+        boost::latch started(1);
+        QueuedThreadPool queuedThreadPool(1UL);
+        queuedThreadPool.execute(
+            new SleepTask(started, BOOST_THREAD_TEST_TIME_MS));
+        for (size_t i = 0; i < 4; ++i) {
+            queuedThreadPool.execute(new TestTask("Dropped", result));
+        }
+        started.wait();
+        BOOST_TEST(queuedThreadPool.shutdown(ThreadPool::DROP_QUEUED));
+        BOOST_TEST(queuedThreadPool.size() == 0UL);
+    }
+    BOOST_TEST(TestTask::task_count() == 0UL, "All task has to be deleted!");
+    BOOST_TEST(TestTask::run_count() == 0UL, "No task has to be executed!");
+    TestTask::reset_counter();
+
+    {
+        boost::latch started(1);
+        QueuedThreadPool queuedThreadPool(1UL);
+        queuedThreadPool.execute(
+            new SleepTask(started, BOOST_THREAD_TEST_TIME_MS));
+        for (size_t i = 0; i < 4; ++i) {
+            queuedThreadPool.execute(new TestTask("Timed out", result));
+        }
+        started.wait();
+        // NOTE: the queued tasks are deleted after the deadline! CK
+        BOOST_TEST(!queuedThreadPool.shutdown(
+            ThreadPool::DRAIN, Synchronized::deadline(1)));
+        BOOST_TEST(TestTask::task_count() == 0UL);
+
+        queuedThreadPool.terminate();
+    }
+    BOOST_TEST(TestTask::run_count() == 0UL, "No task has to be executed!");
+    TestTask::reset_counter();
+
+    {
+        boost::latch started(2);
+        WorkStealingThreadPool workStealing(2UL);
+        workStealing.execute(
+            new SleepTask(started, BOOST_THREAD_TEST_TIME_MS));
+        workStealing.execute(
+            new SleepTask(started, BOOST_THREAD_TEST_TIME_MS));
+        started.wait();
+        for (size_t i = 0; i < 4; ++i) {
+            workStealing.execute(new TestTask("Cancelled", result));
+        }
+        BOOST_TEST(!workStealing.shutdown(ThreadPool::CANCEL_NOW));
+        workStealing.execute(new TestTask("After shutdown ...", result));
+
+        workStealing.terminate();
+        BOOST_TEST(workStealing.size() == 0UL);
+    }
+    BOOST_TEST(TestTask::task_count() == 0UL, "All task has to be deleted!");
+    BOOST_TEST(TestTask::run_count() == 0UL, "No task has to be executed!");
+    TestTask::reset_counter();
+}
+#endif
+
 BOOST_AUTO_TEST_CASE(Synchronized_test)
 {
     Synchronized sync;
@@ -680,6 +1331,66 @@ BOOST_AUTO_TEST_CASE(SyncWait_test)
 }
 #endif
 
+#ifndef _WIN32
+struct TimedLockHandover {
+    Synchronized sync;
+    boost::latch* locked;
+    time_point released; // NOTE: written with lock, read by the next owner
+};
+
+void hold_and_release(TimedLockHandover* h)
+{
+    h->sync.lock();
+    h->locked->count_down();
+    boost::this_thread::sleep_for(ms(1));
+    h->released = Clock::now();
+    h->sync.unlock();
+}
+
+BOOST_AUTO_TEST_CASE(SyncTimedLockLatency_test)
+{
+    // latency from unlock() to the return of a waiting lock(timeout)
+    const ns limits[] = { ns(10000), ns(100000), ns(ms(1)), ns(ms(10)) };
+    const size_t buckets = sizeof(limits) / sizeof(limits[0]) + 1;
+    const size_t rounds  = 200;
+    size_t histogram[buckets] = {};
+    std::vector<ns> latency;
+
+    TimedLockHandover h;
+    for (size_t i = 0; i < rounds; ++i) {
+        boost::latch locked(1);
+        h.locked = &locked;
+        boost::thread t(hold_and_release, &h);
+        locked.wait();
+
+        BOOST_TEST(h.sync.lock(1000), "timeout occurred on lock!");
+        const ns d = Clock::now() - h.released;
+        BOOST_TEST(h.sync.unlock());
+        t.join();
+
+        size_t b = 0;
+        while (b < buckets - 1 && d >= limits[b]) {
+            ++b;
+        }
+        ++histogram[b];
+        latency.push_back(d);
+    }
+
+    BOOST_TEST_MESSAGE(BOOST_CURRENT_FUNCTION);
+    BOOST_TEST_MESSAGE("   < 10us: " << histogram[0]);
+    BOOST_TEST_MESSAGE("  < 100us: " << histogram[1]);
+    BOOST_TEST_MESSAGE("    < 1ms: " << histogram[2]);
+    BOOST_TEST_MESSAGE("   < 10ms: " << histogram[3]);
+    BOOST_TEST_MESSAGE("  >= 10ms: " << histogram[4]);
+
+    // NOTE: a lock(timeout) polling every 10 ms has a median of 5 ms! CK
+    std::nth_element(
+        latency.begin(), latency.begin() + rounds / 2, latency.end());
+    BOOST_TEST_MESSAGE("median: " << latency[rounds / 2]);
+    BOOST_TEST(latency[rounds / 2] < ns(ms(2)));
+}
+#endif
+
 class BadTask : public Runnable {
 private:
     Synchronized sync;